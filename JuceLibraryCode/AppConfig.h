@@ -446,13 +446,13 @@
  #define JucePlugin_VSTNumMidiOutputs      16
 #endif
 #ifndef  JucePlugin_MaxNumInputChannels
- #define JucePlugin_MaxNumInputChannels    2
+ #define JucePlugin_MaxNumInputChannels    16
 #endif
 #ifndef  JucePlugin_MaxNumOutputChannels
- #define JucePlugin_MaxNumOutputChannels   2
+ #define JucePlugin_MaxNumOutputChannels   16
 #endif
 #ifndef  JucePlugin_PreferredChannelConfigurations
- #define JucePlugin_PreferredChannelConfigurations  {1, 1}, {2, 2}, {1, 2}
+ #define JucePlugin_PreferredChannelConfigurations  {1, 1}, {2, 2}, {1, 2}, {1, 4}, {4, 4}, {1, 9}, {9, 9}, {1, 16}, {16, 16}, {2, 6}, {6, 6}, {2, 8}, {8, 8}
 #endif
 
 //==============================================================================
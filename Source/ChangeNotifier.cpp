@@ -27,7 +27,7 @@ ChangeNotifier::ChangeNotifier() :
   _changePending(0),
   _timerInterval(100)
 {
-  startTimer(_timerInterval);
+  // The timer only runs while somebody is listening (e.g. most agents never get any listener)
 }
   
 
@@ -52,6 +52,10 @@ void ChangeNotifier::addNotificationListener(ChangeNotifier::Listener* listener)
   {
     juce::ScopedLock lock(_listenersMutex);
     _listeners.insert(listener);
+    if (!isTimerRunning())
+    {
+      startTimer(_timerInterval);
+    }
   }
 }
 
@@ -62,6 +66,10 @@ void ChangeNotifier::removeNotificationListener(ChangeNotifier::Listener* listen
   {
     juce::ScopedLock lock(_listenersMutex);
     _listeners.erase(listener);
+    if (_listeners.empty())
+    {
+      stopTimer();
+    }
   }
 }
   
@@ -30,6 +30,9 @@
 * The difference to the juce::ChangeBroadcaster is that notifying about
 * changes doesn't involve any blocking calls (e.g. malloc() etc.), so it
 * safe to call even from realtime threads.
+*
+* The timer polling for changes only runs while there are listeners, changes
+* notified meanwhile are passed on as soon as the first listener is added.
 */
 class ChangeNotifier : public juce::Timer
 {
@@ -0,0 +1,626 @@
+// ==================================================================================
+// Copyright (c) 2012 HiFi-LoFi
+//
+// This is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+// ==================================================================================
+
+#include "ConvolutionEngine.h"
+
+#include "Parameters.h"
+#include "Processor.h"
+
+#include <algorithm>
+#include <cmath>
+#include <set>
+
+
+// Number of recent input samples kept for warming up new convolvers (power of 2)
+static const size_t HistorySize = 1 << 17;
+
+// Number of samples fed into a new convolver at once while warming it up
+static const size_t WarmUpChunkSize = 4096;
+
+// Size of the buffer for each output of the fading convolver
+static const size_t CrossfadeBufferSize = 1024;
+
+// Duration of a crossfade between two convolvers
+static const double CrossfadeSeconds = 0.05;
+
+// Interval of keeping a warmed up convolver up to date until the audio thread takes it over
+static const int HandOverIntervalMs = 1;
+
+// Interval of deleting the convolvers which aren't used anymore
+static const int ReclaimIntervalMs = 100;
+
+
+ConvolutionEngine::ConvolutionEngine(Processor& processor) :
+  juce::Timer(),
+  _processor(processor),
+  _inputCount(0),
+  _outputCount(0),
+  _agentMatrix(),
+  _convolverKey(),
+  _convolver(nullptr),
+  _handOverState(HandOverDone),
+  _retiredConvolversMutex(),
+  _retiredConvolvers(),
+  _activeConvolver(nullptr),
+  _fadingConvolver(nullptr),
+  _crossfading(false),
+  _crossfadePos(0),
+  _crossfadeLength(1),
+  _crossfadeBuffer(),
+  _crossfadeOutputs(),
+  _offsetInputs(),
+  _autoGain(1.0f),
+  _activeAutoGain(1.0f),
+  _fadingAutoGain(1.0f),
+  _blockSize(0),
+  _maxCatchUpLength(0),
+  _history(),
+  _historyEnd(0),
+  _eqLo(),
+  _eqHi()
+{
+  _convolversInUse[0].store(nullptr);
+  _convolversInUse[1].store(nullptr);
+  startTimer(ReclaimIntervalMs);
+}
+
+
+ConvolutionEngine::~ConvolutionEngine()
+{
+  stopTimer();
+
+  // The audio thread isn't running anymore, so all convolvers can be deleted now
+  deleteConvolvers();
+}
+
+
+size_t ConvolutionEngine::getInputCount() const
+{
+  return _inputCount;
+}
+
+
+size_t ConvolutionEngine::getOutputCount() const
+{
+  return _outputCount;
+}
+
+
+IRAgent* ConvolutionEngine::getAgent(size_t input, size_t output) const
+{
+  return (input < _inputCount && output < _outputCount) ? _agentMatrix[input * _outputCount + output] : nullptr;
+}
+
+
+void ConvolutionEngine::initialize(size_t inputCount, size_t outputCount)
+{
+  if (inputCount != _inputCount || outputCount != _outputCount)
+  {
+    // The convolvers are laid out for the previous channels, so they can't be
+    // used anymore (the IR calculation sets up new ones)
+    deleteConvolvers();
+    _convolverKey = juce::String();
+    _convolversInUse[0].store(nullptr);
+    _convolversInUse[1].store(nullptr);
+    _crossfading = false;
+    _crossfadePos = 0;
+    _autoGain.initializeValue(1.0f);
+    _activeAutoGain = 1.0f;
+    _fadingAutoGain = 1.0f;
+
+    _inputCount = inputCount;
+    _outputCount = outputCount;
+
+    _crossfadeBuffer.assign(_outputCount * CrossfadeBufferSize, 0.0f);
+    _crossfadeOutputs.assign(_outputCount, nullptr);
+    for (size_t i=0; i<_crossfadeOutputs.size(); ++i)
+    {
+      _crossfadeOutputs[i] = &_crossfadeBuffer[i * CrossfadeBufferSize];
+    }
+    _offsetInputs.assign(_inputCount, nullptr);
+    _history.assign(_inputCount * HistorySize, 0.0f);
+    _historyEnd.store(0);
+    _eqLo.assign(_outputCount, CookbookEq(CookbookEq::HiPass2, Parameters::EqLowCutFreq.getMinValue(), 1.0f));
+    _eqHi.assign(_outputCount, CookbookEq(CookbookEq::LoPass2, Parameters::EqHighCutFreq.getMaxValue(), 1.0f));
+  }
+
+  // Pairs of input and output channel without agent stay unconnected (the processor
+  // might have created agents since the last time)
+  const IRAgentContainer agents = _processor.getAgents();
+  _agentMatrix.assign(_inputCount * _outputCount, nullptr);
+  for (size_t i=0; i<agents.size(); ++i)
+  {
+    const size_t input = agents[i]->getInputChannel();
+    const size_t output = agents[i]->getOutputChannel();
+    if (input < _inputCount && output < _outputCount)
+    {
+      _agentMatrix[input * _outputCount + output] = agents[i];
+    }
+  }
+
+  const float eqSampleRate = static_cast<float>(_processor.getSampleRate());
+  const size_t eqBlockSize = _processor.getConvolverHeadBlockSize();
+
+  const int eqLowType = _processor.getParameter(Parameters::EqLowType);
+  const int eqHighType = _processor.getParameter(Parameters::EqHighType);
+  for (size_t i=0; i<_outputCount; ++i)
+  {
+    if (eqLowType == Parameters::Cut)
+    {
+      _eqLo[i].setType(CookbookEq::HiPass2);
+      _eqLo[i].setFreq(_processor.getParameter(Parameters::EqLowCutFreq));
+    }
+    else if (eqLowType == Parameters::Shelf)
+    {
+      _eqLo[i].setType(CookbookEq::LoShelf);
+      _eqLo[i].setFreq(_processor.getParameter(Parameters::EqLowShelfFreq));
+      _eqLo[i].setGain(_processor.getParameter(Parameters::EqLowShelfDecibels));
+    }
+
+    if (eqHighType == Parameters::Cut)
+    {
+      _eqHi[i].setType(CookbookEq::LoPass2);
+      _eqHi[i].setFreq(_processor.getParameter(Parameters::EqHighCutFreq));
+    }
+    else if (eqHighType == Parameters::Shelf)
+    {
+      _eqHi[i].setType(CookbookEq::HiShelf);
+      _eqHi[i].setFreq(_processor.getParameter(Parameters::EqHighShelfFreq));
+      _eqHi[i].setGain(_processor.getParameter(Parameters::EqHighShelfDecibels));
+    }
+
+    _eqLo[i].prepareToPlay(eqSampleRate, eqBlockSize);
+    _eqHi[i].prepareToPlay(eqSampleRate, eqBlockSize);
+  }
+
+  _crossfadeLength = std::max(size_t(1), static_cast<size_t>(CrossfadeSeconds * _processor.getSampleRate()));
+  _blockSize = std::max(size_t(1), eqBlockSize);
+  _maxCatchUpLength = _blockSize + static_cast<size_t>(2.0 * HandOverIntervalMs * _processor.getSampleRate() / 1000.0);
+}
+
+
+juce::String& ConvolutionEngine::getConvolverKey()
+{
+  return _convolverKey;
+}
+
+
+bool ConvolutionEngine::setConvolver(Convolver* convolver, size_t warmUpLength)
+{
+  jassert(!convolver || (convolver->getInputCount() == _inputCount && convolver->getOutputCount() == _outputCount));
+  const bool warmingUp = (convolver && convolver->isBackgroundProcessing());
+  if (warmingUp)
+  {
+    warmUp(*convolver, warmUpLength);
+    _handOverState.store(HandOverFeeding);
+  }
+
+  // The audio thread crossfades to the new convolver when it gets aware of it,
+  // the old one is deleted after the crossfade (see reclaimConvolvers())
+  Convolver* oldConvolver = _convolver.exchange(convolver);
+  if (oldConvolver && oldConvolver != convolver)
+  {
+    ScopedLock lock(_retiredConvolversMutex);
+    _retiredConvolvers.push_back(oldConvolver);
+  }
+  reclaimConvolvers();
+
+  return warmingUp ? handOver(*convolver) : true;
+}
+
+
+void ConvolutionEngine::warmUp(Convolver& convolver, size_t warmUpLength)
+{
+  // Feed the new convolver with the recent input, so its output is already
+  // "in the middle of it" when being crossfaded in
+  const juce::int64 warmUpSize = std::min(static_cast<juce::int64>(warmUpLength), static_cast<juce::int64>(HistorySize / 2));
+  convolver.setInputPosition(std::max(juce::int64(0), _historyEnd.load(std::memory_order_acquire) - warmUpSize));
+  feed(convolver);
+}
+
+
+void ConvolutionEngine::feed(Convolver& convolver)
+{
+  // Feed the convolver with the input it has missed so far, and keep on feeding
+  // until it lags behind the audio thread by one block at most
+  const juce::int64 historySize = static_cast<juce::int64>(HistorySize);
+  const juce::int64 blockSize = static_cast<juce::int64>(_blockSize);
+  juce::int64 pos = convolver.getInputPosition();
+  std::vector<float> input;
+  std::vector<const float*> inputs;
+  std::vector<float> output;
+  std::vector<float*> outputs;
+  for (;;)
+  {
+    // Only the input published by the audio thread is read, the audio thread is
+    // meanwhile writing behind it
+    const juce::int64 historyEnd = _historyEnd.load(std::memory_order_acquire);
+    if (historyEnd - pos <= blockSize)
+    {
+      // Let the background jobs started by the feeding finish, so the audio thread
+      // never has to wait for them when feeding the rest, which might take a
+      // while though, so check the lag again afterwards
+      convolver.finishBackgroundProcessing();
+      if (_historyEnd.load(std::memory_order_acquire) - pos <= blockSize)
+      {
+        break;
+      }
+      continue;
+    }
+
+    if (input.empty())
+    {
+      input.resize(_inputCount * WarmUpChunkSize);
+      inputs.resize(_inputCount, nullptr);
+      for (size_t i=0; i<inputs.size(); ++i)
+      {
+        inputs[i] = &input[i * WarmUpChunkSize];
+      }
+      output.resize(_outputCount * WarmUpChunkSize);
+      outputs.resize(_outputCount, nullptr);
+      for (size_t i=0; i<outputs.size(); ++i)
+      {
+        outputs[i] = &output[i * WarmUpChunkSize];
+      }
+    }
+
+    // Skip input which might get overwritten while being copied (only if we're
+    // much slower than realtime, the audio thread would have to write half of
+    // the history meanwhile)
+    pos = std::max(pos, historyEnd - historySize / 2);
+
+    const size_t len = static_cast<size_t>(std::min(static_cast<juce::int64>(WarmUpChunkSize), historyEnd - pos));
+    for (size_t n=0; n<_inputCount; ++n)
+    {
+      const float* history = &_history[n * HistorySize];
+      float* chunk = &input[n * WarmUpChunkSize];
+      for (size_t i=0; i<len; ++i)
+      {
+        chunk[i] = history[static_cast<size_t>(pos + static_cast<juce::int64>(i)) & (HistorySize - 1)];
+      }
+    }
+    if (_historyEnd.load(std::memory_order_acquire) - pos > historySize)
+    {
+      continue; // Overwritten while copying anyway => Try again
+    }
+
+    convolver.process(inputs.data(), outputs.data(), len);
+    pos += static_cast<juce::int64>(len);
+  }
+  convolver.setInputPosition(pos);
+}
+
+
+bool ConvolutionEngine::handOver(Convolver& convolver)
+{
+  // Offer the convolver to the audio thread, and in between keep it up to date
+  // with the input until the audio thread has taken it over, so the audio thread
+  // never has to catch up with more than the input of a few blocks (see takeOver())
+  for (;;)
+  {
+    _handOverState.store(HandOverReady, std::memory_order_release);
+    juce::Thread::sleep(HandOverIntervalMs);
+
+    int ready = HandOverReady;
+    if (!_handOverState.compare_exchange_strong(ready, HandOverFeeding, std::memory_order_acq_rel))
+    {
+      return true;
+    }
+    if (juce::Thread::currentThreadShouldExit())
+    {
+      return false; // Stays HandOverFeeding, so the audio thread never takes it
+    }
+    feed(convolver);
+  }
+}
+
+
+bool ConvolutionEngine::takeOver(Convolver* convolver, juce::int64 historyEnd)
+{
+  // Convolvers which aren't warmed up (silence or offline rendering) are taken as they
+  // are, the others only if they haven't missed more input than the warm-up can
+  // miss between keeping them up to date (see handOver())
+  if (!convolver || !convolver->isBackgroundProcessing())
+  {
+    return true;
+  }
+  if (historyEnd - convolver->getInputPosition() > static_cast<juce::int64>(_maxCatchUpLength))
+  {
+    return false;
+  }
+  int ready = HandOverReady;
+  if (!_handOverState.compare_exchange_strong(ready, HandOverDone, std::memory_order_acq_rel))
+  {
+    return false;
+  }
+  catchUp(*convolver, historyEnd);
+  return true;
+}
+
+
+void ConvolutionEngine::catchUp(Convolver& convolver, juce::int64 historyEnd)
+{
+  // Feed the remaining input the new convolver has missed so far, which is a few
+  // blocks at most (the convolver isn't taken over otherwise, see takeOver())
+  juce::int64 pos = convolver.getInputPosition();
+  jassert(historyEnd - pos <= static_cast<juce::int64>(_maxCatchUpLength));
+  while (pos < historyEnd)
+  {
+    const size_t offset = static_cast<size_t>(pos) & (HistorySize - 1);
+    const size_t len = static_cast<size_t>(std::min(static_cast<juce::int64>(std::min(CrossfadeBufferSize, HistorySize - offset)), historyEnd - pos));
+    for (size_t n=0; n<_inputCount; ++n)
+    {
+      _offsetInputs[n] = &_history[n * HistorySize + offset];
+    }
+    convolver.process(_offsetInputs.data(), _crossfadeOutputs.data(), len);
+    pos += static_cast<juce::int64>(len);
+  }
+  convolver.setInputPosition(historyEnd);
+}
+
+
+void ConvolutionEngine::reclaimConvolvers()
+{
+  // Read the announcements in the opposite order of the audio thread updating them
+  // at the end of a crossfade, so the new convolver is never missed in between
+  ScopedLock lock(_retiredConvolversMutex);
+  const Convolver* inUse1 = _convolversInUse[1].load();
+  const Convolver* inUse0 = _convolversInUse[0].load();
+  for (size_t i=0; i<_retiredConvolvers.size(); )
+  {
+    Convolver* convolver = _retiredConvolvers[i];
+    if (convolver != inUse0 && convolver != inUse1)
+    {
+      delete convolver;
+      _retiredConvolvers.erase(_retiredConvolvers.begin() + i);
+    }
+    else
+    {
+      ++i;
+    }
+  }
+}
+
+
+void ConvolutionEngine::deleteConvolvers()
+{
+  ScopedLock lock(_retiredConvolversMutex);
+  std::set<Convolver*> convolvers(_retiredConvolvers.begin(), _retiredConvolvers.end());
+  convolvers.insert(_convolver.exchange(nullptr));
+  convolvers.insert(_activeConvolver);
+  convolvers.insert(_fadingConvolver);
+  convolvers.erase(nullptr);
+  for (std::set<Convolver*>::iterator it=convolvers.begin(); it!=convolvers.end(); ++it)
+  {
+    delete (*it);
+  }
+  _retiredConvolvers.clear();
+  _activeConvolver = nullptr;
+  _fadingConvolver = nullptr;
+}
+
+
+void ConvolutionEngine::timerCallback()
+{
+  reclaimConvolvers();
+}
+
+
+bool ConvolutionEngine::process(const float* const* inputs, float* const* outputs, size_t len)
+{
+  // Keep the input history up to date (even if there's no convolver at all yet),
+  // the new input is published to the warm-up after it has been written
+  const juce::int64 historyBegin = _historyEnd.load(std::memory_order_relaxed);
+  {
+    const size_t offset = static_cast<size_t>(historyBegin) & (HistorySize - 1);
+    const size_t len0 = std::min(len, HistorySize - offset);
+    for (size_t n=0; n<_inputCount; ++n)
+    {
+      float* history = &_history[n * HistorySize];
+      ::memcpy(history+offset, inputs[n], len0 * sizeof(float));
+      ::memcpy(history, inputs[n]+len0, (len - len0) * sizeof(float));
+    }
+    _historyEnd.store(historyBegin + static_cast<juce::int64>(len), std::memory_order_release);
+  }
+
+  // New convolver available? => Start crossfading to it (unless a crossfade is
+  // running already). The new convolver is announced before being used, and the
+  // swap is checked again afterwards because it might have been replaced in the
+  // meantime (in this case the swapping thread might have missed the announcement).
+  if (!_crossfading)
+  {
+    Convolver* convolver = _convolver.load();
+    if (convolver != _activeConvolver)
+    {
+      _convolversInUse[1].store(convolver);
+      if (convolver == _convolver.load() && takeOver(convolver, historyBegin))
+      {
+        if (convolver && !convolver->isBackgroundProcessing())
+        {
+          // Rendering offline => Switch right away, starting from a clean state
+          _activeConvolver = convolver;
+          _activeAutoGain = getAutoGain(_activeConvolver);
+          _autoGain.initializeValue(_activeAutoGain);
+          _convolversInUse[0].store(_activeConvolver);
+          _convolversInUse[1].store(nullptr);
+        }
+        else
+        {
+          _fadingConvolver = _activeConvolver;
+          _activeConvolver = convolver;
+
+          // The old convolver is faded out with the gain it has been played with, the
+          // new one starts with its own auto gain right away (the crossfade smoothes it)
+          _fadingAutoGain = _activeAutoGain;
+          _activeAutoGain = getAutoGain(_activeConvolver);
+          _autoGain.initializeValue(_activeAutoGain);
+          _crossfading = true;
+          _crossfadePos = 0;
+        }
+      }
+      else
+      {
+        _convolversInUse[1].store(nullptr);
+      }
+    }
+  }
+
+  if (!_activeConvolver && !_fadingConvolver)
+  {
+    return false;
+  }
+
+  if (_activeConvolver)
+  {
+    _activeConvolver->process(inputs, outputs, len);
+
+    // Auto gain (ramped when switched on or off)
+    _autoGain.updateValue(getAutoGain(_activeConvolver));
+    float autoGain0 = 1.0f;
+    float autoGain1 = 1.0f;
+    _autoGain.getSmoothValues(len, autoGain0, autoGain1);
+    if (autoGain0 != 1.0f || autoGain1 != 1.0f)
+    {
+      const float autoGainStep = (autoGain1 - autoGain0) / static_cast<float>(len);
+      for (size_t o=0; o<_outputCount; ++o)
+      {
+        float* output = outputs[o];
+        for (size_t i=0; i<len; ++i)
+        {
+          output[i] *= autoGain0 + autoGainStep * static_cast<float>(i);
+        }
+      }
+    }
+    _activeAutoGain = autoGain1;
+  }
+  else
+  {
+    for (size_t o=0; o<_outputCount; ++o)
+    {
+      ::memset(outputs[o], 0, len * sizeof(float));
+    }
+  }
+
+  // Equal-power crossfade of all outputs from the old convolver to the new one
+  if (_crossfading)
+  {
+    const double Pi2 = 0.5 * 3.14159265358979323846;
+    size_t processed = 0;
+    while (processed < len)
+    {
+      const size_t processing = std::min(len - processed, CrossfadeBufferSize);
+      if (_fadingConvolver)
+      {
+        for (size_t n=0; n<_inputCount; ++n)
+        {
+          _offsetInputs[n] = inputs[n] + processed;
+        }
+        _fadingConvolver->process(_offsetInputs.data(), _crossfadeOutputs.data(), processing);
+      }
+      else
+      {
+        std::fill(_crossfadeBuffer.begin(), _crossfadeBuffer.end(), 0.0f);
+      }
+      for (size_t i=0; i<processing; ++i)
+      {
+        const double x = static_cast<double>(std::min(_crossfadePos, _crossfadeLength)) / static_cast<double>(_crossfadeLength);
+        const float gainIn = static_cast<float>(::sin(Pi2 * x));
+        const float gainOut = _fadingAutoGain * static_cast<float>(::cos(Pi2 * x));
+        for (size_t o=0; o<_outputCount; ++o)
+        {
+          outputs[o][processed+i] = gainIn * outputs[o][processed+i] + gainOut * _crossfadeOutputs[o][i];
+        }
+        ++_crossfadePos;
+      }
+      processed += processing;
+    }
+
+    if (_crossfadePos >= _crossfadeLength)
+    {
+      // Done => The old convolver can be deleted by some non-realtime thread now
+      _crossfading = false;
+      _fadingConvolver = nullptr;
+      _convolversInUse[0].store(_activeConvolver);
+      _convolversInUse[1].store(nullptr);
+    }
+  }
+
+  for (size_t o=0; o<_outputCount; ++o)
+  {
+    equalize(o, outputs[o], len);
+  }
+
+  return true;
+}
+
+
+float ConvolutionEngine::getAutoGain(const Convolver* convolver) const
+{
+  return (convolver && _processor.getParameter(Parameters::AutoGainOn)) ? convolver->getAutoGain() : 1.0f;
+}
+
+
+void ConvolutionEngine::equalize(size_t output, float* data, size_t len)
+{
+  // EQ low
+  const int eqLowType = _processor.getParameter(Parameters::EqLowType);
+  if (eqLowType == Parameters::Cut)
+  {
+    const float eqLowCutFreq = _processor.getParameter(Parameters::EqLowCutFreq);
+    if (::fabs(eqLowCutFreq-Parameters::EqLowCutFreq.getMinValue()) > 0.0001f)
+    {
+      _eqLo[output].setType(CookbookEq::HiPass2);
+      _eqLo[output].setFreq(eqLowCutFreq);
+      _eqLo[output].filterOut(data, len);
+    }
+  }
+  else if (eqLowType == Parameters::Shelf)
+  {
+    const float eqLowShelfDecibels = _processor.getParameter(Parameters::EqLowShelfDecibels);
+    if (::fabs(eqLowShelfDecibels-0.0f) > 0.0001f)
+    {
+      _eqLo[output].setType(CookbookEq::LoShelf);
+      _eqLo[output].setFreq(_processor.getParameter(Parameters::EqLowShelfFreq));
+      _eqLo[output].setGain(eqLowShelfDecibels);
+      _eqLo[output].filterOut(data, len);
+    }
+  }
+
+  // EQ high
+  const int eqHighType = _processor.getParameter(Parameters::EqHighType);
+  if (eqHighType == Parameters::Cut)
+  {
+    const float eqHighCutFreq = _processor.getParameter(Parameters::EqHighCutFreq);
+    if (::fabs(eqHighCutFreq-Parameters::EqHighCutFreq.getMaxValue()) > 0.0001f)
+    {
+      _eqHi[output].setType(CookbookEq::LoPass2);
+      _eqHi[output].setFreq(eqHighCutFreq);
+      _eqHi[output].filterOut(data, len);
+    }
+  }
+  else if (eqHighType == Parameters::Shelf)
+  {
+    const float eqHighShelfDecibels = _processor.getParameter(Parameters::EqHighShelfDecibels);
+    if (::fabs(eqHighShelfDecibels-0.0f) > 0.0001f)
+    {
+      _eqHi[output].setType(CookbookEq::HiShelf);
+      _eqHi[output].setFreq(_processor.getParameter(Parameters::EqHighShelfFreq));
+      _eqHi[output].setGain(eqHighShelfDecibels);
+      _eqHi[output].filterOut(data, len);
+    }
+  }
+}
@@ -0,0 +1,162 @@
+// ==================================================================================
+// Copyright (c) 2012 HiFi-LoFi
+//
+// This is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+// ==================================================================================
+
+#ifndef _CONVOLUTIONENGINE_H
+#define _CONVOLUTIONENGINE_H
+
+#include "JuceHeader.h"
+
+#include "CookbookEq.h"
+#include "Convolver.h"
+#include "IRAgent.h"
+#include "SmoothValue.h"
+
+#include <atomic>
+#include <vector>
+
+
+// Forward declarations
+class Processor;
+
+
+/**
+* @class ConvolutionEngine
+* @brief Convolves all input channels with the impulse responses of all agents
+*
+* The agents form a matrix of impulse responses from the input channels to the output
+* channels, which is processed by one matrix convolver: Each input is transformed only
+* once per block for all agents fed by it, and the products of all inputs feeding an
+* output channel are summed up in the frequency domain, so there's only one backward
+* FFT per output channel. The EQ is applied once per output channel as well.
+*
+* The numbers of input and output channels are those of the host and are set whenever
+* the processor prepares for playing, the agents of the pairs of channels beyond them
+* are ignored. Pairs of channels without impulse response don't cost anything.
+*
+* The convolver is replaced as a whole whenever any of the impulse responses changes:
+* The new convolver is warmed up with the recent input by the IR calculation thread,
+* and the audio thread crossfades all outputs from the old convolver to the new one.
+* Convolvers for offline rendering are installed as they are: Nobody is listening
+* in realtime, and the rendering must not depend on the input played before.
+*
+* The auto gain isn't part of the impulse responses: Each convolver carries the auto
+* gain calculated for its impulse responses, which is applied to its outputs, so
+* switching auto gain on or off just ramps the gain.
+*/
+class ConvolutionEngine : public juce::Timer
+{
+public:
+  explicit ConvolutionEngine(Processor& processor);
+  virtual ~ConvolutionEngine();
+
+  // Inputs/outputs (the agent of a pair of input and output channel might be missing)
+  size_t getInputCount() const;
+  size_t getOutputCount() const;
+  IRAgent* getAgent(size_t input, size_t output) const;
+
+  // Not to be called while processing or while the IR calculation is running
+  void initialize(size_t inputCount, size_t outputCount);
+
+  // Only to be accessed by the IR calculation thread
+  juce::String& getConvolverKey();
+
+  // Hands a new convolver (nullptr: silence) over to the audio thread, warming it up
+  // with (at most) the given number of recent input samples (unless it's one for
+  // offline rendering, i.e. without background processing) and keeping it up to
+  // date until the audio thread takes it over. Returns false if the calling thread
+  // has been asked to exit before, the convolver is never taken over then.
+  bool setConvolver(Convolver* convolver, size_t warmUpLength);
+
+  bool process(const float* const* inputs, float* const* outputs, size_t len);
+
+  virtual void timerCallback();
+
+private:
+  void warmUp(Convolver& convolver, size_t warmUpLength);
+  void feed(Convolver& convolver);
+  bool handOver(Convolver& convolver);
+  bool takeOver(Convolver* convolver, juce::int64 historyEnd);
+  void catchUp(Convolver& convolver, juce::int64 historyEnd);
+  void reclaimConvolvers();
+  void deleteConvolvers();
+  float getAutoGain(const Convolver* convolver) const;
+  void equalize(size_t output, float* data, size_t len);
+
+  Processor& _processor;
+  size_t _inputCount;
+  size_t _outputCount;
+  IRAgentContainer _agentMatrix;
+  juce::String _convolverKey;
+
+  // Convolver hot-swapping: The latest convolver is handed over to the audio thread
+  // by an atomic pointer. The audio thread crossfades from the convolver it's currently
+  // playing to the new one, and it announces the (up to two) convolvers it's using in
+  // _convolversInUse, so replaced convolvers are deleted by a non-realtime thread only
+  // after the audio thread has finished the crossfade (see reclaimConvolvers())
+  std::atomic<Convolver*> _convolver;
+
+  // The warm-up keeps on feeding the latest convolver (HandOverFeeding) and offers it
+  // to the audio thread in between (HandOverReady), which takes it over (HandOverDone)
+  // only if it hasn't missed more than _maxCatchUpLength input samples meanwhile
+  enum HandOverState
+  {
+    HandOverFeeding,
+    HandOverReady,
+    HandOverDone
+  };
+  std::atomic<int> _handOverState;
+
+  std::atomic<Convolver*> _convolversInUse[2];
+  CriticalSection _retiredConvolversMutex;
+  std::vector<Convolver*> _retiredConvolvers;
+
+  // Audio thread only
+  Convolver* _activeConvolver;
+  Convolver* _fadingConvolver;
+  bool _crossfading;
+  size_t _crossfadePos;
+  size_t _crossfadeLength;
+  std::vector<float> _crossfadeBuffer;
+  std::vector<float*> _crossfadeOutputs;
+  std::vector<const float*> _offsetInputs;
+  SmoothValue<float> _autoGain;
+  float _activeAutoGain;
+  float _fadingAutoGain;
+
+  // Block size of the processing calls (at most)
+  size_t _blockSize;
+
+  // Input a convolver may have missed when being taken over by the audio thread: One
+  // block plus the input of two intervals of the warm-up keeping it up to date
+  size_t _maxCatchUpLength;
+
+  // Recent input of all inputs (back to back), used to warm up new convolvers
+  // before crossfading to them: Written by the audio thread only, which publishes
+  // the input up to _historyEnd (release), and the warm-up reads the input before
+  // _historyEnd only (acquire)
+  std::vector<float> _history;
+  std::atomic<juce::int64> _historyEnd;
+
+  std::vector<CookbookEq> _eqLo;
+  std::vector<CookbookEq> _eqHi;
+
+  // Prevent uncontrolled usage
+  ConvolutionEngine(const ConvolutionEngine&);
+  ConvolutionEngine& operator=(const ConvolutionEngine&);
+};
+
+#endif // Header guard
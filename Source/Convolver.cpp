@@ -18,76 +18,143 @@
 #include "Convolver.h"
 
 
-class ConvolverBackgroundThread : public juce::Thread
+Convolver::Convolver(double sampleRate, bool backgroundProcessing) :
+  fftconvolver::MultiStageFFTConvolver(),
+  _scheduler(),
+  _irSpectrumCache(),
+  _backgroundProcessing(backgroundProcessing),
+  _ticksPerSample(static_cast<double>(juce::Time::getHighResolutionTicksPerSecond()) / std::max(1.0, sampleRate)),
+  _inputPosition(0),
+  _autoGain(1.0f),
+  _irKeys(),
+  _pendingStages(0),
+  _scheduledJobs(0),
+  _backgroundProcessingFinishedEvent(false)
 {
-public:
-  explicit ConvolverBackgroundThread(Convolver& convolver) :
-    juce::Thread("ConvolverBackgroundThread"),
-    _convolver(convolver)
+}
+
+
+Convolver::~Convolver()
+{
+  // The workers of the scheduler mustn't touch this convolver anymore
+  _scheduler->waitForJobs(_scheduledJobs);
+}
+
+
+bool Convolver::isBackgroundProcessing() const
+{
+  return _backgroundProcessing;
+}
+
+
+void Convolver::setInputPosition(juce::int64 inputPosition)
+{
+  _inputPosition = inputPosition;
+}
+
+
+juce::int64 Convolver::getInputPosition() const
+{
+  return _inputPosition;
+}
+
+
+void Convolver::setAutoGain(float autoGain)
+{
+  _autoGain = autoGain;
+}
+
+
+float Convolver::getAutoGain() const
+{
+  return _autoGain;
+}
+
+
+void Convolver::setIRKeys(const std::vector<const fftconvolver::Sample*>& irs, const std::vector<size_t>& irLens, const std::vector<juce::String>& irKeys)
+{
+  jassert(irs.size() == irLens.size() && irs.size() == irKeys.size());
+  _irKeys.clear();
+  for (size_t n=0; n<irs.size(); ++n)
   {
-    startThread(8); // Use a priority higher than the priority of normal threads
+    if (irs[n] && irKeys[n].isNotEmpty())
+    {
+      IRKey irKey;
+      irKey.ir = irs[n];
+      irKey.irLen = irLens[n];
+      irKey.key = irKeys[n];
+      _irKeys.push_back(irKey);
+    }
   }
-  
-  
-  virtual ~ConvolverBackgroundThread()
+}
+
+
+void Convolver::finishBackgroundProcessing()
+{
+  while (_pendingStages.load() != 0)
   {
-    signalThreadShouldExit();
-    notify();
-    stopThread(1000);
+    _backgroundProcessingFinishedEvent.wait();
   }
-  
-  
-  virtual void run()
+}
+
+
+std::shared_ptr<const fftconvolver::PartitionedIR> Convolver::createPartitionedIR(size_t blockSize, const fftconvolver::Sample* ir, size_t irLen, fftconvolver::Sample gain)
+{
+  // Share the spectra with all other convolvers using the same impulse response: The
+  // partition is identified by the key of the whole impulse response and its offset
+  juce::String key;
+  for (size_t n=0; n<_irKeys.size(); ++n)
   {
-    while (!threadShouldExit())
+    if (ir >= _irKeys[n].ir && ir + irLen <= _irKeys[n].ir + _irKeys[n].irLen)
     {
-      wait(-1);
-      if (threadShouldExit())
-      {
-        return;
-      }
-      _convolver.doBackgroundProcessing();
-      _convolver._backgroundProcessingFinished.store(1);
-      _convolver._backgroundProcessingFinishedEvent.signal();
+      key = _irKeys[n].key + "@" + juce::String(static_cast<juce::int64>(ir - _irKeys[n].ir));
+      break;
     }
   }
-  
-private:
-  Convolver& _convolver;
-  
-  ConvolverBackgroundThread(const ConvolverBackgroundThread&);
-  ConvolverBackgroundThread& operator=(const ConvolverBackgroundThread&);
-};
-
-
-// =================================================
-
-Convolver::Convolver() :
-  fftconvolver::TwoStageFFTConvolver(),
-  _thread(),
-  _backgroundProcessingFinished(1),
-  _backgroundProcessingFinishedEvent(true)
-{
-  _thread.reset(new ConvolverBackgroundThread(*this));
-  _backgroundProcessingFinishedEvent.signal();
+  return _irSpectrumCache->getPartitionedIR(key, blockSize, ir, irLen, gain);
 }
 
 
-Convolver::~Convolver()
+void Convolver::startBackgroundProcessing(size_t stage)
 {
-  _thread = nullptr;
+  jassert(stage < 32);
+  _pendingStages.fetch_or(uint32(1) << stage);
+  _scheduledJobs.fetch_add(1);
+
+  // The result of the stage is needed one block period later - unless rendering
+  // offline, where the processing call only waits for the workers, so the stages
+  // are due right away (they're still processed in parallel to each other and
+  // to the head, each stage level by its own worker)
+  juce::int64 deadline = juce::Time::getHighResolutionTicks();
+  if (_backgroundProcessing)
+  {
+    const double period = _ticksPerSample * static_cast<double>(getStageBlockSize(stage));
+    deadline += static_cast<juce::int64>(period);
+  }
+  if (!_scheduler->schedule(*this, stage, deadline))
+  {
+    // Queue full (should never happen) => Do it ourselves instead of dropping it
+    processBackgroundJob(stage);
+  }
 }
 
 
-void Convolver::startBackgroundProcessing()
+void Convolver::waitForBackgroundProcessing(size_t stage)
 {
-  _backgroundProcessingFinished.store(0);
-  _backgroundProcessingFinishedEvent.reset();
-  _thread->notify();
+  // The event is signalled whenever any stage has been finished, so check
+  // again after waking up until the requested stage is done
+  const uint32 stageMask = uint32(1) << stage;
+  while ((_pendingStages.load() & stageMask) != 0)
+  {
+    _backgroundProcessingFinishedEvent.wait();
+  }
 }
 
 
-void Convolver::waitForBackgroundProcessing()
+bool Convolver::processBackgroundJob(size_t stage)
 {
-  _backgroundProcessingFinishedEvent.wait();
+  doBackgroundProcessing(stage);
+  _pendingStages.fetch_and(~(uint32(1) << stage));
+  _backgroundProcessingFinishedEvent.signal();
+  return (_scheduledJobs.fetch_sub(1) == 1); // Last access to this convolver by the worker
 }
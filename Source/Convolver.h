@@ -21,27 +21,70 @@
 // We need to include this before the Juce includes due to some
 // name clashes with Apple system headers, for more information see:
 // http://www.juce.com/forum/topic/reference-point-ambiguous
-#include "FFTConvolver/TwoStageFFTConvolver.h"
+#include "FFTConvolver/MultiStageFFTConvolver.h"
 
 #include "JuceHeader.h"
 
+#include "ConvolverScheduler.h"
+#include "IRSpectrumCache.h"
 
 
-class Convolver : public fftconvolver::TwoStageFFTConvolver
+
+class Convolver : public fftconvolver::MultiStageFFTConvolver
 {
 public:
-  Convolver();
+  // Without background processing (e.g. when rendering offline), the stages have
+  // no deadlines to meet, they're scheduled to be processed as soon as possible
+  Convolver(double sampleRate, bool backgroundProcessing);
   virtual ~Convolver();
+
+  bool isBackgroundProcessing() const;
+
+  // Position in the owner's input stream up to which this convolver has been fed
+  // with input (used for warming up a convolver before it's swapped in, it's only
+  // set by the thread feeding it but might be read by others)
+  void setInputPosition(juce::int64 inputPosition);
+  juce::int64 getInputPosition() const;
+
+  // Auto gain of the impulse responses, which isn't part of their spectra but applied
+  // by the ConvolutionEngine (so switching it doesn't require a new convolver)
+  void setAutoGain(float autoGain);
+  float getAutoGain() const;
+
+  // Keys identifying the content of the impulse responses for the IRSpectrumCache, which
+  // would have to hash them otherwise (to be called right before init() with the same irs)
+  void setIRKeys(const std::vector<const fftconvolver::Sample*>& irs, const std::vector<size_t>& irLens, const std::vector<juce::String>& irKeys);
+
+  // Waits until all scheduled stages have been processed (not to be called by the audio thread)
+  void finishBackgroundProcessing();
   
 protected:
-  virtual void startBackgroundProcessing();
-  virtual void waitForBackgroundProcessing();
+  virtual std::shared_ptr<const fftconvolver::PartitionedIR> createPartitionedIR(size_t blockSize, const fftconvolver::Sample* ir, size_t irLen, fftconvolver::Sample gain);
+  virtual void startBackgroundProcessing(size_t stage);
+  virtual void waitForBackgroundProcessing(size_t stage);
   
 private:
-  friend class ConvolverBackgroundThread;
+  friend class ConvolverSchedulerWorker;
+
+  // Returns whether it has been the last scheduled job (see ConvolverScheduler::waitForJobs())
+  bool processBackgroundJob(size_t stage);
+
+  struct IRKey
+  {
+    const fftconvolver::Sample* ir;
+    size_t irLen;
+    juce::String key;
+  };
   
-  std::unique_ptr<juce::Thread> _thread;
-  std::atomic<uint32> _backgroundProcessingFinished;
+  juce::SharedResourcePointer<ConvolverScheduler> _scheduler;
+  juce::SharedResourcePointer<IRSpectrumCache> _irSpectrumCache;
+  const bool _backgroundProcessing;
+  double _ticksPerSample;
+  std::atomic<juce::int64> _inputPosition;
+  float _autoGain;
+  std::vector<IRKey> _irKeys;
+  std::atomic<uint32> _pendingStages; // Bit mask of the stages scheduled but not yet processed
+  std::atomic<int> _scheduledJobs;
   juce::WaitableEvent _backgroundProcessingFinishedEvent;
 };
 
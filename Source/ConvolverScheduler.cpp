@@ -0,0 +1,361 @@
+// ==================================================================================
+// Copyright (c) 2012 HiFi-LoFi
+//
+// This is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+// ==================================================================================
+
+#include "ConvolverScheduler.h"
+
+#include "Convolver.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#if JUCE_WINDOWS
+  #ifndef NOMINMAX
+    #define NOMINMAX
+  #endif
+  #ifndef WIN32_LEAN_AND_MEAN
+    #define WIN32_LEAN_AND_MEAN
+  #endif
+  #include <windows.h>
+#elif JUCE_MAC || JUCE_IOS
+  #include <dispatch/dispatch.h>
+#else
+  #include <cerrno>
+  #include <semaphore.h>
+#endif
+
+
+struct ConvolverJob
+{
+  Convolver* convolver;
+  size_t stage;
+  juce::int64 deadline;
+};
+
+
+// Bounded multi-producer/multi-consumer queue (D. Vyukov), each cell carries
+// a sequence number which tells producers and consumers whether it's theirs
+class ConvolverJobQueue
+{
+public:
+  explicit ConvolverJobQueue(size_t capacity) :
+    _cells(new Cell[capacity]),
+    _mask(capacity - 1),
+    _enqueuePos(0),
+    _dequeuePos(0)
+  {
+    jassert(capacity >= 2 && (capacity & (capacity - 1)) == 0);
+    for (size_t i=0; i<capacity; ++i)
+    {
+      _cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+
+  bool push(const ConvolverJob& job)
+  {
+    size_t pos = _enqueuePos.load(std::memory_order_relaxed);
+    for (;;)
+    {
+      Cell& cell = _cells[pos & _mask];
+      const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+      const intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+      if (diff == 0)
+      {
+        if (_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+        {
+          cell.job = job;
+          cell.sequence.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      }
+      else if (diff < 0)
+      {
+        return false; // Full
+      }
+      else
+      {
+        pos = _enqueuePos.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+
+  bool pop(ConvolverJob& job)
+  {
+    size_t pos = _dequeuePos.load(std::memory_order_relaxed);
+    for (;;)
+    {
+      Cell& cell = _cells[pos & _mask];
+      const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+      const intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+      if (diff == 0)
+      {
+        if (_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+        {
+          job = cell.job;
+          cell.sequence.store(pos + _mask + 1, std::memory_order_release);
+          return true;
+        }
+      }
+      else if (diff < 0)
+      {
+        return false; // Empty
+      }
+      else
+      {
+        pos = _dequeuePos.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+private:
+  struct Cell
+  {
+    std::atomic<size_t> sequence;
+    ConvolverJob job;
+  };
+
+  std::unique_ptr<Cell[]> _cells;
+  const size_t _mask;
+  char _padding0[64];
+  std::atomic<size_t> _enqueuePos;
+  char _padding1[64];
+  std::atomic<size_t> _dequeuePos;
+
+  ConvolverJobQueue(const ConvolverJobQueue&);
+  ConvolverJobQueue& operator=(const ConvolverJobQueue&);
+};
+
+
+// Counting semaphore of the operating system: Unlike juce::WaitableEvent, signalling
+// it doesn't lock any mutex, so it's safe to be signalled by the audio thread
+class ConvolverSemaphore
+{
+public:
+  ConvolverSemaphore()
+  {
+#if JUCE_WINDOWS
+    _semaphore = ::CreateSemaphore(nullptr, 0, 0x7fffffff, nullptr);
+#elif JUCE_MAC || JUCE_IOS
+    _semaphore = ::dispatch_semaphore_create(0);
+#else
+    ::sem_init(&_semaphore, 0, 0);
+#endif
+  }
+
+
+  ~ConvolverSemaphore()
+  {
+#if JUCE_WINDOWS
+    ::CloseHandle(_semaphore);
+#elif JUCE_MAC || JUCE_IOS
+    ::dispatch_release(_semaphore);
+#else
+    ::sem_destroy(&_semaphore);
+#endif
+  }
+
+
+  void signal()
+  {
+#if JUCE_WINDOWS
+    ::ReleaseSemaphore(_semaphore, 1, nullptr);
+#elif JUCE_MAC || JUCE_IOS
+    ::dispatch_semaphore_signal(_semaphore);
+#else
+    ::sem_post(&_semaphore);
+#endif
+  }
+
+
+  void wait()
+  {
+#if JUCE_WINDOWS
+    ::WaitForSingleObject(_semaphore, INFINITE);
+#elif JUCE_MAC || JUCE_IOS
+    ::dispatch_semaphore_wait(_semaphore, DISPATCH_TIME_FOREVER);
+#else
+    while (::sem_wait(&_semaphore) != 0 && errno == EINTR)
+    {
+    }
+#endif
+  }
+
+private:
+#if JUCE_WINDOWS
+  HANDLE _semaphore;
+#elif JUCE_MAC || JUCE_IOS
+  dispatch_semaphore_t _semaphore;
+#else
+  sem_t _semaphore;
+#endif
+
+  ConvolverSemaphore(const ConvolverSemaphore&);
+  ConvolverSemaphore& operator=(const ConvolverSemaphore&);
+};
+
+
+class ConvolverSchedulerWorker : public juce::Thread
+{
+public:
+  ConvolverSchedulerWorker(ConvolverScheduler& scheduler, size_t level) :
+    juce::Thread("ConvolverSchedulerWorker" + juce::String(static_cast<int>(level))),
+    _scheduler(scheduler),
+    _queue(QueueSize),
+    _ready(),
+    _wakeUp()
+  {
+    _ready.reserve(QueueSize);
+    startThread(8); // Use a priority higher than the priority of normal threads
+  }
+
+
+  virtual ~ConvolverSchedulerWorker()
+  {
+    signalThreadShouldExit();
+    _wakeUp.signal();
+    stopThread(1000);
+  }
+
+
+  bool schedule(const ConvolverJob& job)
+  {
+    if (!_queue.push(job))
+    {
+      return false;
+    }
+    _wakeUp.signal();
+    return true;
+  }
+
+
+  virtual void run()
+  {
+    while (!threadShouldExit())
+    {
+      // Move all queued jobs into the deadline heap and always process
+      // the job with the earliest deadline next, so a long job of one
+      // convolver can't make a short job of another one miss its deadline
+      // more than necessary
+      fetchJobs();
+      while (!_ready.empty() && !threadShouldExit())
+      {
+        std::pop_heap(_ready.begin(), _ready.end(), LaterDeadline);
+        const ConvolverJob job = _ready.back();
+        _ready.pop_back();
+        if (job.convolver->processBackgroundJob(job.stage))
+        {
+          _scheduler.notifyJobsFinished();
+        }
+        fetchJobs();
+      }
+
+      // Each scheduled job has signalled the semaphore once, so after processing
+      // several jobs at once, the following waits just return immediately
+      _wakeUp.wait();
+    }
+  }
+
+private:
+  static const size_t QueueSize = 1024;
+
+  static bool LaterDeadline(const ConvolverJob& a, const ConvolverJob& b)
+  {
+    return a.deadline > b.deadline;
+  }
+
+  void fetchJobs()
+  {
+    ConvolverJob job;
+    while (_queue.pop(job))
+    {
+      _ready.push_back(job);
+      std::push_heap(_ready.begin(), _ready.end(), LaterDeadline);
+    }
+  }
+
+  ConvolverScheduler& _scheduler;
+  ConvolverJobQueue _queue;
+  std::vector<ConvolverJob> _ready;
+  ConvolverSemaphore _wakeUp;
+
+  ConvolverSchedulerWorker(const ConvolverSchedulerWorker&);
+  ConvolverSchedulerWorker& operator=(const ConvolverSchedulerWorker&);
+};
+
+
+// ===================================================================
+
+
+// Maximum number of workers: The block size doubles (at least) from stage to stage,
+// so each stage is processed half as often as the previous one, and all stages
+// beyond the first few ones together hardly cause more load than a single one
+static const int MaxWorkerCount = 4;
+
+
+ConvolverScheduler::ConvolverScheduler() :
+  _workers(),
+  _jobsFinishedMutex(),
+  _jobsFinishedCondition()
+{
+  // One core is left to the audio thread (and the head of the convolvers)
+  const int workerCount = juce::jlimit(1, MaxWorkerCount, juce::SystemStats::getNumCpus() - 1);
+  for (int i=0; i<workerCount; ++i)
+  {
+    _workers.add(new ConvolverSchedulerWorker(*this, static_cast<size_t>(i)));
+  }
+}
+
+
+ConvolverScheduler::~ConvolverScheduler()
+{
+  _workers.clear();
+}
+
+
+bool ConvolverScheduler::schedule(Convolver& convolver, size_t stage, juce::int64 deadline)
+{
+  ConvolverJob job;
+  job.convolver = &convolver;
+  job.stage = stage;
+  job.deadline = deadline;
+
+  // Each stage level has a worker of its own, so the short jobs of the first stages
+  // never wait behind a long job of a later stage, the last worker takes all the
+  // remaining (rarely due) levels
+  const size_t level = std::min(stage, static_cast<size_t>(_workers.size()) - 1);
+  return _workers.getUnchecked(static_cast<int>(level))->schedule(job);
+}
+
+
+void ConvolverScheduler::waitForJobs(const std::atomic<int>& scheduledJobs)
+{
+  std::unique_lock<std::mutex> lock(_jobsFinishedMutex);
+  _jobsFinishedCondition.wait(lock, [&scheduledJobs]() { return scheduledJobs.load() == 0; });
+}
+
+
+void ConvolverScheduler::notifyJobsFinished()
+{
+  // Taking the mutex orders the notification after the check of any waiting thread
+  {
+    std::lock_guard<std::mutex> lock(_jobsFinishedMutex);
+  }
+  _jobsFinishedCondition.notify_all();
+}
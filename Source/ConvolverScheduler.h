@@ -0,0 +1,86 @@
+// ==================================================================================
+// Copyright (c) 2012 HiFi-LoFi
+//
+// This is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+// ==================================================================================
+
+#ifndef _CONVOLVERSCHEDULER_H
+#define _CONVOLVERSCHEDULER_H
+
+#include "JuceHeader.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+
+class Convolver;
+class ConvolverSchedulerWorker;
+
+
+/**
+* @class ConvolverScheduler
+* @brief Process-wide pool of background threads processing the convolver stages
+*
+* All convolvers of all plugin instances share one worker thread per stage level
+* (i.e. the first stage of each convolver is processed by the first worker etc.),
+* so the number of threads doesn't grow with the number of convolvers.
+*
+* Jobs are passed to the workers by lock-free queues and the workers are woken
+* up by semaphores, so scheduling a job is safe to call from realtime threads.
+* Each worker processes its pending jobs in the order of their deadlines
+* (earliest deadline first).
+*
+* There's one worker per core besides the audio thread (at most four of them).
+*
+* Use it by juce::SharedResourcePointer<ConvolverScheduler> only.
+*/
+class ConvolverScheduler
+{
+public:
+  ConvolverScheduler();
+  ~ConvolverScheduler();
+
+  /**
+  * @brief Schedules the background processing of a convolver stage
+  * @param convolver The convolver
+  * @param stage The index of the stage
+  * @param deadline Time in high resolution ticks until which the job has to be finished
+  * @return true: Success - false: The queue is full, the caller has to process the job itself
+  */
+  bool schedule(Convolver& convolver, size_t stage, juce::int64 deadline);
+
+  /**
+  * @brief Waits until a counter of scheduled jobs has dropped to zero (not to be called by the audio thread)
+  * @param scheduledJobs The counter, which is decremented by the workers (see notifyJobsFinished())
+  */
+  void waitForJobs(const std::atomic<int>& scheduledJobs);
+
+  /**
+  * @brief Wakes up the threads waiting in waitForJobs() (called by the workers)
+  */
+  void notifyJobsFinished();
+
+private:
+  juce::OwnedArray<ConvolverSchedulerWorker> _workers;
+  std::mutex _jobsFinishedMutex;
+  std::condition_variable _jobsFinishedCondition;
+
+  // Prevent uncontrolled usage
+  ConvolverScheduler(const ConvolverScheduler&);
+  ConvolverScheduler& operator=(const ConvolverScheduler&);
+};
+
+
+#endif // Header guard
@@ -21,24 +21,29 @@
 
 #include "AudioFFT.h"
 
+#include <atomic>
 #include <cassert>
 #include <cmath>
 #include <cstring>
+#include <vector>
 
 
+// The SIMD and the Ooura backends are always available, the
+// others depend on the according defines (see AudioFFT.h)
 #if defined(AUDIOFFT_APPLE_ACCELERATE)
   #define AUDIOFFT_APPLE_ACCELERATE_USED
   #include <Accelerate/Accelerate.h>
-  #include <vector>
-#elif defined (AUDIOFFT_FFTW3)
+#endif
+
+#if defined (AUDIOFFT_FFTW3)
   #define AUDIOFFT_FFTW3_USED
   #include <fftw3.h>
-#else
-  #if !defined(AUDIOFFT_OOURA)
-    #define AUDIOFFT_OOURA
-  #endif
-  #define AUDIOFFT_OOURA_USED
-  #include <vector>
+  #include <mutex>
+#endif
+
+#if !defined(AUDIOFFT_DONT_USE_SSE) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+  #define AUDIOFFT_SIMD_SSE
+  #include <xmmintrin.h>
 #endif
 
 
@@ -77,13 +82,541 @@ namespace audiofft
     // ================================================================
 
 
-#ifdef AUDIOFFT_OOURA_USED
+    /**
+     * @internal
+     * @class SIMDFFT
+     * @brief Float-native FFT implementation working directly on split-complex data
+     *
+     * The real FFT of size N is calculated by means of a complex FFT of size N/2
+     * (even samples as real part, odd samples as imaginary part) followed by a
+     * post-processing pass separating the spectra. The complex FFT is a radix-4
+     * Stockham autosort FFT (plus one radix-2 pass for odd powers of 2), so no
+     * bit reversal is needed and all passes read and write contiguous vectors.
+     * There's no conversion to double precision, and SSE is used if available.
+     */
+    class SIMDFFT : public AudioFFTImpl
+    {
+    public:
+      SIMDFFT() :
+        AudioFFTImpl(),
+        _size(0),
+        _stages(),
+        _twiddles(),
+        _postRe(),
+        _postIm(),
+        _work()
+      {
+      }
+
+      virtual void init(size_t size) override
+      {
+        if (_size == size)
+        {
+          return;
+        }
+
+        _size = size;
+        _stages.clear();
+        _twiddles.clear();
+        _postRe.clear();
+        _postIm.clear();
+        _work.clear();
+        if (size < 4)
+        {
+          return;
+        }
+
+        const size_t size2 = size / 2;
+        const double pi = 3.14159265358979323846;
+
+        // Passes of the complex FFT with their twiddle factors exp(-2*pi*i*k*p/n)
+        // (for a radix-4 pass, each one occupies six tables of length n/4 for
+        // the real and imaginary parts of k = 1, 2 and 3)
+        size_t n = size2;
+        size_t s = 1;
+        while (n >= 4)
+        {
+          Stage stage;
+          stage.n = n;
+          stage.s = s;
+          stage.radix = 4;
+          stage.twiddleOffset = _twiddles.size();
+          _stages.push_back(stage);
+          const size_t m = n / 4;
+          _twiddles.resize(_twiddles.size() + 6 * m);
+          float* tw = &_twiddles[stage.twiddleOffset];
+          for (size_t k=1; k<=3; ++k)
+          {
+            for (size_t p=0; p<m; ++p)
+            {
+              const double phase = -2.0 * pi * static_cast<double>(k * p) / static_cast<double>(n);
+              tw[(2 * k - 2) * m + p] = static_cast<float>(std::cos(phase));
+              tw[(2 * k - 1) * m + p] = static_cast<float>(std::sin(phase));
+            }
+          }
+          n /= 4;
+          s *= 4;
+        }
+        if (n == 2)
+        {
+          Stage stage;
+          stage.n = n;
+          stage.s = s;
+          stage.radix = 2;
+          stage.twiddleOffset = _twiddles.size();
+          _stages.push_back(stage);
+        }
+
+        // Twiddle factors exp(-2*pi*i*k/size) for separating the spectra
+        _postRe.resize(size2);
+        _postIm.resize(size2);
+        for (size_t k=0; k<size2; ++k)
+        {
+          const double phase = -2.0 * pi * static_cast<double>(k) / static_cast<double>(size);
+          _postRe[k] = static_cast<float>(std::cos(phase));
+          _postIm[k] = static_cast<float>(std::sin(phase));
+        }
+
+        // Two ping-pong buffers for the real and imaginary parts
+        _work.resize(4 * size2);
+      }
+
+      virtual void fft(const float* data, float* re, float* im) override
+      {
+        if (_size < 4)
+        {
+          fftTiny(data, re, im);
+          return;
+        }
+
+        const size_t size2 = _size / 2;
+        float* zr = _work.data();
+        float* zi = zr + size2;
+
+        // Even samples become the real part, odd samples the imaginary part
+        size_t k = 0;
+#ifdef AUDIOFFT_SIMD_SSE
+        for (; k + 4 <= size2; k += 4)
+        {
+          const __m128 d0 = _mm_loadu_ps(data + 2 * k);
+          const __m128 d1 = _mm_loadu_ps(data + 2 * k + 4);
+          _mm_storeu_ps(zr + k, _mm_shuffle_ps(d0, d1, _MM_SHUFFLE(2, 0, 2, 0)));
+          _mm_storeu_ps(zi + k, _mm_shuffle_ps(d0, d1, _MM_SHUFFLE(3, 1, 3, 1)));
+        }
+#endif
+        for (; k < size2; ++k)
+        {
+          zr[k] = data[2 * k];
+          zi[k] = data[2 * k + 1];
+        }
+
+        const size_t result = transform(zr, zi);
+        zr = _work.data() + 2 * size2 * result;
+        zi = zr + size2;
+
+        // Separation of the spectra of the even and odd samples:
+        // X[k] = E[k] + W^k * O[k] with E[k] = (Z[k] + conj(Z[M-k])) / 2
+        // and O[k] = (Z[k] - conj(Z[M-k])) / 2i
+        re[0] = zr[0] + zi[0];
+        im[0] = 0.0f;
+        re[size2] = zr[0] - zi[0];
+        im[size2] = 0.0f;
+        k = 1;
+#ifdef AUDIOFFT_SIMD_SSE
+        const __m128 half = _mm_set1_ps(0.5f);
+        for (; k + 4 <= size2; k += 4)
+        {
+          const __m128 ar = _mm_loadu_ps(zr + k);
+          const __m128 ai = _mm_loadu_ps(zi + k);
+          const __m128 br = Reverse(_mm_loadu_ps(zr + size2 - k - 3));
+          const __m128 bi = Reverse(_mm_loadu_ps(zi + size2 - k - 3));
+          const __m128 er = _mm_mul_ps(half, _mm_add_ps(ar, br));
+          const __m128 ei = _mm_mul_ps(half, _mm_sub_ps(ai, bi));
+          const __m128 or_ = _mm_mul_ps(half, _mm_add_ps(ai, bi));
+          const __m128 oi = _mm_mul_ps(half, _mm_sub_ps(br, ar));
+          const __m128 wr = _mm_loadu_ps(&_postRe[k]);
+          const __m128 wi = _mm_loadu_ps(&_postIm[k]);
+          _mm_storeu_ps(re + k, _mm_add_ps(er, _mm_sub_ps(_mm_mul_ps(wr, or_), _mm_mul_ps(wi, oi))));
+          _mm_storeu_ps(im + k, _mm_add_ps(ei, _mm_add_ps(_mm_mul_ps(wr, oi), _mm_mul_ps(wi, or_))));
+        }
+#endif
+        for (; k < size2; ++k)
+        {
+          const float ar = zr[k];
+          const float ai = zi[k];
+          const float br = zr[size2 - k];
+          const float bi = zi[size2 - k];
+          const float er = 0.5f * (ar + br);
+          const float ei = 0.5f * (ai - bi);
+          const float or_ = 0.5f * (ai + bi);
+          const float oi = 0.5f * (br - ar);
+          const float wr = _postRe[k];
+          const float wi = _postIm[k];
+          re[k] = er + (wr * or_ - wi * oi);
+          im[k] = ei + (wr * oi + wi * or_);
+        }
+      }
+
+      virtual void ifft(float* data, const float* re, const float* im, bool normalize) override
+      {
+        if (_size < 4)
+        {
+          ifftTiny(data, re, im, normalize);
+          return;
+        }
+
+        // The inverse complex FFT is the forward one with swapped real
+        // and imaginary parts, so Z is written with swapped parts, too
+        const size_t size2 = _size / 2;
+        const float scale = normalize ? 1.0f / static_cast<float>(_size) : 1.0f;
+        float* zi = _work.data();
+        float* zr = zi + size2;
+
+        // Combination of the spectra of the even and odd samples:
+        // Z[k] = (X[k] + conj(X[M-k])) / 2 + i * conj(W^k) * (X[k] - conj(X[M-k])) / 2
+        // (including the normalization of the inverse FFT)
+        zr[0] = scale * (re[0] + re[size2]);
+        zi[0] = scale * (re[0] - re[size2]);
+        size_t k = 1;
+#ifdef AUDIOFFT_SIMD_SSE
+        const __m128 scale4 = _mm_set1_ps(scale);
+        for (; k + 4 <= size2; k += 4)
+        {
+          const __m128 ar = _mm_loadu_ps(re + k);
+          const __m128 ai = _mm_loadu_ps(im + k);
+          const __m128 br = Reverse(_mm_loadu_ps(re + size2 - k - 3));
+          const __m128 bi = Reverse(_mm_loadu_ps(im + size2 - k - 3));
+          const __m128 pr = _mm_add_ps(ar, br);
+          const __m128 pi = _mm_sub_ps(ai, bi);
+          const __m128 qr = _mm_sub_ps(ar, br);
+          const __m128 qi = _mm_add_ps(ai, bi);
+          const __m128 wr = _mm_loadu_ps(&_postRe[k]);
+          const __m128 wi = _mm_loadu_ps(&_postIm[k]);
+          const __m128 rr = _mm_add_ps(_mm_mul_ps(wr, qr), _mm_mul_ps(wi, qi));
+          const __m128 ri = _mm_sub_ps(_mm_mul_ps(wr, qi), _mm_mul_ps(wi, qr));
+          _mm_storeu_ps(zr + k, _mm_mul_ps(scale4, _mm_sub_ps(pr, ri)));
+          _mm_storeu_ps(zi + k, _mm_mul_ps(scale4, _mm_add_ps(pi, rr)));
+        }
+#endif
+        for (; k < size2; ++k)
+        {
+          const float ar = re[k];
+          const float ai = im[k];
+          const float br = re[size2 - k];
+          const float bi = im[size2 - k];
+          const float pr = ar + br;
+          const float pi = ai - bi;
+          const float qr = ar - br;
+          const float qi = ai + bi;
+          const float wr = _postRe[k];
+          const float wi = _postIm[k];
+          const float rr = wr * qr + wi * qi;
+          const float ri = wr * qi - wi * qr;
+          zr[k] = scale * (pr - ri);
+          zi[k] = scale * (pi + rr);
+        }
+
+        const size_t result = transform(zi, zr);
+        zi = _work.data() + 2 * size2 * result;
+        zr = zi + size2;
+
+        // Real part to the even samples, imaginary part to the odd samples
+        k = 0;
+#ifdef AUDIOFFT_SIMD_SSE
+        for (; k + 4 <= size2; k += 4)
+        {
+          const __m128 r = _mm_loadu_ps(zr + k);
+          const __m128 i = _mm_loadu_ps(zi + k);
+          _mm_storeu_ps(data + 2 * k, _mm_unpacklo_ps(r, i));
+          _mm_storeu_ps(data + 2 * k + 4, _mm_unpackhi_ps(r, i));
+        }
+#endif
+        for (; k < size2; ++k)
+        {
+          data[2 * k] = zr[k];
+          data[2 * k + 1] = zi[k];
+        }
+      }
+
+    private:
+      struct Stage
+      {
+        size_t n;
+        size_t s;
+        size_t radix;
+        size_t twiddleOffset;
+      };
+
+#ifdef AUDIOFFT_SIMD_SSE
+      static __m128 Reverse(__m128 v)
+      {
+        return _mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 1, 2, 3));
+      }
+#endif
+
+      void fftTiny(const float* data, float* re, float* im)
+      {
+        if (_size == 1)
+        {
+          re[0] = data[0];
+          im[0] = 0.0f;
+        }
+        else if (_size == 2)
+        {
+          re[0] = data[0] + data[1];
+          im[0] = 0.0f;
+          re[1] = data[0] - data[1];
+          im[1] = 0.0f;
+        }
+      }
+
+      void ifftTiny(float* data, const float* re, const float* /*im*/, bool normalize)
+      {
+        if (_size == 1)
+        {
+          data[0] = re[0];
+        }
+        else if (_size == 2)
+        {
+          const float scale = normalize ? 0.5f : 1.0f;
+          data[0] = scale * (re[0] + re[1]);
+          data[1] = scale * (re[0] - re[1]);
+        }
+      }
+
+      /**
+       * Performs the complex forward FFT of the first ping-pong buffer (the real
+       * and imaginary parts at the given pointers into it) and returns the index
+       * (0 or 1) of the ping-pong buffer containing the result in the same layout
+       */
+      size_t transform(float* re, float* im)
+      {
+        const size_t size2 = _size / 2;
+        const ptrdiff_t imOffset = im - re;
+        float* buffers[2] = { re, re + 2 * size2 };
+        size_t current = 0;
+        for (size_t i=0; i<_stages.size(); ++i)
+        {
+          const Stage& stage = _stages[i];
+          const float* xr = buffers[current];
+          float* yr = buffers[current ^ 1];
+          if (stage.radix == 4)
+          {
+            pass4(stage, xr, xr + imOffset, yr, yr + imOffset);
+          }
+          else
+          {
+            pass2(stage, xr, xr + imOffset, yr, yr + imOffset);
+          }
+          current ^= 1;
+        }
+        return current;
+      }
+
+      void pass4(const Stage& stage, const float* xr, const float* xi, float* yr, float* yi) const
+      {
+        const size_t s = stage.s;
+        const size_t m = stage.n / 4;
+        const float* tw = &_twiddles[stage.twiddleOffset];
+        const float* w1r = tw;
+        const float* w1i = tw + m;
+        const float* w2r = tw + 2 * m;
+        const float* w2i = tw + 3 * m;
+        const float* w3r = tw + 4 * m;
+        const float* w3i = tw + 5 * m;
+        const size_t sm = s * m;
+
+#ifdef AUDIOFFT_SIMD_SSE
+        if (s >= 4)
+        {
+          for (size_t p=0; p<m; ++p)
+          {
+            const size_t x0 = s * p;
+            const size_t y0 = 4 * s * p;
+            const Twiddles4 w(_mm_set1_ps(w1r[p]), _mm_set1_ps(w1i[p]),
+                              _mm_set1_ps(w2r[p]), _mm_set1_ps(w2i[p]),
+                              _mm_set1_ps(w3r[p]), _mm_set1_ps(w3i[p]));
+            for (size_t q=0; q<s; q+=4)
+            {
+              __m128 r[4];
+              __m128 i[4];
+              Butterfly4(w,
+                         _mm_loadu_ps(xr + x0 + q), _mm_loadu_ps(xi + x0 + q),
+                         _mm_loadu_ps(xr + x0 + sm + q), _mm_loadu_ps(xi + x0 + sm + q),
+                         _mm_loadu_ps(xr + x0 + 2 * sm + q), _mm_loadu_ps(xi + x0 + 2 * sm + q),
+                         _mm_loadu_ps(xr + x0 + 3 * sm + q), _mm_loadu_ps(xi + x0 + 3 * sm + q),
+                         r, i);
+              for (size_t j=0; j<4; ++j)
+              {
+                _mm_storeu_ps(yr + y0 + j * s + q, r[j]);
+                _mm_storeu_ps(yi + y0 + j * s + q, i[j]);
+              }
+            }
+          }
+          return;
+        }
+        if (s == 1 && m >= 4)
+        {
+          // First pass: Four consecutive values of p at once, the
+          // results are transposed into four consecutive outputs each
+          for (size_t p=0; p<m; p+=4)
+          {
+            const Twiddles4 w(_mm_loadu_ps(w1r + p), _mm_loadu_ps(w1i + p),
+                              _mm_loadu_ps(w2r + p), _mm_loadu_ps(w2i + p),
+                              _mm_loadu_ps(w3r + p), _mm_loadu_ps(w3i + p));
+            __m128 r[4];
+            __m128 i[4];
+            Butterfly4(w,
+                       _mm_loadu_ps(xr + p), _mm_loadu_ps(xi + p),
+                       _mm_loadu_ps(xr + m + p), _mm_loadu_ps(xi + m + p),
+                       _mm_loadu_ps(xr + 2 * m + p), _mm_loadu_ps(xi + 2 * m + p),
+                       _mm_loadu_ps(xr + 3 * m + p), _mm_loadu_ps(xi + 3 * m + p),
+                       r, i);
+            _MM_TRANSPOSE4_PS(r[0], r[1], r[2], r[3]);
+            _MM_TRANSPOSE4_PS(i[0], i[1], i[2], i[3]);
+            for (size_t j=0; j<4; ++j)
+            {
+              _mm_storeu_ps(yr + 4 * (p + j), r[j]);
+              _mm_storeu_ps(yi + 4 * (p + j), i[j]);
+            }
+          }
+          return;
+        }
+#endif
+
+        for (size_t p=0; p<m; ++p)
+        {
+          for (size_t q=0; q<s; ++q)
+          {
+            const size_t x0 = s * p + q;
+            const size_t y0 = 4 * s * p + q;
+            const float apcr = xr[x0] + xr[x0 + 2 * sm];
+            const float apci = xi[x0] + xi[x0 + 2 * sm];
+            const float amcr = xr[x0] - xr[x0 + 2 * sm];
+            const float amci = xi[x0] - xi[x0 + 2 * sm];
+            const float bpdr = xr[x0 + sm] + xr[x0 + 3 * sm];
+            const float bpdi = xi[x0 + sm] + xi[x0 + 3 * sm];
+            const float bmdr = xr[x0 + sm] - xr[x0 + 3 * sm];
+            const float bmdi = xi[x0 + sm] - xi[x0 + 3 * sm];
+            const float t1r = amcr + bmdi;
+            const float t1i = amci - bmdr;
+            const float t2r = apcr - bpdr;
+            const float t2i = apci - bpdi;
+            const float t3r = amcr - bmdi;
+            const float t3i = amci + bmdr;
+            yr[y0] = apcr + bpdr;
+            yi[y0] = apci + bpdi;
+            yr[y0 + s] = w1r[p] * t1r - w1i[p] * t1i;
+            yi[y0 + s] = w1r[p] * t1i + w1i[p] * t1r;
+            yr[y0 + 2 * s] = w2r[p] * t2r - w2i[p] * t2i;
+            yi[y0 + 2 * s] = w2r[p] * t2i + w2i[p] * t2r;
+            yr[y0 + 3 * s] = w3r[p] * t3r - w3i[p] * t3i;
+            yi[y0 + 3 * s] = w3r[p] * t3i + w3i[p] * t3r;
+          }
+        }
+      }
+
+      void pass2(const Stage& stage, const float* xr, const float* xi, float* yr, float* yi) const
+      {
+        // Only used as last pass (n == 2), so there are no twiddle factors
+        const size_t s = stage.s;
+        size_t q = 0;
+#ifdef AUDIOFFT_SIMD_SSE
+        for (; q + 4 <= s; q += 4)
+        {
+          const __m128 ar = _mm_loadu_ps(xr + q);
+          const __m128 ai = _mm_loadu_ps(xi + q);
+          const __m128 br = _mm_loadu_ps(xr + s + q);
+          const __m128 bi = _mm_loadu_ps(xi + s + q);
+          _mm_storeu_ps(yr + q, _mm_add_ps(ar, br));
+          _mm_storeu_ps(yi + q, _mm_add_ps(ai, bi));
+          _mm_storeu_ps(yr + s + q, _mm_sub_ps(ar, br));
+          _mm_storeu_ps(yi + s + q, _mm_sub_ps(ai, bi));
+        }
+#endif
+        for (; q < s; ++q)
+        {
+          const float ar = xr[q];
+          const float ai = xi[q];
+          const float br = xr[s + q];
+          const float bi = xi[s + q];
+          yr[q] = ar + br;
+          yi[q] = ai + bi;
+          yr[s + q] = ar - br;
+          yi[s + q] = ai - bi;
+        }
+      }
+
+#ifdef AUDIOFFT_SIMD_SSE
+      struct Twiddles4
+      {
+        Twiddles4(__m128 w1r_, __m128 w1i_, __m128 w2r_, __m128 w2i_, __m128 w3r_, __m128 w3i_) :
+          w1r(w1r_), w1i(w1i_), w2r(w2r_), w2i(w2i_), w3r(w3r_), w3i(w3i_)
+        {
+        }
+
+        __m128 w1r;
+        __m128 w1i;
+        __m128 w2r;
+        __m128 w2i;
+        __m128 w3r;
+        __m128 w3i;
+      };
+
+      static void Butterfly4(const Twiddles4& w,
+                             __m128 ar, __m128 ai, __m128 br, __m128 bi,
+                             __m128 cr, __m128 ci, __m128 dr, __m128 di,
+                             __m128* yr, __m128* yi)
+      {
+        const __m128 apcr = _mm_add_ps(ar, cr);
+        const __m128 apci = _mm_add_ps(ai, ci);
+        const __m128 amcr = _mm_sub_ps(ar, cr);
+        const __m128 amci = _mm_sub_ps(ai, ci);
+        const __m128 bpdr = _mm_add_ps(br, dr);
+        const __m128 bpdi = _mm_add_ps(bi, di);
+        const __m128 bmdr = _mm_sub_ps(br, dr);
+        const __m128 bmdi = _mm_sub_ps(bi, di);
+        const __m128 t1r = _mm_add_ps(amcr, bmdi);
+        const __m128 t1i = _mm_sub_ps(amci, bmdr);
+        const __m128 t2r = _mm_sub_ps(apcr, bpdr);
+        const __m128 t2i = _mm_sub_ps(apci, bpdi);
+        const __m128 t3r = _mm_sub_ps(amcr, bmdi);
+        const __m128 t3i = _mm_add_ps(amci, bmdr);
+        yr[0] = _mm_add_ps(apcr, bpdr);
+        yi[0] = _mm_add_ps(apci, bpdi);
+        yr[1] = _mm_sub_ps(_mm_mul_ps(w.w1r, t1r), _mm_mul_ps(w.w1i, t1i));
+        yi[1] = _mm_add_ps(_mm_mul_ps(w.w1r, t1i), _mm_mul_ps(w.w1i, t1r));
+        yr[2] = _mm_sub_ps(_mm_mul_ps(w.w2r, t2r), _mm_mul_ps(w.w2i, t2i));
+        yi[2] = _mm_add_ps(_mm_mul_ps(w.w2r, t2i), _mm_mul_ps(w.w2i, t2r));
+        yr[3] = _mm_sub_ps(_mm_mul_ps(w.w3r, t3r), _mm_mul_ps(w.w3i, t3i));
+        yi[3] = _mm_add_ps(_mm_mul_ps(w.w3r, t3i), _mm_mul_ps(w.w3i, t3r));
+      }
+#endif
+
+      size_t _size;
+      std::vector<Stage> _stages;
+      std::vector<float> _twiddles;
+      std::vector<float> _postRe;
+      std::vector<float> _postIm;
+      std::vector<float> _work;
+
+      SIMDFFT(const SIMDFFT&) = delete;
+      SIMDFFT& operator=(const SIMDFFT&) = delete;
+    };
+
+
+    // ================================================================
+
 
     /**
      * @internal
      * @class OouraFFT
      * @brief FFT implementation based on the great radix-4 routines by Takuya Ooura
+     *
+     * The routines are templated on their sample type, the float version works
+     * without any conversion to double (and the inverse FFT in place on the output).
      */
+    template<typename T>
     class OouraFFT : public AudioFFTImpl
     {
     public:
@@ -113,15 +646,15 @@ namespace audiofft
 
       virtual void fft(const float* data, float* re, float* im) override
       {
-        // Convert into the format as required by the Ooura FFT
+        // Ooura's FFT works in place, so the input is copied (resp. converted)
         ConvertBuffer(&_buffer[0], data, _size);
 
         rdft(static_cast<int>(_size), +1, _buffer.data(), _ip.data(), _w.data());
 
         // Convert back to split-complex
         {
-          double* b = &_buffer[0];
-          double* bEnd = b + _size;
+          const T* b = &_buffer[0];
+          const T* bEnd = b + _size;
           float *r = re;
           float *i = im;
           while (b != bEnd)
@@ -136,35 +669,50 @@ namespace audiofft
         im[size2] = 0.0;
       }
 
-      virtual void ifft(float* data, const float* re, const float* im) override
+      virtual void ifft(float* data, const float* re, const float* im, bool normalize) override
       {
-        // Convert into the format as required by the Ooura FFT
+        // Convert into the format as required by the Ooura FFT, including
+        // the normalization (all of Ooura's backward routines are linear)
+        T* a = WorkBuffer(data, _buffer);
         {
-          double* b = &_buffer[0];
-          double* bEnd = b + _size;
+          const T scale = static_cast<T>(normalize ? 2.0 / static_cast<double>(_size) : 2.0);
+          T* b = a;
+          T* bEnd = b + _size;
           const float *r = re;
           const float *i = im;
           while (b != bEnd)
           {
-            *(b++) = static_cast<double>(*(r++));
-            *(b++) = -static_cast<double>(*(i++));
+            *(b++) = scale * static_cast<T>(*(r++));
+            *(b++) = -scale * static_cast<T>(*(i++));
           }
-          _buffer[1] = re[_size / 2];
+          a[1] = scale * static_cast<T>(re[_size / 2]);
         }
 
-        rdft(static_cast<int>(_size), -1, _buffer.data(), _ip.data(), _w.data());
+        rdft(static_cast<int>(_size), -1, a, _ip.data(), _w.data());
 
-        // Convert back to split-complex
-        ScaleBuffer(data, &_buffer[0], 2.0 / static_cast<double>(_size), _size);
+        if (a != reinterpret_cast<const void*>(data))
+        {
+          ConvertBuffer(data, a, _size);
+        }
       }
 
     private:
       size_t _size;
       std::vector<int> _ip;
-      std::vector<double> _w;
-      std::vector<double> _buffer;
+      std::vector<T> _w;
+      std::vector<T> _buffer;
+
+      static float* WorkBuffer(float* data, std::vector<float>&)
+      {
+        return data;
+      }
+
+      static double* WorkBuffer(float*, std::vector<double>& buffer)
+      {
+        return buffer.data();
+      }
 
-      void rdft(int n, int isgn, double *a, int *ip, double *w)
+      void rdft(int n, int isgn, T *a, int *ip, T *w)
       {
         int nw = ip[0];
         int nc = ip[1];
@@ -181,13 +729,13 @@ namespace audiofft
           {
             cftfsub(n, a, w);
           }
-          double xi = a[0] - a[1];
+          T xi = a[0] - a[1];
           a[0] += a[1];
           a[1] = xi;
         }
         else
         {
-          a[1] = 0.5 * (a[0] - a[1]);
+          a[1] = static_cast<T>(0.5) * (a[0] - a[1]);
           a[0] -= a[1];
           if (n > 4)
           {
@@ -205,7 +753,7 @@ namespace audiofft
 
       /* -------- initializing routines -------- */
 
-      void makewt(int nw, int *ip, double *w)
+      void makewt(int nw, int *ip, T *w)
       {
         int j, nwh;
         double delta, x, y;
@@ -217,16 +765,16 @@ namespace audiofft
           delta = atan(1.0) / nwh;
           w[0] = 1;
           w[1] = 0;
-          w[nwh] = cos(delta * nwh);
+          w[nwh] = static_cast<T>(cos(delta * nwh));
           w[nwh + 1] = w[nwh];
           if (nwh > 2) {
             for (j = 2; j < nwh; j += 2) {
               x = cos(delta * j);
               y = sin(delta * j);
-              w[j] = x;
-              w[j + 1] = y;
-              w[nw - j] = y;
-              w[nw - j + 1] = x;
+              w[j] = static_cast<T>(x);
+              w[j + 1] = static_cast<T>(y);
+              w[nw - j] = static_cast<T>(y);
+              w[nw - j + 1] = static_cast<T>(x);
             }
             bitrv2(nw, ip + 2, w);
           }
@@ -234,7 +782,7 @@ namespace audiofft
       }
 
 
-      void makect(int nc, int *ip, double *c)
+      void makect(int nc, int *ip, T *c)
       {
         int j, nch;
         double delta;
@@ -243,11 +791,11 @@ namespace audiofft
         if (nc > 1) {
           nch = nc >> 1;
           delta = atan(1.0) / nch;
-          c[0] = cos(delta * nch);
-          c[nch] = 0.5 * c[0];
+          c[0] = static_cast<T>(cos(delta * nch));
+          c[nch] = static_cast<T>(0.5 * cos(delta * nch));
           for (j = 1; j < nch; j++) {
-            c[j] = 0.5 * cos(delta * j);
-            c[nc - j] = 0.5 * sin(delta * j);
+            c[j] = static_cast<T>(0.5 * cos(delta * j));
+            c[nc - j] = static_cast<T>(0.5 * sin(delta * j));
           }
         }
       }
@@ -256,10 +804,10 @@ namespace audiofft
       /* -------- child routines -------- */
 
 
-      void bitrv2(int n, int *ip, double *a)
+      void bitrv2(int n, int *ip, T *a)
       {
         int j, j1, k, k1, l, m, m2;
-        double xr, xi, yr, yi;
+        T xr, xi, yr, yi;
 
         ip[0] = 0;
         l = n;
@@ -356,10 +904,10 @@ namespace audiofft
       }
 
 
-      void cftfsub(int n, double *a, double *w)
+      void cftfsub(int n, T *a, T *w)
       {
         int j, j1, j2, j3, l;
-        double x0r, x0i, x1r, x1i, x2r, x2i, x3r, x3i;
+        T x0r, x0i, x1r, x1i, x2r, x2i, x3r, x3i;
 
         l = 2;
         if (n > 8) {
@@ -406,10 +954,10 @@ namespace audiofft
       }
 
 
-      void cftbsub(int n, double *a, double *w)
+      void cftbsub(int n, T *a, T *w)
       {
         int j, j1, j2, j3, l;
-        double x0r, x0i, x1r, x1i, x2r, x2i, x3r, x3i;
+        T x0r, x0i, x1r, x1i, x2r, x2i, x3r, x3i;
 
         l = 2;
         if (n > 8) {
@@ -456,11 +1004,11 @@ namespace audiofft
       }
 
 
-      void cft1st(int n, double *a, double *w)
+      void cft1st(int n, T *a, T *w)
       {
         int j, k1, k2;
-        double wk1r, wk1i, wk2r, wk2i, wk3r, wk3i;
-        double x0r, x0i, x1r, x1i, x2r, x2i, x3r, x3i;
+        T wk1r, wk1i, wk2r, wk2i, wk3r, wk3i;
+        T x0r, x0i, x1r, x1i, x2r, x2i, x3r, x3i;
 
         x0r = a[0] + a[2];
         x0i = a[1] + a[3];
@@ -561,11 +1109,11 @@ namespace audiofft
       }
 
 
-      void cftmdl(int n, int l, double *a, double *w)
+      void cftmdl(int n, int l, T *a, T *w)
       {
         int j, j1, j2, j3, k, k1, k2, m, m2;
-        double wk1r, wk1i, wk2r, wk2i, wk3r, wk3i;
-        double x0r, x0i, x1r, x1i, x2r, x2i, x3r, x3i;
+        T wk1r, wk1i, wk2r, wk2i, wk3r, wk3i;
+        T x0r, x0i, x1r, x1i, x2r, x2i, x3r, x3i;
 
         m = l << 2;
         for (j = 0; j < l; j += 2) {
@@ -688,10 +1236,10 @@ namespace audiofft
       }
 
 
-      void rftfsub(int n, double *a, int nc, double *c)
+      void rftfsub(int n, T *a, int nc, T *c)
       {
         int j, k, kk, ks, m;
-        double wkr, wki, xr, xi, yr, yi;
+        T wkr, wki, xr, xi, yr, yi;
 
         m = n >> 1;
         ks = 2 * nc / m;
@@ -699,7 +1247,7 @@ namespace audiofft
         for (j = 2; j < m; j += 2) {
           k = n - j;
           kk += ks;
-          wkr = 0.5 - c[nc - kk];
+          wkr = static_cast<T>(0.5) - c[nc - kk];
           wki = c[kk];
           xr = a[j] - a[k];
           xi = a[j + 1] + a[k + 1];
@@ -713,10 +1261,10 @@ namespace audiofft
       }
 
 
-      void rftbsub(int n, double *a, int nc, double *c)
+      void rftbsub(int n, T *a, int nc, T *c)
       {
         int j, k, kk, ks, m;
-        double wkr, wki, xr, xi, yr, yi;
+        T wkr, wki, xr, xi, yr, yi;
 
         a[1] = -a[1];
         m = n >> 1;
@@ -725,7 +1273,7 @@ namespace audiofft
         for (j = 2; j < m; j += 2) {
           k = n - j;
           kk += ks;
-          wkr = 0.5 - c[nc - kk];
+          wkr = static_cast<T>(0.5) - c[nc - kk];
           wki = c[kk];
           xr = a[j] - a[k];
           xi = a[j + 1] + a[k + 1];
@@ -743,14 +1291,6 @@ namespace audiofft
       OouraFFT& operator=(const OouraFFT&) = delete;
     };
 
-    std::unique_ptr<AudioFFTImpl> MakeAudioFFTImpl()
-    {
-      return std::unique_ptr<OouraFFT>(new OouraFFT());
-    }
-
-
-#endif // AUDIOFFT_OOURA_USED
-
 
     // ================================================================
 
@@ -823,7 +1363,7 @@ namespace audiofft
         im[size2] = 0.0f;
       }
 
-      virtual void ifft(float* data, const float* re, const float* im) override
+      virtual void ifft(float* data, const float* re, const float* im, bool normalize) override
       {
         const size_t size2 = _size / 2;
         ::memcpy(_re.data(), re, size2 * sizeof(float));
@@ -834,8 +1374,11 @@ namespace audiofft
         splitComplex.imagp = _im.data();
         vDSP_fft_zrip(_fftSetup, &splitComplex, 1, _powerOf2, FFT_INVERSE);
         vDSP_ztoc(&splitComplex, 1, reinterpret_cast<COMPLEX*>(data), 2, size2);
-        const float factor = 1.0f / static_cast<float>(_size);
-        vDSP_vsmul(data, 1, &factor, data, 1, _size);
+        if (normalize)
+        {
+          const float factor = 1.0f / static_cast<float>(_size);
+          vDSP_vsmul(data, 1, &factor, data, 1, _size);
+        }
       }
 
     private:
@@ -850,12 +1393,6 @@ namespace audiofft
     };
 
 
-    std::unique_ptr<AudioFFTImpl> MakeAudioFFTImpl()
-    {
-      return std::unique_ptr<AppleAccelerateFFT>(new AppleAccelerateFFT());
-    }
-
-
 #endif // AUDIOFFT_APPLE_ACCELERATE_USED
 
 
@@ -865,6 +1402,29 @@ namespace audiofft
 #ifdef AUDIOFFT_FFTW3_USED
 
 
+    /**
+     * @internal
+     * @brief Serializes all calls of the FFTW planner, which isn't thread-safe
+     * (impulse responses are usually prepared by several threads at once)
+     */
+    static std::mutex& FFTW3PlannerMutex()
+    {
+      static std::mutex mutex;
+      return mutex;
+    }
+
+
+    /**
+     * @internal
+     * @brief Wisdom file set by AudioFFT::SetWisdomFile() (guarded by the planner mutex)
+     */
+    static std::string& FFTW3WisdomFile()
+    {
+      static std::string fileName;
+      return fileName;
+    }
+
+
     /**
      * @internal
      * @class FFTW3FFT
@@ -896,8 +1456,11 @@ namespace audiofft
         {
           if (_size > 0)
           {
-            fftwf_destroy_plan(_planForward);
-            fftwf_destroy_plan(_planBackward);
+            {
+              std::lock_guard<std::mutex> lock(FFTW3PlannerMutex());
+              fftwf_destroy_plan(_planForward);
+              fftwf_destroy_plan(_planBackward);
+            }
             _planForward = 0;
             _planBackward = 0;
             _size = 0;
@@ -925,8 +1488,8 @@ namespace audiofft
           if (size > 0)
           {
             _size = size;
-            _complexSize = ComplexSize(_size);
-            const size_t complexSize = ComplexSize(_size);
+            _complexSize = AudioFFT::ComplexSize(_size);
+            const size_t complexSize = AudioFFT::ComplexSize(_size);
             _data = reinterpret_cast<float*>(fftwf_malloc(_size * sizeof(float)));
             _re = reinterpret_cast<float*>(fftwf_malloc(complexSize * sizeof(float)));
             _im = reinterpret_cast<float*>(fftwf_malloc(complexSize * sizeof(float)));
@@ -935,8 +1498,28 @@ namespace audiofft
             dim.n = static_cast<int>(size);
             dim.is = 1;
             dim.os = 1;
-            _planForward = fftwf_plan_guru_split_dft_r2c(1, &dim, 0, 0, _data, _re, _im, FFTW_MEASURE);
-            _planBackward = fftwf_plan_guru_split_dft_c2r(1, &dim, 0, 0, _re, _im, _data, FFTW_MEASURE);
+
+            // Measuring is expensive, so the plans are taken from the wisdom
+            // file if possible, and newly measured plans are added to it
+            std::lock_guard<std::mutex> lock(FFTW3PlannerMutex());
+            const std::string& wisdomFile = FFTW3WisdomFile();
+            _planForward = fftwf_plan_guru_split_dft_r2c(1, &dim, 0, 0, _data, _re, _im, FFTW_MEASURE | FFTW_WISDOM_ONLY);
+            _planBackward = fftwf_plan_guru_split_dft_c2r(1, &dim, 0, 0, _re, _im, _data, FFTW_MEASURE | FFTW_WISDOM_ONLY);
+            if (!_planForward || !_planBackward)
+            {
+              if (!_planForward)
+              {
+                _planForward = fftwf_plan_guru_split_dft_r2c(1, &dim, 0, 0, _data, _re, _im, FFTW_MEASURE);
+              }
+              if (!_planBackward)
+              {
+                _planBackward = fftwf_plan_guru_split_dft_c2r(1, &dim, 0, 0, _re, _im, _data, FFTW_MEASURE);
+              }
+              if (!wisdomFile.empty())
+              {
+                fftwf_export_wisdom_to_filename(wisdomFile.c_str());
+              }
+            }
           }
         }
       }
@@ -949,12 +1532,19 @@ namespace audiofft
         ::memcpy(im, _im, _complexSize * sizeof(float));
       }
 
-      void ifft(float* data, const float* re, const float* im)
+      virtual void ifft(float* data, const float* re, const float* im, bool normalize) override
       {
         ::memcpy(_re, re, _complexSize * sizeof(float));
         ::memcpy(_im, im, _complexSize * sizeof(float));
         fftwf_execute_split_dft_c2r(_planBackward, _re, _im, _data);
-        ScaleBuffer(data, _data, 1.0f / static_cast<float>(_size), _size);
+        if (normalize)
+        {
+          ScaleBuffer(data, _data, 1.0f / static_cast<float>(_size), _size);
+        }
+        else
+        {
+          ::memcpy(data, _data, _size * sizeof(float));
+        }
       }
 
     private:
@@ -971,13 +1561,56 @@ namespace audiofft
     };
 
 
-    std::unique_ptr<AudioFFTImpl> MakeAudioFFTImpl()
+#endif // AUDIOFFT_FFTW3_USED
+
+
+    // ================================================================
+
+
+    static std::atomic<int> DefaultBackend(static_cast<int>(AudioFFT::Backend::Default));
+
+
+    static AudioFFT::Backend ResolveBackend(AudioFFT::Backend backend)
     {
-      return std::unique_ptr<FFTW3FFT>(new FFTW3FFT());
+      if (backend != AudioFFT::Backend::Default && AudioFFT::IsBackendAvailable(backend))
+      {
+        return backend;
+      }
+      const AudioFFT::Backend defaultBackend = static_cast<AudioFFT::Backend>(DefaultBackend.load());
+      if (defaultBackend != AudioFFT::Backend::Default)
+      {
+        return defaultBackend;
+      }
+#if defined(AUDIOFFT_APPLE_ACCELERATE_USED)
+      return AudioFFT::Backend::AppleAccelerate;
+#elif defined(AUDIOFFT_FFTW3_USED)
+      return AudioFFT::Backend::FFTW3;
+#elif defined(AUDIOFFT_OOURA)
+      return AudioFFT::Backend::Ooura;
+#else
+      return AudioFFT::Backend::SIMD;
+#endif
     }
 
 
-#endif // AUDIOFFT_FFTW3_USED
+    static std::unique_ptr<AudioFFTImpl> MakeAudioFFTImpl(AudioFFT::Backend backend)
+    {
+      switch (backend)
+      {
+#ifdef AUDIOFFT_APPLE_ACCELERATE_USED
+      case AudioFFT::Backend::AppleAccelerate:
+        return std::unique_ptr<AppleAccelerateFFT>(new AppleAccelerateFFT());
+#endif
+#ifdef AUDIOFFT_FFTW3_USED
+      case AudioFFT::Backend::FFTW3:
+        return std::unique_ptr<FFTW3FFT>(new FFTW3FFT());
+#endif
+      case AudioFFT::Backend::Ooura:
+        return std::unique_ptr<OouraFFT<float>>(new OouraFFT<float>());
+      default:
+        return std::unique_ptr<SIMDFFT>(new SIMDFFT());
+      }
+    }
 
   } // End of namespace details
 
@@ -986,11 +1619,25 @@ namespace audiofft
 
 
   AudioFFT::AudioFFT() :
-    _impl(details::MakeAudioFFTImpl())
+    _backend(details::ResolveBackend(Backend::Default)),
+    _impl(details::MakeAudioFFTImpl(_backend))
+  {
+  }
+
+
+  AudioFFT::AudioFFT(Backend backend) :
+    _backend(details::ResolveBackend(backend)),
+    _impl(details::MakeAudioFFTImpl(_backend))
   {
   }
 
 
+  AudioFFT::Backend AudioFFT::getBackend() const
+  {
+    return _backend;
+  }
+
+
   void AudioFFT::init(size_t size)
   {
     assert(details::IsPowerOf2(size));
@@ -1006,7 +1653,13 @@ namespace audiofft
 
   void AudioFFT::ifft(float* data, const float* re, const float* im)
   {
-    _impl->ifft(data, re, im);
+    _impl->ifft(data, re, im, true);
+  }
+
+
+  void AudioFFT::ifftUnnormalized(float* data, const float* re, const float* im)
+  {
+    _impl->ifft(data, re, im, false);
   }
 
 
@@ -1015,4 +1668,82 @@ namespace audiofft
     return (size / 2) + 1;
   }
 
+
+  bool AudioFFT::IsBackendAvailable(Backend backend)
+  {
+    switch (backend)
+    {
+    case Backend::Default:
+    case Backend::SIMD:
+    case Backend::Ooura:
+      return true;
+    case Backend::FFTW3:
+#ifdef AUDIOFFT_FFTW3_USED
+      return true;
+#else
+      return false;
+#endif
+    case Backend::AppleAccelerate:
+#ifdef AUDIOFFT_APPLE_ACCELERATE_USED
+      return true;
+#else
+      return false;
+#endif
+    }
+    return false;
+  }
+
+
+  void AudioFFT::SetDefaultBackend(Backend backend)
+  {
+    details::DefaultBackend.store(static_cast<int>(IsBackendAvailable(backend) ? backend : Backend::Default));
+  }
+
+
+  AudioFFT::Backend AudioFFT::GetDefaultBackend()
+  {
+    return details::ResolveBackend(Backend::Default);
+  }
+
+
+  const char* AudioFFT::GetBackendName(Backend backend)
+  {
+    switch (backend)
+    {
+    case Backend::Default:
+      return GetBackendName(GetDefaultBackend());
+    case Backend::SIMD:
+#ifdef AUDIOFFT_SIMD_SSE
+      return "SIMD (SSE)";
+#else
+      return "SIMD (Scalar)";
+#endif
+    case Backend::Ooura:
+      return "Ooura";
+    case Backend::FFTW3:
+      return "FFTW3";
+    case Backend::AppleAccelerate:
+      return "Apple Accelerate";
+    }
+    return "";
+  }
+
+
+  void AudioFFT::SetWisdomFile(const std::string& fileName)
+  {
+#ifdef AUDIOFFT_FFTW3_USED
+    std::lock_guard<std::mutex> lock(details::FFTW3PlannerMutex());
+    if (details::FFTW3WisdomFile() != fileName)
+    {
+      details::FFTW3WisdomFile() = fileName;
+      if (!fileName.empty())
+      {
+        fftwf_import_wisdom_from_filename(fileName.c_str());
+      }
+    }
+#else
+    (void)fileName;
+#endif
+  }
+
 } // End of namespace
@@ -30,7 +30,8 @@
 *
 * - Real-complex FFT and complex-real inverse FFT for power-of-2-sized real data.
 *
-* - Uniform interface to different FFT implementations (currently Ooura, FFTW3 and Apple Accelerate).
+* - Uniform interface to different FFT implementations ("backends", currently a built-in
+*   float-native SIMD FFT, Ooura, FFTW3 and Apple Accelerate), which can be selected at runtime.
 *
 * - Complex data is handled in "split-complex" format, i.e. there are separate
 *   arrays for the real and imaginary parts which can be useful for SIMD optimizations
@@ -47,9 +48,14 @@
 *
 * - Add the .h and .cpp file to your project - that's all.
 *
+* - By default, the built-in SIMD backend is used (with SSE if available, define
+*   AUDIOFFT_DONT_USE_SSE to force portable code). Define AUDIOFFT_OOURA to make
+*   the Ooura backend the default instead.
+*
 * - To get extra speed, you can link FFTW3 to your project and define
 *   AUDIOFFT_FFTW3 (however, please check whether your project suits the
-*   according license).
+*   according license). FFTW3 measures the fastest algorithm for each size, which
+*   takes some time, so you might want to cache the results (see SetWisdomFile()).
 *
 * - To get the best speed on Apple platforms, you can link the Apple
 *   Accelerate framework to your project and define
@@ -89,6 +95,7 @@
 
 #include <cstddef>
 #include <memory>
+#include <string>
 
 
 namespace audiofft
@@ -104,7 +111,7 @@ namespace audiofft
       virtual ~AudioFFTImpl() = default;
       virtual void init(size_t size) = 0;
       virtual void fft(const float* data, float* re, float* im) = 0;
-      virtual void ifft(float* data, const float* re, const float* im) = 0;
+      virtual void ifft(float* data, const float* re, const float* im, bool normalize) = 0;
 
     private:
       AudioFFTImpl(const AudioFFTImpl&) = delete;
@@ -124,10 +131,34 @@ namespace audiofft
   {
   public:
     /**
-     * @brief Constructor
+     * @brief FFT implementations
+     */
+    enum class Backend
+    {
+      Default,        ///< The default backend (see SetDefaultBackend())
+      SIMD,           ///< Built-in float-native split-complex FFT (always available)
+      Ooura,          ///< Ooura's radix-4 FFT (always available)
+      FFTW3,          ///< FFTW3 (only available if AUDIOFFT_FFTW3 is defined)
+      AppleAccelerate ///< Apple Accelerate (only available if AUDIOFFT_APPLE_ACCELERATE is defined)
+    };
+
+    /**
+     * @brief Constructor, uses the default backend
      */
     AudioFFT();
 
+    /**
+     * @brief Constructor
+     * @param backend The backend to use (the default backend if it isn't available)
+     */
+    explicit AudioFFT(Backend backend);
+
+    /**
+     * @brief Returns the backend actually used
+     * @return The backend (never Backend::Default)
+     */
+    Backend getBackend() const;
+
     /**
      * @brief Initializes the FFT object
      * @param size Size of the real input (must be power 2)
@@ -150,6 +181,18 @@ namespace audiofft
      */
     void ifft(float* data, const float* re, const float* im);
 
+    /**
+     * @brief Performs the inverse FFT without normalization, i.e. the output is scaled by the size
+     *
+     * Useful if the normalization can be folded into the spectrum in advance (e.g.
+     * into a fixed filter spectrum which is multiplied with the input spectra).
+     *
+     * @param data The real output data (has to be of the length as specified in init())
+     * @param re The real part of the complex input (has to be of length as returned by ComplexSize())
+     * @param im The imaginary part of the complex input (has to be of length as returned by ComplexSize())
+     */
+    void ifftUnnormalized(float* data, const float* re, const float* im);
+
     /**
      * @brief Calculates the necessary size of the real/imaginary complex arrays
      * @param size The size of the real data
@@ -157,7 +200,45 @@ namespace audiofft
      */
     static size_t ComplexSize(size_t size);
 
+    /**
+     * @brief Checks whether a backend is available in this build
+     * @param backend The backend
+     * @return true: Available - false: Not available
+     */
+    static bool IsBackendAvailable(Backend backend);
+
+    /**
+     * @brief Sets the backend used by all AudioFFT objects constructed afterwards without explicit backend
+     * @param backend The backend (Backend::Default or an unavailable backend restores the built-in choice:
+     * Apple Accelerate, FFTW3 or the SIMD backend, in this order of preference)
+     */
+    static void SetDefaultBackend(Backend backend);
+
+    /**
+     * @brief Returns the backend used by AudioFFT objects constructed without explicit backend
+     * @return The default backend (never Backend::Default)
+     */
+    static Backend GetDefaultBackend();
+
+    /**
+     * @brief Returns a human-readable name of a backend
+     * @param backend The backend
+     * @return The name
+     */
+    static const char* GetBackendName(Backend backend);
+
+    /**
+     * @brief Sets the file caching measured FFTW3 plans ("wisdom") between program runs
+     *
+     * The wisdom in the file is imported immediately, and the file gets updated whenever
+     * a new plan has been measured. Has no effect for other backends than FFTW3.
+     *
+     * @param fileName The path of the wisdom file (empty: no caching)
+     */
+    static void SetWisdomFile(const std::string& fileName);
+
   private:
+    Backend _backend;
     std::unique_ptr<details::AudioFFTImpl> _impl;
 
     AudioFFT(const AudioFFT&) = delete;
@@ -28,13 +28,160 @@
 namespace fftconvolver
 {  
 
+// Number of IR samples transformed by each chunk of the preparation of the IR
+// segments, so smaller impulse responses aren't worth distributing
+static const size_t PreparationChunkSize = 1 << 16;
+
+
+PartitionedIR::PartitionedIR(size_t blockSize, size_t irLen) :
+  _blockSize(NextPowerOf2(blockSize)),
+  _segSize(2 * _blockSize),
+  _segCount(static_cast<size_t>(::ceil(static_cast<float>(irLen) / static_cast<float>(_blockSize)))),
+  _segStride(AlignedSize<Sample>(audiofft::AudioFFT::ComplexSize(_segSize))),
+  _segments(_segCount * 2 * _segStride),
+  _segmentEnergies(_segCount, 0.0)
+{
+}
+
+
+std::shared_ptr<const PartitionedIR> PartitionedIR::Create(size_t blockSize, const Sample* ir, size_t irLen)
+{
+  return Create(blockSize, ir, irLen, Sample(1.0));
+}
+
+
+std::shared_ptr<const PartitionedIR> PartitionedIR::Create(size_t blockSize, const Sample* ir, size_t irLen, Sample gain)
+{
+  return Create(blockSize, ir, irLen, gain, ChunkRunner());
+}
+
+
+std::shared_ptr<const PartitionedIR> PartitionedIR::Create(size_t blockSize, const Sample* ir, size_t irLen, Sample gain, const ChunkRunner& runChunks)
+{
+  if (blockSize == 0)
+  {
+    return std::shared_ptr<const PartitionedIR>();
+  }
+
+  // Ignore zeros at the end of the impulse response because they only waste computation time
+  while (irLen > 0 && ::fabs(ir[irLen-1]) < 0.000001f)
+  {
+    --irLen;
+  }
+
+  std::shared_ptr<PartitionedIR> partitionedIR(new PartitionedIR(blockSize, irLen));
+  const size_t segCount = partitionedIR->_segCount;
+
+  // The convolvers use unnormalized inverse FFTs, so the normalization
+  // is applied here once instead of to each block of output
+  const Sample scale = gain / static_cast<Sample>(partitionedIR->_segSize);
+  
+  // The segments are independent of each other, so for long impulse responses
+  // their FFTs are prepared in chunks, which the caller may run concurrently
+  const size_t chunkSegCount = std::max(static_cast<size_t>(1), PreparationChunkSize / partitionedIR->_segSize);
+  const size_t chunkCount = (segCount + chunkSegCount - 1) / chunkSegCount;
+  if (chunkCount > 1 && runChunks)
+  {
+    PartitionedIR* prepared = partitionedIR.get();
+    runChunks(chunkCount, [=](size_t chunk)
+    {
+      prepared->prepareSegments(ir, irLen, scale, chunk * chunkSegCount, std::min((chunk + 1) * chunkSegCount, segCount));
+    });
+  }
+  else
+  {
+    partitionedIR->prepareSegments(ir, irLen, scale, 0, segCount);
+  }
+
+  return partitionedIR;
+}
+
+
+void PartitionedIR::prepareSegments(const Sample* ir, size_t irLen, Sample scale, size_t begin, size_t end)
+{
+  // Each chunk needs its own FFT instance and buffer (chunks might be prepared concurrently)
+  audiofft::AudioFFT fft;
+  fft.init(_segSize);
+  SampleBuffer fftBuffer(_segSize);
+  const double gain = static_cast<double>(scale) * static_cast<double>(_segSize);
+  for (size_t i=begin; i<end; ++i)
+  {
+    const size_t remaining = irLen - (i * _blockSize);
+    const size_t sizeCopy = (remaining >= _blockSize) ? _blockSize : remaining;
+    CopyAndPad(fftBuffer, &ir[i*_blockSize], sizeCopy);
+    double energy = 0.0;
+    for (size_t j=0; j<sizeCopy; ++j)
+    {
+      energy += static_cast<double>(fftBuffer[j]) * static_cast<double>(fftBuffer[j]);
+      fftBuffer[j] *= scale;
+    }
+    _segmentEnergies[i] = gain * gain * energy;
+    Sample* re = _segments.data() + i * 2 * _segStride;
+    fft.fft(fftBuffer.data(), re, re + _segStride);
+  }
+}
+
+
+size_t PartitionedIR::getBlockSize() const
+{
+  return _blockSize;
+}
+
+
+size_t PartitionedIR::getSegmentCount() const
+{
+  return _segCount;
+}
+
+
+const Sample* PartitionedIR::segmentRe(size_t index) const
+{
+  assert(index < _segCount);
+  return _segments.data() + index * 2 * _segStride;
+}
+
+
+const Sample* PartitionedIR::segmentIm(size_t index) const
+{
+  return segmentRe(index) + _segStride;
+}
+
+
+double PartitionedIR::getSegmentEnergy(size_t index) const
+{
+  assert(index < _segCount);
+  return _segmentEnergies[index];
+}
+
+
+double PartitionedIR::getEnergy() const
+{
+  double energy = 0.0;
+  for (size_t i=0; i<_segCount; ++i)
+  {
+    energy += _segmentEnergies[i];
+  }
+  return energy;
+}
+
+
+// ===================================================================
+
+
+const double FFTConvolver::DefaultSegmentThreshold = 1e-12;
+
+
 FFTConvolver::FFTConvolver() :
   _blockSize(0),
   _segSize(0),
   _segCount(0),
   _fftComplexSize(0),
-  _segments(),
-  _segmentsIR(),
+  _segStride(0),
+  _inputCount(0),
+  _outputCount(0),
+  _irs(),
+  _arena(),
+  _segmentsArena(),
   _fftBuffer(),
   _fft(),
   _preMultiplied(),
@@ -42,7 +189,14 @@ FFTConvolver::FFTConvolver() :
   _overlap(),
   _current(0),
   _inputBuffer(),
-  _inputBufferFill(0)
+  _inputBufferFill(0),
+  _buffered(false),
+  _outputBuffer(),
+  _silentIRSegments(),
+  _silentSegments(),
+  _activeSegmentCounts(),
+  _idleOutputs(),
+  _silentOverlaps()
 {
 }
 
@@ -55,18 +209,15 @@ FFTConvolver::~FFTConvolver()
   
 void FFTConvolver::reset()
 {  
-  for (size_t i=0; i<_segCount; ++i)
-  {
-    delete _segments[i];
-    delete _segmentsIR[i];
-  }
-  
   _blockSize = 0;
   _segSize = 0;
   _segCount = 0;
   _fftComplexSize = 0;
-  _segments.clear();
-  _segmentsIR.clear();
+  _segStride = 0;
+  _inputCount = 0;
+  _outputCount = 0;
+  _irs.clear();
+  _segmentsArena.clear();
   _fftBuffer.clear();
   _fft.init(0);
   _preMultiplied.clear();
@@ -75,71 +226,185 @@ void FFTConvolver::reset()
   _current = 0;
   _inputBuffer.clear();
   _inputBufferFill = 0;
+  _buffered = false;
+  _outputBuffer.clear();
+  _silentIRSegments.clear();
+  _silentSegments.clear();
+  _activeSegmentCounts.clear();
+  _idleOutputs.clear();
+  _silentOverlaps.clear();
+  _arena.clear();
 }
 
   
 bool FFTConvolver::init(size_t blockSize, const Sample* ir, size_t irLen)
+{
+  return init(PartitionedIR::Create(blockSize, ir, irLen));
+}
+
+
+bool FFTConvolver::init(size_t blockSize, const Sample* ir, size_t irLen, Sample gain)
+{
+  return init(PartitionedIR::Create(blockSize, ir, irLen, gain));
+}
+
+
+bool FFTConvolver::init(const std::shared_ptr<const PartitionedIR>& ir)
+{
+  return init(ir, false);
+}
+
+
+bool FFTConvolver::init(const std::shared_ptr<const PartitionedIR>& ir, bool buffered)
+{
+  if (!ir)
+  {
+    reset();
+    return false;
+  }
+  return init(std::vector<std::shared_ptr<const PartitionedIR> >(1, ir), buffered);
+}
+
+
+bool FFTConvolver::init(const std::vector<std::shared_ptr<const PartitionedIR> >& irs, bool buffered)
+{
+  return init(irs, 1, buffered);
+}
+
+
+bool FFTConvolver::init(const std::vector<std::shared_ptr<const PartitionedIR> >& irs, size_t inputCount, bool buffered)
+{
+  std::vector<double> segmentEnergyFloors(irs.size(), 0.0);
+  for (size_t i=0; i<irs.size(); ++i)
+  {
+    if (irs[i])
+    {
+      segmentEnergyFloors[i] = DefaultSegmentThreshold * irs[i]->getEnergy();
+    }
+  }
+  return init(irs, inputCount, buffered, segmentEnergyFloors);
+}
+
+
+bool FFTConvolver::init(const std::vector<std::shared_ptr<const PartitionedIR> >& irs, size_t inputCount, bool buffered, const std::vector<double>& segmentEnergyFloors)
 {
   reset();
 
-  if (blockSize == 0)
+  if (inputCount == 0 || irs.size() % inputCount != 0 || segmentEnergyFloors.size() != irs.size())
   {
     return false;
   }
-  
-  // Ignore zeros at the end of the impulse response because they only waste computation time
-  while (irLen > 0 && ::fabs(ir[irLen-1]) < 0.000001f)
+
+  // All inputs and outputs share the block size, and the delay lines
+  // have to be as long as the longest impulse response (impulse responses
+  // without any segment above their energy floor are no connection at all)
+  size_t blockSize = 0;
+  size_t segCount = 0;
+  for (size_t i=0; i<irs.size(); ++i)
   {
-    --irLen;
+    bool active = false;
+    for (size_t j=0; irs[i] && j<irs[i]->getSegmentCount() && !active; ++j)
+    {
+      active = (irs[i]->getSegmentEnergy(j) > segmentEnergyFloors[i]);
+    }
+    if (active)
+    {
+      if (blockSize != 0 && irs[i]->getBlockSize() != blockSize)
+      {
+        _irs.clear();
+        return false;
+      }
+      blockSize = irs[i]->getBlockSize();
+      segCount = std::max(segCount, irs[i]->getSegmentCount());
+    }
+    _irs.push_back(active ? irs[i] : std::shared_ptr<const PartitionedIR>());
   }
 
-  if (irLen == 0)
+  _inputCount = inputCount;
+  _outputCount = irs.size() / inputCount;
+
+  if (segCount == 0)
   {
     return true;
   }
+
+  InitSIMDKernel();
   
-  _blockSize = NextPowerOf2(blockSize);
+  _blockSize = blockSize;
   _segSize = 2 * _blockSize;
-  _segCount = static_cast<size_t>(::ceil(static_cast<float>(irLen) / static_cast<float>(_blockSize)));
+  _segCount = segCount;
   _fftComplexSize = audiofft::AudioFFT::ComplexSize(_segSize);
+  _segStride = AlignedSize<Sample>(_fftComplexSize);
   
+  _buffered = buffered;
+
+  // All buffers live in one block of memory
+  _arena.allocate(Arena::Bytes<Sample>(_segSize)
+                + Arena::Bytes<Sample>(_inputCount * _segCount * 2 * _segStride)
+                + Arena::Bytes<Sample>(_outputCount * 2 * _segStride)
+                + 2 * Arena::Bytes<Sample>(_fftComplexSize)
+                + Arena::Bytes<Sample>(_outputCount * _blockSize)
+                + Arena::Bytes<Sample>(_inputCount * _blockSize)
+                + (_buffered ? Arena::Bytes<Sample>(_outputCount * _blockSize) : 0));
+
   // FFT
   _fft.init(_segSize);
-  _fftBuffer.resize(_segSize);
+  _fftBuffer.attach(_arena, _segSize);
   
-  // Prepare segments
-  for (size_t i=0; i<_segCount; ++i)
-  {
-    _segments.push_back(new SplitComplex(_fftComplexSize));    
-  }
-  
-  // Prepare IR
-  for (size_t i=0; i<_segCount; ++i)
-  {
-    SplitComplex* segment = new SplitComplex(_fftComplexSize);
-    const size_t remaining = irLen - (i * _blockSize);
-    const size_t sizeCopy = (remaining >= _blockSize) ? _blockSize : remaining;
-    CopyAndPad(_fftBuffer, &ir[i*_blockSize], sizeCopy);
-    _fft.fft(_fftBuffer.data(), segment->re(), segment->im());
-    _segmentsIR.push_back(segment);
-  }
+  // Prepare input segments in one contiguous region
+  _segmentsArena.attach(_arena, _inputCount * _segCount * 2 * _segStride);
   
-  // Prepare convolution buffers  
-  _preMultiplied.resize(_fftComplexSize);
-  _conv.resize(_fftComplexSize);
-  _overlap.resize(_blockSize);
+  // Prepare convolution buffers (the pre-multiplied spectra and the
+  // overlaps of the outputs back to back)
+  _preMultiplied.attach(_arena, _outputCount * 2 * _segStride);
+  _conv.attach(_arena, _fftComplexSize);
+  _overlap.attach(_arena, _outputCount * _blockSize);
   
-  // Prepare input buffer
-  _inputBuffer.resize(_blockSize);
+  // Prepare input buffers
+  _inputBuffer.attach(_arena, _inputCount * _blockSize);
   _inputBufferFill = 0;
 
+  // Prepare output buffer (delayed output of the buffered processing)
+  if (_buffered)
+  {
+    _outputBuffer.attach(_arena, _outputCount * _blockSize);
+  }
+
   // Reset current position
   _current = 0;
+
+  // Segments of the impulse responses to be skipped
+  _silentIRSegments.assign(_irs.size() * _segCount, true);
+  for (size_t i=0; i<_irs.size(); ++i)
+  {
+    for (size_t j=0; _irs[i] && j<_irs[i]->getSegmentCount(); ++j)
+    {
+      _silentIRSegments[i * _segCount + j] = (_irs[i]->getSegmentEnergy(j) <= segmentEnergyFloors[i]);
+    }
+  }
+
+  // Nothing but silence so far
+  _silentSegments.assign(_inputCount * _segCount, true);
+  _activeSegmentCounts.assign(_inputCount, 0);
+  _idleOutputs.assign(_outputCount, true);
+  _silentOverlaps.assign(_outputCount, true);
   
   return true;
 }
 
 
+size_t FFTConvolver::getInputCount() const
+{
+  return _inputCount;
+}
+
+
+size_t FFTConvolver::getOutputCount() const
+{
+  return _outputCount;
+}
+
+
 void FFTConvolver::process(const Sample* input, Sample* output, size_t len)
 {
   if (_segCount == 0)
@@ -148,49 +413,98 @@ void FFTConvolver::process(const Sample* input, Sample* output, size_t len)
     return;
   }
 
+  assert(_inputCount == 1 && _outputCount == 1);
+  process(&input, &output, len);
+}
+
+
+void FFTConvolver::process(const Sample* input, Sample* const* outputs, size_t len)
+{
+  assert(_inputCount <= 1);
+  process(&input, outputs, len);
+}
+
+
+void FFTConvolver::process(const Sample* const* inputs, Sample* const* outputs, size_t len)
+{
+  if (_segCount == 0)
+  {
+    for (size_t o=0; o<_outputCount; ++o)
+    {
+      ::memset(outputs[o], 0, len * sizeof(Sample));
+    }
+    return;
+  }
+
+  if (_buffered)
+  {
+    processBuffered(inputs, outputs, len);
+    return;
+  }
+
   size_t processed = 0;
   while (processed < len)
   {
     const bool inputBufferWasEmpty = (_inputBufferFill == 0);
     const size_t processing = std::min(len-processed, _blockSize-_inputBufferFill);
     const size_t inputBufferPos = _inputBufferFill;
-    ::memcpy(_inputBuffer.data()+inputBufferPos, input+processed, processing * sizeof(Sample));
-
-    // Forward FFT
-    CopyAndPad(_fftBuffer, &_inputBuffer[0], _blockSize); 
-    _fft.fft(_fftBuffer.data(), _segments[_current]->re(), _segments[_current]->im());
+    const bool blockComplete = (_inputBufferFill + processing == _blockSize);
 
-    // Complex multiplication
-    if (inputBufferWasEmpty)
+    // Forward FFTs (once per input for all outputs, unless the block is silent so far)
+    for (size_t i=0; i<_inputCount; ++i)
     {
-      _preMultiplied.setZero();
-      for (size_t i=1; i<_segCount; ++i)
+      Sample* inputBuffer = _inputBuffer.data() + i * _blockSize;
+      ::memcpy(inputBuffer+inputBufferPos, inputs[i]+processed, processing * sizeof(Sample));
+      const bool silent = (inputBufferWasEmpty || _silentSegments[i * _segCount + _current]) && IsSilent(inputs[i]+processed, processing);
+      setSegmentSilent(i, _current, silent);
+      if (!silent)
       {
-        const size_t indexIr = i;
-        const size_t indexAudio = (_current + i) % _segCount;
-        ComplexMultiplyAccumulate(_preMultiplied, *_segmentsIR[indexIr], *_segments[indexAudio]);
+        CopyAndPad(_fftBuffer, inputBuffer, _blockSize);
+        _fft.fft(_fftBuffer.data(), segmentRe(i, _current), segmentIm(i, _current));
       }
     }
-    _conv.copyFrom(_preMultiplied);
-    ComplexMultiplyAccumulate(_conv, *_segments[_current], *_segmentsIR[0]);
 
-    // Backward FFT
-    _fft.ifft(_fftBuffer.data(), _conv.re(), _conv.im());
+    for (size_t o=0; o<_outputCount; ++o)
+    {
+      if (isIdle(o))
+      {
+        ringOut(o, outputs[o]+processed, inputBufferPos, processing, blockComplete);
+        _idleOutputs[o] = true;
+        continue;
+      }
 
-    // Add overlap
-    Sum(output+processed, _fftBuffer.data()+inputBufferPos, _overlap.data()+inputBufferPos, processing);
+      // Complex multiplication (the pre-multiplied spectrum is outdated if the
+      // output has been idle so far in this block)
+      if (inputBufferWasEmpty || _idleOutputs[o])
+      {
+        preMultiply(o);
+      }
+      _idleOutputs[o] = false;
+      convolve(o);
+
+      // Backward FFT (once per output for all inputs)
+      _fft.ifftUnnormalized(_fftBuffer.data(), _conv.re(), _conv.im());
+
+      // Add overlap
+      Sample* overlap = _overlap.data() + o * _blockSize;
+      Sum(outputs[o]+processed, _fftBuffer.data()+inputBufferPos, overlap+inputBufferPos, processing);
+
+      // Input buffer full => Save the overlap for the next block
+      if (blockComplete)
+      {
+        ::memcpy(overlap, _fftBuffer.data()+_blockSize, _blockSize * sizeof(Sample));
+        _silentOverlaps[o] = false;
+      }
+    }
 
     // Input buffer full => Next block
     _inputBufferFill += processing;
-    if (_inputBufferFill == _blockSize)
+    if (blockComplete)
     {
-      // Input buffer is empty again now
+      // Input buffers are empty again now
       _inputBuffer.setZero();
       _inputBufferFill = 0;
 
-      // Save the overlap
-      ::memcpy(_overlap.data(), _fftBuffer.data()+_blockSize, _blockSize * sizeof(Sample));
-
       // Update current segment
       _current = (_current > 0) ? (_current - 1) : (_segCount - 1);
     }
@@ -198,5 +512,263 @@ void FFTConvolver::process(const Sample* input, Sample* output, size_t len)
     processed += processing;
   }
 }
-  
+
+
+size_t FFTConvolver::getLatency() const
+{
+  return _buffered ? _blockSize : 0;
+}
+
+
+void FFTConvolver::processBuffered(const Sample* const* inputs, Sample* const* outputs, size_t len)
+{
+  size_t processed = 0;
+  while (processed < len)
+  {
+    const size_t processing = std::min(len-processed, _blockSize-_inputBufferFill);
+    for (size_t i=0; i<_inputCount; ++i)
+    {
+      ::memcpy(_inputBuffer.data()+i*_blockSize+_inputBufferFill, inputs[i]+processed, processing * sizeof(Sample));
+    }
+    for (size_t o=0; o<_outputCount; ++o)
+    {
+      ::memcpy(outputs[o]+processed, _outputBuffer.data()+o*_blockSize+_inputBufferFill, processing * sizeof(Sample));
+    }
+    _inputBufferFill += processing;
+
+    // Input buffers full => One forward FFT per input and one backward FFT per output for the whole block
+    if (_inputBufferFill == _blockSize)
+    {
+      for (size_t i=0; i<_inputCount; ++i)
+      {
+        const Sample* inputBuffer = _inputBuffer.data() + i * _blockSize;
+        const bool silent = IsSilent(inputBuffer, _blockSize);
+        setSegmentSilent(i, _current, silent);
+        if (!silent)
+        {
+          CopyAndPad(_fftBuffer, inputBuffer, _blockSize);
+          _fft.fft(_fftBuffer.data(), segmentRe(i, _current), segmentIm(i, _current));
+        }
+      }
+
+      for (size_t o=0; o<_outputCount; ++o)
+      {
+        if (isIdle(o))
+        {
+          ringOut(o, _outputBuffer.data()+o*_blockSize, 0, _blockSize, true);
+          continue;
+        }
+        preMultiply(o);
+        convolve(o);
+        _fft.ifftUnnormalized(_fftBuffer.data(), _conv.re(), _conv.im());
+
+        Sample* overlap = _overlap.data() + o * _blockSize;
+        Sum(_outputBuffer.data()+o*_blockSize, _fftBuffer.data(), overlap, _blockSize);
+        ::memcpy(overlap, _fftBuffer.data()+_blockSize, _blockSize * sizeof(Sample));
+        _silentOverlaps[o] = false;
+      }
+
+      _inputBufferFill = 0;
+      _current = (_current > 0) ? (_current - 1) : (_segCount - 1);
+    }
+
+    processed += processing;
+  }
+}
+
+
+void FFTConvolver::preMultiply(size_t output)
+{
+  // The audio segments following the current one pair up with IR segments
+  // 1, 2, ... until the end of the delay line, the remaining ones wrap around
+  // to its start. Both runs are contiguous in the arena, so each of them
+  // is handled by a single fused call (apart from silent segments). Impulse
+  // responses shorter than the delay line just end earlier. The products of
+  // all inputs are summed up.
+  const size_t wrapBegin = _segCount - _current;
+  Sample* re = preMultipliedRe(output);
+  Sample* im = preMultipliedIm(output);
+  ::memset(re, 0, _fftComplexSize * sizeof(Sample));
+  ::memset(im, 0, _fftComplexSize * sizeof(Sample));
+  for (size_t i=0; i<_inputCount; ++i)
+  {
+    const PartitionedIR* ir = getIR(i, output);
+    if (!ir || _activeSegmentCounts[i] == 0)
+    {
+      continue;
+    }
+    const size_t irSegCount = ir->getSegmentCount();
+    const size_t tailCount = std::min(_segCount - 1 - _current, irSegCount - 1);
+    if (tailCount > 0)
+    {
+      multiplyAccumulateSegments(re, im, i, output, 1, _current + 1, tailCount);
+    }
+    if (_current > 0 && wrapBegin < irSegCount)
+    {
+      multiplyAccumulateSegments(re, im, i, output, wrapBegin, 0, irSegCount - wrapBegin);
+    }
+  }
+}
+
+
+void FFTConvolver::multiplyAccumulateSegments(Sample* re, Sample* im, size_t input, size_t output, size_t irIndex, size_t index, size_t count)
+{
+  // Each run of pairs of non-silent audio and IR segments is handled by a single fused call
+  const PartitionedIR* ir = getIR(input, output);
+  const size_t segStride = 2 * _segStride;
+  const size_t audioSegments = input * _segCount + index;
+  const size_t irSegments = (input * _outputCount + output) * _segCount + irIndex;
+  size_t begin = 0;
+  while (begin < count)
+  {
+    if (_silentSegments[audioSegments + begin] || _silentIRSegments[irSegments + begin])
+    {
+      ++begin;
+      continue;
+    }
+    size_t end = begin + 1;
+    while (end < count && !_silentSegments[audioSegments + end] && !_silentIRSegments[irSegments + end])
+    {
+      ++end;
+    }
+    ComplexMultiplyAccumulate(re,
+                              im,
+                              ir->segmentRe(irIndex + begin),
+                              ir->segmentIm(irIndex + begin),
+                              segStride,
+                              segmentRe(input, index + begin),
+                              segmentIm(input, index + begin),
+                              segStride,
+                              end - begin,
+                              _fftComplexSize);
+    begin = end;
+  }
+}
+
+
+void FFTConvolver::convolve(size_t output)
+{
+  // Pre-multiplied spectrum plus the current segments of all inputs feeding
+  // the output => Spectrum of the output block
+  ::memcpy(_conv.re(), preMultipliedRe(output), _fftComplexSize * sizeof(Sample));
+  ::memcpy(_conv.im(), preMultipliedIm(output), _fftComplexSize * sizeof(Sample));
+  for (size_t i=0; i<_inputCount; ++i)
+  {
+    const PartitionedIR* ir = getIR(i, output);
+    if (ir && !_silentSegments[i * _segCount + _current] && !_silentIRSegments[(i * _outputCount + output) * _segCount])
+    {
+      ComplexMultiplyAccumulate(_conv.re(),
+                                _conv.im(),
+                                segmentRe(i, _current),
+                                segmentIm(i, _current),
+                                ir->segmentRe(0),
+                                ir->segmentIm(0),
+                                _fftComplexSize);
+    }
+  }
+}
+
+
+void FFTConvolver::setSegmentSilent(size_t input, size_t index, bool silent)
+{
+  const size_t segment = input * _segCount + index;
+  if (_silentSegments[segment] != silent)
+  {
+    _silentSegments[segment] = silent;
+    if (silent)
+    {
+      --_activeSegmentCounts[input];
+    }
+    else
+    {
+      ++_activeSegmentCounts[input];
+    }
+  }
+}
+
+
+bool FFTConvolver::isIdle() const
+{
+  // The current block counts as well, so it's fine to be in the middle of it
+  if (_buffered)
+  {
+    return false;
+  }
+  for (size_t o=0; o<_outputCount; ++o)
+  {
+    if (!isIdle(o) || !_silentOverlaps[o])
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+bool FFTConvolver::isIdle(size_t output) const
+{
+  // Idle: None of the inputs feeding the output has any non-silent segment
+  for (size_t i=0; i<_inputCount; ++i)
+  {
+    if (_activeSegmentCounts[i] > 0 && getIR(i, output))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+void FFTConvolver::ringOut(size_t output, Sample* data, size_t pos, size_t len, bool blockComplete)
+{
+  // Nothing to convolve => The output is just the rest of the previous block,
+  // and there's nothing left to ring out after this block
+  Sample* overlap = _overlap.data() + output * _blockSize;
+  if (_silentOverlaps[output])
+  {
+    ::memset(data, 0, len * sizeof(Sample));
+    return;
+  }
+  ::memcpy(data, overlap+pos, len * sizeof(Sample));
+  if (blockComplete)
+  {
+    ::memset(overlap, 0, _blockSize * sizeof(Sample));
+    _silentOverlaps[output] = true;
+  }
+}
+
+
+const PartitionedIR* FFTConvolver::getIR(size_t input, size_t output) const
+{
+  assert(input < _inputCount && output < _outputCount);
+  return _irs[input * _outputCount + output].get();
+}
+
+
+Sample* FFTConvolver::segmentRe(size_t input, size_t index)
+{
+  assert(input < _inputCount && index < _segCount);
+  return _segmentsArena.data() + (input * _segCount + index) * 2 * _segStride;
+}
+
+
+Sample* FFTConvolver::segmentIm(size_t input, size_t index)
+{
+  return segmentRe(input, index) + _segStride;
+}
+
+
+Sample* FFTConvolver::preMultipliedRe(size_t output)
+{
+  assert(output < _outputCount);
+  return _preMultiplied.data() + output * 2 * _segStride;
+}
+
+
+Sample* FFTConvolver::preMultipliedIm(size_t output)
+{
+  return preMultipliedRe(output) + _segStride;
+}
+
+
 } // End of namespace fftconvolver
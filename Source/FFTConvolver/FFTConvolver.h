@@ -21,12 +21,132 @@
 #include "AudioFFT.h"
 #include "Utilities.h"
 
+#include <functional>
+#include <memory>
 #include <vector>
 
 
 namespace fftconvolver
 { 
 
+/**
+* @class PartitionedIR
+* @brief Spectra of an impulse response which is partitioned into segments of uniform size
+*
+* A partitioned impulse response can't be modified anymore after its creation, so it can
+* be shared by any number of convolvers (e.g. by all convolvers of all plugin instances
+* using the same impulse response with the same block size).
+*
+* The segments of long impulse responses are prepared in chunks of a fixed size, which
+* can be distributed over the threads of a pool owned by the caller (see ChunkRunner).
+*
+* The spectra already contain the normalization of the inverse FFT (and optionally
+* a static gain), so the convolvers can use unnormalized inverse FFTs.
+*
+* The energy of each segment is recorded as well, so the convolvers can leave out
+* segments which don't contribute audibly to the output (e.g. a pre-delay).
+*/
+class PartitionedIR
+{
+public:
+  /**
+  * @brief Partitions an impulse response
+  * @param blockSize Block size of the convolver(s) using the impulse response (partition size)
+  * @param ir The impulse response
+  * @param irLen Length of the impulse response
+  * @return The partitioned impulse response (nullptr if the block size is invalid)
+  */
+  static std::shared_ptr<const PartitionedIR> Create(size_t blockSize, const Sample* ir, size_t irLen);
+
+  /**
+  * @brief Partitions an impulse response and applies a static gain to it
+  * @param blockSize Block size of the convolver(s) using the impulse response (partition size)
+  * @param ir The impulse response
+  * @param irLen Length of the impulse response
+  * @param gain Gain of the convolution result (at no additional cost during processing)
+  * @return The partitioned impulse response (nullptr if the block size is invalid)
+  */
+  static std::shared_ptr<const PartitionedIR> Create(size_t blockSize, const Sample* ir, size_t irLen, Sample gain);
+
+  /**
+  * @brief Function running all chunks of a preparation, e.g. by the threads of a pool
+  *
+  * It's called with the number of chunks and the function preparing a chunk by its index.
+  * The chunks are independent of each other, so they may be prepared concurrently, but
+  * the function must not return before all of them have been prepared.
+  */
+  typedef std::function<void(size_t chunkCount, const std::function<void(size_t chunk)>& prepareChunk)> ChunkRunner;
+
+  /**
+  * @brief Partitions an impulse response and applies a static gain to it, preparing the segments in chunks
+  * @param blockSize Block size of the convolver(s) using the impulse response (partition size)
+  * @param ir The impulse response
+  * @param irLen Length of the impulse response
+  * @param gain Gain of the convolution result (at no additional cost during processing)
+  * @param runChunks Function running the chunks (only called if there's more than one chunk)
+  * @return The partitioned impulse response (nullptr if the block size is invalid)
+  */
+  static std::shared_ptr<const PartitionedIR> Create(size_t blockSize, const Sample* ir, size_t irLen, Sample gain, const ChunkRunner& runChunks);
+
+  /**
+  * @brief Returns the block size (always a power of 2)
+  * @return The block size
+  */
+  size_t getBlockSize() const;
+
+  /**
+  * @brief Returns the number of segments
+  * @return The number of segments (0 if the impulse response is empty)
+  */
+  size_t getSegmentCount() const;
+
+  /**
+  * @brief Returns the real part of the spectrum of a segment
+  * @param index The index of the segment
+  * @return The real part (the imaginary part directly follows at an offset of AlignedSize<Sample>(AudioFFT::ComplexSize(2 * blockSize)))
+  */
+  const Sample* segmentRe(size_t index) const;
+
+  /**
+  * @brief Returns the imaginary part of the spectrum of a segment
+  * @param index The index of the segment
+  * @return The imaginary part
+  */
+  const Sample* segmentIm(size_t index) const;
+
+  /**
+  * @brief Returns the energy of a segment
+  * @param index The index of the segment
+  * @return The sum of the squares of the samples of the segment (including the static gain)
+  */
+  double getSegmentEnergy(size_t index) const;
+
+  /**
+  * @brief Returns the energy of the whole impulse response
+  * @return The sum of the energies of all segments
+  */
+  double getEnergy() const;
+
+private:
+  PartitionedIR(size_t blockSize, size_t irLen);
+  void prepareSegments(const Sample* ir, size_t irLen, Sample scale, size_t begin, size_t end);
+
+  size_t _blockSize;
+  size_t _segSize;
+  size_t _segCount;
+  size_t _segStride;
+
+  // All spectra back to back in one aligned buffer, each of them occupies
+  // 2 * _segStride samples (real part followed by imaginary part)
+  SampleBuffer _segments;
+  std::vector<double> _segmentEnergies;
+
+  // Prevent uncontrolled usage
+  PartitionedIR(const PartitionedIR&);
+  PartitionedIR& operator=(const PartitionedIR&);
+};
+
+
 /**
 * @class FFTConvolver
 * @brief Implementation of a partitioned FFT convolution algorithm with uniform block size
@@ -45,10 +165,51 @@ namespace fftconvolver
 *   "unpredictable" operations like allocations, locking, API calls, etc. are
 *   performed during processing (all necessary allocations and preparations take
 *   place during initialization).
+*
+* - The impulse response may be given as PartitionedIR, which is shared
+*   with other convolvers instead of being copied.
+*
+* - Optionally, the convolver can be initialized for buffered processing: The
+*   input is collected until a block is complete, and the output is delayed by
+*   one block (see getLatency()). Without buffering, each processing call which
+*   doesn't end at a block boundary requires an additional forward and backward
+*   FFT, so buffering roughly halves the FFT costs for processing calls whose
+*   length isn't a multiple of the block size (e.g. 441 or 960 samples).
+*
+* - The convolver can be initialized with several impulse responses, each of them
+*   producing an output of its own (e.g. the left and right output of a true stereo
+*   reverb fed by the same input channel). The input is transformed only once per
+*   block for all outputs and stored in one shared frequency-domain delay line,
+*   only the complex multiplications and the backward FFTs are done per output.
+*
+* - More generally, the convolver can be initialized with a matrix of impulse responses
+*   from several inputs to several outputs (e.g. true stereo: 2 inputs x 2 outputs).
+*   Each input has a frequency-domain delay line of its own, and the products of all
+*   inputs feeding an output are accumulated in the frequency domain, so there's only
+*   one backward FFT per output (instead of one per impulse response).
+*
+* - Segments of the impulse responses whose energy is below a threshold (relative
+*   to the energy of the impulse response, see DefaultSegmentThreshold) are left
+*   out of the complex multiplications, so silent or nearly silent regions like a
+*   pre-delay or a gated tail don't cost anything.
+*
+* - Silent input costs (almost) nothing: Silent blocks of an input (all samples below
+*   -120 dB, see IsSilent()) are neither transformed nor multiplied, and an output fed
+*   by silent inputs only just lets the end of its previous block ring out. So once the
+*   tail of all impulse responses has rung out, the convolver is idle until some input
+*   arrives again.
 */
 class FFTConvolver
 {  
 public:
+  /**
+  * @brief Default energy threshold of the segments of the impulse responses
+  *
+  * Segments with less energy relative to the energy of their impulse response
+  * (1e-12 => -120 dB) are skipped.
+  */
+  static const double DefaultSegmentThreshold;
+
   FFTConvolver();  
   virtual ~FFTConvolver();
   
@@ -61,6 +222,80 @@ public:
   */
   bool init(size_t blockSize, const Sample* ir, size_t irLen);
 
+  /**
+  * @brief Initializes the convolver with a static gain applied to the output
+  * @param blockSize Block size internally used by the convolver (partition size)
+  * @param ir The impulse response
+  * @param irLen Length of the impulse response
+  * @param gain Gain of the convolution result (folded into the impulse response spectra)
+  * @return true: Success - false: Failed
+  */
+  bool init(size_t blockSize, const Sample* ir, size_t irLen, Sample gain);
+
+  /**
+  * @brief Initializes the convolver with an already partitioned impulse response
+  * @param ir The partitioned impulse response (the block size of the convolver is its block size)
+  * @return true: Success - false: Failed
+  */
+  bool init(const std::shared_ptr<const PartitionedIR>& ir);
+
+  /**
+  * @brief Initializes the convolver with an already partitioned impulse response
+  * @param ir The partitioned impulse response (the block size of the convolver is its block size)
+  * @param buffered true: Buffered processing with a latency of one block - false: No latency
+  * @return true: Success - false: Failed
+  */
+  bool init(const std::shared_ptr<const PartitionedIR>& ir, bool buffered);
+
+  /**
+  * @brief Initializes the convolver with several partitioned impulse responses sharing the input
+  * @param irs The partitioned impulse responses of the outputs (all of them with the same block size, nullptr: silent output)
+  * @param buffered true: Buffered processing with a latency of one block - false: No latency
+  * @return true: Success - false: Failed
+  */
+  bool init(const std::vector<std::shared_ptr<const PartitionedIR> >& irs, bool buffered);
+
+  /**
+  * @brief Initializes the convolver with a matrix of partitioned impulse responses from several inputs to several outputs
+  * @param irs The partitioned impulse responses, irs[input * outputCount + output] (all of them with the same block size, nullptr: no connection)
+  * @param inputCount The number of inputs (the number of outputs is irs.size() / inputCount)
+  * @param buffered true: Buffered processing with a latency of one block - false: No latency
+  * @return true: Success - false: Failed
+  */
+  bool init(const std::vector<std::shared_ptr<const PartitionedIR> >& irs, size_t inputCount, bool buffered);
+
+  /**
+  * @brief Initializes the convolver with a matrix of partitioned impulse responses and explicit energy floors for their segments
+  *
+  * Useful if the partitioned impulse responses are parts of longer impulse responses,
+  * so the threshold can refer to the energy of the whole impulse responses.
+  *
+  * @param irs The partitioned impulse responses, irs[input * outputCount + output] (all of them with the same block size, nullptr: no connection)
+  * @param inputCount The number of inputs (the number of outputs is irs.size() / inputCount)
+  * @param buffered true: Buffered processing with a latency of one block - false: No latency
+  * @param segmentEnergyFloors Segments of irs[n] with an energy not above segmentEnergyFloors[n] are skipped (0: only silent segments)
+  * @return true: Success - false: Failed
+  */
+  bool init(const std::vector<std::shared_ptr<const PartitionedIR> >& irs, size_t inputCount, bool buffered, const std::vector<double>& segmentEnergyFloors);
+
+  /**
+  * @brief Returns the number of inputs
+  * @return The number of inputs
+  */
+  size_t getInputCount() const;
+
+  /**
+  * @brief Returns the number of outputs
+  * @return The number of outputs
+  */
+  size_t getOutputCount() const;
+
+  /**
+  * @brief Returns the latency of the output
+  * @return The latency in samples (the block size for buffered processing, otherwise 0)
+  */
+  size_t getLatency() const;
+
   /**
   * @brief Convolves the the given input samples and immediately outputs the result
   * @param input The input samples
@@ -69,26 +304,88 @@ public:
   */
   void process(const Sample* input, Sample* output, size_t len);
 
+  /**
+  * @brief Convolves the the given input samples with all impulse responses and immediately outputs the results
+  * @param input The input samples
+  * @param outputs The convolution results, one array per output (see getOutputCount())
+  * @param len Number of input/output samples
+  */
+  void process(const Sample* input, Sample* const* outputs, size_t len);
+
+  /**
+  * @brief Convolves the the given samples of all inputs and immediately outputs the results (the sums over all inputs)
+  * @param inputs The input samples, one array per input (see getInputCount())
+  * @param outputs The convolution results, one array per output (see getOutputCount())
+  * @param len Number of input/output samples
+  */
+  void process(const Sample* const* inputs, Sample* const* outputs, size_t len);
+
+  /**
+  * @brief Returns whether the convolver is idle, i.e. whether silent input would only produce silent output
+  *
+  * Processing silent input doesn't change anything but the positions in the delay lines
+  * then, so the caller may skip it (taking silence as output instead).
+  *
+  * @return true: Idle - false: Some output is still ringing out (or the convolver is buffered)
+  */
+  bool isIdle() const;
+
   /**
   * @brief Resets the convolver and discards the set impulse response
   */
   void reset();
   
 private:
+  const PartitionedIR* getIR(size_t input, size_t output) const;
+  Sample* segmentRe(size_t input, size_t index);
+  Sample* segmentIm(size_t input, size_t index);
+  Sample* preMultipliedRe(size_t output);
+  Sample* preMultipliedIm(size_t output);
+  void preMultiply(size_t output);
+  void multiplyAccumulateSegments(Sample* re, Sample* im, size_t input, size_t output, size_t irIndex, size_t index, size_t count);
+  void convolve(size_t output);
+  void setSegmentSilent(size_t input, size_t index, bool silent);
+  bool isIdle(size_t output) const;
+  void ringOut(size_t output, Sample* data, size_t pos, size_t len, bool blockComplete);
+  void processBuffered(const Sample* const* inputs, Sample* const* outputs, size_t len);
+
   size_t _blockSize;
   size_t _segSize;
   size_t _segCount;
   size_t _fftComplexSize;
-  std::vector<SplitComplex*> _segments;
-  std::vector<SplitComplex*> _segmentsIR;
+  size_t _segStride;
+  size_t _inputCount;
+  size_t _outputCount;
+
+  // Frequency-domain delay lines: All input spectra stored back to back in one
+  // aligned region, using the same layout as the spectra of the (shared)
+  // impulse response. Each spectrum occupies 2 * _segStride samples (real
+  // part followed by imaginary part), the delay lines of the inputs follow
+  // each other. Like all other buffers, it's part of the arena. The input
+  // buffers of all inputs and the pre-multiplied spectra, overlaps and output
+  // buffers of all outputs are stored back to back as well.
+  std::vector<std::shared_ptr<const PartitionedIR> > _irs;
+  Arena _arena;
+  SampleBuffer _segmentsArena;
   SampleBuffer _fftBuffer;
   audiofft::AudioFFT _fft;
-  SplitComplex _preMultiplied;
+  SampleBuffer _preMultiplied;
   SplitComplex _conv;
   SampleBuffer _overlap;
   size_t _current;
   SampleBuffer _inputBuffer;
   size_t _inputBufferFill;
+  bool _buffered;
+  SampleBuffer _outputBuffer;
+
+  // Silence tracking: Silent segments of the delay lines aren't transformed (so
+  // they don't hold valid spectra) and are left out of the multiplications, as
+  // well as the segments of the impulse responses below their energy floor
+  std::vector<bool> _silentIRSegments;
+  std::vector<bool> _silentSegments;
+  std::vector<size_t> _activeSegmentCounts;
+  std::vector<bool> _idleOutputs;
+  std::vector<bool> _silentOverlaps;
 
   // Prevent uncontrolled usage
   FFTConvolver(const FFTConvolver&);
@@ -0,0 +1,766 @@
+// ==================================================================================
+// Copyright (c) 2012 HiFi-LoFi
+//
+// This is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+// ==================================================================================
+
+#include "MultiStageFFTConvolver.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+
+namespace fftconvolver
+{
+
+// Relative CPU costs of one forward plus one backward FFT (per N*log2(N)) and of
+// one complex multiply-accumulate of a single frequency bin, measured roughly
+// with the SIMD kernels in Utilities.cpp
+static const double FFTCostFactor = 3.0;
+static const double MACCostFactor = 1.0;
+
+// Work of the head convolver is done in the processing call itself (i.e. usually
+// in the audio thread), so it's weighted higher than the work of the stages which
+// can be moved into the background
+static const double HeadCostWeight = 2.0;
+
+
+static double ConvolutionCost(size_t blockSize, size_t irLen)
+{
+  // Estimated costs per output sample of a uniformly partitioned convolver
+  const double fftSize = static_cast<double>(2 * blockSize);
+  const double fftCosts = FFTCostFactor * fftSize * ::log(fftSize) / ::log(2.0);
+  const double partitions = static_cast<double>((irLen + blockSize - 1) / blockSize);
+  const double macCosts = MACCostFactor * partitions * static_cast<double>(blockSize + 1);
+  return (fftCosts + macCosts) / static_cast<double>(blockSize);
+}
+
+
+static size_t TrimmedLength(const Sample* ir, size_t irLen)
+{
+  // Zeros at the end of an impulse response only waste computation time
+  while (irLen > 0 && ::fabs(ir[irLen-1]) < 0.000001f)
+  {
+    --irLen;
+  }
+  return irLen;
+}
+
+
+MultiStageFFTConvolver::MultiStageFFTConvolver() :
+  _headBlockSize(0),
+  _headConvolver(),
+  _headMode(HeadFFT),
+  _directHeadIR(),
+  _directHeadTaps(),
+  _directHeadInput(),
+  _directHeadSilence(),
+  _headPrecalculated(),
+  _headPrecalculatedOutputs(),
+  _headInputs(),
+  _stages(),
+  _stageInput(),
+  _stageInputSize(0),
+  _stageInputFill(0),
+  _ringOutLength(0),
+  _silentInputLength(0),
+  _inputCount(0),
+  _outputCount(0),
+  _inputChannelCount(0),
+  _outputChannelCount(0),
+  _inputChannels(),
+  _outputChannels(),
+  _processInputs(),
+  _processOutputs(),
+  _arena(),
+  _segmentThreshold(FFTConvolver::DefaultSegmentThreshold),
+  _gain(1.0f)
+{
+}
+
+
+MultiStageFFTConvolver::~MultiStageFFTConvolver()
+{
+  reset();
+}
+
+
+void MultiStageFFTConvolver::reset()
+{
+  _headBlockSize = 0;
+  _headConvolver.reset();
+  _headMode = HeadFFT;
+  _directHeadIR.clear();
+  _directHeadTaps.clear();
+  _directHeadInput.clear();
+  _directHeadSilence.clear();
+  _headPrecalculated.clear();
+  _headPrecalculatedOutputs.clear();
+  _headInputs.clear();
+  for (size_t i=0; i<_stages.size(); ++i)
+  {
+    delete _stages[i];
+  }
+  _stages.clear();
+  _stageInput.clear();
+  _stageInputSize = 0;
+  _stageInputFill = 0;
+  _ringOutLength = 0;
+  _silentInputLength = 0;
+  _inputCount = 0;
+  _outputCount = 0;
+  _inputChannelCount = 0;
+  _outputChannelCount = 0;
+  _inputChannels.clear();
+  _outputChannels.clear();
+  _processInputs.clear();
+  _processOutputs.clear();
+  _arena.clear();
+}
+
+
+void MultiStageFFTConvolver::setSegmentThreshold(double threshold)
+{
+  _segmentThreshold = threshold;
+}
+
+
+void MultiStageFFTConvolver::setGain(Sample gain)
+{
+  _gain = gain;
+}
+
+
+size_t MultiStageFFTConvolver::getLatency() const
+{
+  // Not the latency of the head convolver, which might be uninitialized because
+  // its part of the impulse response is silent (but the stages are delayed anyway)
+  return (_headMode == HeadBuffered) ? _headBlockSize : 0;
+}
+
+
+size_t MultiStageFFTConvolver::getStageCount() const
+{
+  return _stages.size();
+}
+
+
+size_t MultiStageFFTConvolver::getStageBlockSize(size_t stage) const
+{
+  assert(stage < _stages.size());
+  return _stages[stage]->blockSize;
+}
+
+
+std::vector<size_t> MultiStageFFTConvolver::CalculateSchedule(size_t headBlockSize, size_t maxBlockSize, size_t irLen)
+{
+  const size_t head = NextPowerOf2(std::max(size_t(1), headBlockSize));
+
+  std::vector<size_t> sizes;
+  for (size_t blockSize=head; blockSize<=maxBlockSize; blockSize*=2)
+  {
+    sizes.push_back(blockSize);
+  }
+  const size_t sizeCount = sizes.size();
+
+  // best[i]: Lowest costs for processing the impulse response from offset 2*sizes[i]
+  // on by a chain of stages starting with block size sizes[i], next[i] is the index
+  // of the block size of the following stage (sizeCount if there is none)
+  const double infinite = std::numeric_limits<double>::max();
+  std::vector<double> best(sizeCount, infinite);
+  std::vector<size_t> next(sizeCount, sizeCount);
+  for (size_t i=sizeCount; i-- > 0; )
+  {
+    const size_t begin = 2 * sizes[i];
+    if (begin >= irLen)
+    {
+      continue;
+    }
+    best[i] = ConvolutionCost(sizes[i], irLen - begin);
+    for (size_t j=i+1; j<sizeCount; ++j)
+    {
+      if (best[j] < infinite)
+      {
+        const double costs = ConvolutionCost(sizes[i], 2 * sizes[j] - begin) + best[j];
+        if (costs < best[i])
+        {
+          best[i] = costs;
+          next[i] = j;
+        }
+      }
+    }
+  }
+
+  // The head convolver processes the impulse response up to the begin of the first stage
+  double bestCosts = HeadCostWeight * ConvolutionCost(head, irLen);
+  size_t first = sizeCount;
+  for (size_t i=0; i<sizeCount; ++i)
+  {
+    if (best[i] < infinite)
+    {
+      const double costs = HeadCostWeight * ConvolutionCost(head, 2 * sizes[i]) + best[i];
+      if (costs < bestCosts)
+      {
+        bestCosts = costs;
+        first = i;
+      }
+    }
+  }
+
+  std::vector<size_t> schedule(1, head);
+  for (size_t i=first; i<sizeCount; i=next[i])
+  {
+    schedule.push_back(sizes[i]);
+  }
+  return schedule;
+}
+
+
+size_t MultiStageFFTConvolver::CalculateLatency(size_t headBlockSize, size_t maxLatency)
+{
+  size_t latency = 1;
+  while (2 * latency <= maxLatency)
+  {
+    latency *= 2;
+  }
+  return (maxLatency > 0 && latency >= NextPowerOf2(headBlockSize)) ? latency : 0;
+}
+
+
+bool MultiStageFFTConvolver::init(size_t headBlockSize,
+                                  size_t maxBlockSize,
+                                  const Sample* ir,
+                                  size_t irLen)
+{
+  return init(headBlockSize, maxBlockSize, ir, irLen, 0);
+}
+
+
+bool MultiStageFFTConvolver::init(size_t headBlockSize,
+                                  size_t maxBlockSize,
+                                  const Sample* ir,
+                                  size_t irLen,
+                                  size_t maxLatency)
+{
+  return init(headBlockSize, maxBlockSize, std::vector<const Sample*>(1, ir), std::vector<size_t>(1, irLen), maxLatency);
+}
+
+
+bool MultiStageFFTConvolver::init(size_t headBlockSize,
+                                  size_t maxBlockSize,
+                                  const std::vector<const Sample*>& irs,
+                                  const std::vector<size_t>& irLens,
+                                  size_t maxLatency)
+{
+  return init(headBlockSize, maxBlockSize, 1, irs, irLens, maxLatency);
+}
+
+
+bool MultiStageFFTConvolver::init(size_t headBlockSize,
+                                  size_t maxBlockSize,
+                                  size_t inputCount,
+                                  const std::vector<const Sample*>& irs,
+                                  const std::vector<size_t>& irLens,
+                                  size_t maxLatency)
+{
+  reset();
+
+  if (headBlockSize == 0 || maxBlockSize == 0 || irs.empty() || irs.size() != irLens.size() ||
+      inputCount == 0 || irs.size() % inputCount != 0)
+  {
+    return false;
+  }
+
+  // The stages are laid out for the longest impulse response (shorter ones just skip stages)
+  std::vector<size_t> lens(irs.size(), 0);
+  size_t irLen = 0;
+  for (size_t i=0; i<irs.size(); ++i)
+  {
+    lens[i] = TrimmedLength(irs[i], irLens[i]);
+    irLen = std::max(irLen, lens[i]);
+  }
+
+  // Only the inputs and outputs connected by any impulse response take part in the
+  // convolution, so unused channels of the matrix don't cost anything
+  _inputChannelCount = inputCount;
+  _outputChannelCount = irs.size() / inputCount;
+  for (size_t n=0; n<_inputChannelCount; ++n)
+  {
+    for (size_t o=0; o<_outputChannelCount; ++o)
+    {
+      if (lens[n * _outputChannelCount + o] > 0)
+      {
+        _inputChannels.push_back(n);
+        break;
+      }
+    }
+  }
+  for (size_t o=0; o<_outputChannelCount; ++o)
+  {
+    for (size_t n=0; n<_inputChannelCount; ++n)
+    {
+      if (lens[n * _outputChannelCount + o] > 0)
+      {
+        _outputChannels.push_back(o);
+        break;
+      }
+    }
+  }
+  _inputCount = _inputChannels.size();
+  _outputCount = _outputChannels.size();
+  _processInputs.resize(_inputCount, nullptr);
+  _processOutputs.resize(_outputCount, nullptr);
+
+  std::vector<const Sample*> connectedIRs;
+  std::vector<size_t> connectedLens;
+  for (size_t n=0; n<_inputCount; ++n)
+  {
+    for (size_t o=0; o<_outputCount; ++o)
+    {
+      const size_t index = _inputChannels[n] * _outputChannelCount + _outputChannels[o];
+      connectedIRs.push_back(irs[index]);
+      connectedLens.push_back(lens[index]);
+    }
+  }
+  const size_t irCount = connectedIRs.size();
+
+  // Parts of the impulse responses below this energy are skipped (the energies
+  // of the segments include the gain)
+  const double gainSquared = static_cast<double>(_gain) * static_cast<double>(_gain);
+  std::vector<double> energyFloors(irCount, 0.0);
+  for (size_t n=0; n<irCount; ++n)
+  {
+    for (size_t i=0; i<connectedLens[n]; ++i)
+    {
+      energyFloors[n] += static_cast<double>(connectedIRs[n][i]) * static_cast<double>(connectedIRs[n][i]);
+    }
+    energyFloors[n] *= _segmentThreshold * gainSquared;
+  }
+
+  if (irLen == 0)
+  {
+    return true;
+  }
+
+  // A buffered head replaces the head block size by the latency, and for tiny
+  // head blocks the time-domain head replaces it by its length
+  const size_t latency = CalculateLatency(headBlockSize, maxLatency);
+  if (latency > 0)
+  {
+    _headMode = HeadBuffered;
+    headBlockSize = latency;
+  }
+  else if (NextPowerOf2(headBlockSize) <= DirectHeadMaxBlockSize)
+  {
+    _headMode = HeadDirect;
+    headBlockSize = DirectHeadLength;
+  }
+  else
+  {
+    _headMode = HeadFFT;
+  }
+  const std::vector<size_t> schedule = CalculateSchedule(headBlockSize, maxBlockSize, irLen);
+  _headBlockSize = schedule[0];
+
+  // With a buffered head, the output is delayed by one head block (the latency),
+  // so each stage may begin earlier in the impulse response by the latency.
+  // Stages beginning behind the end of the impulse response aren't needed at all.
+  std::vector<size_t> blockSizes;
+  for (size_t i=1; i<schedule.size() && 2*schedule[i]-latency < irLen; ++i)
+  {
+    blockSizes.push_back(schedule[i]);
+  }
+
+  const size_t headIrLen = std::min(irLen, blockSizes.empty() ? irLen : 2*blockSizes[0]-latency);
+  const size_t taps = (_headMode == HeadDirect) ? std::min(_headBlockSize, headIrLen) : 0;
+  _stageInputSize = !blockSizes.empty() ? blockSizes.back() : ((_headMode == HeadDirect) ? _headBlockSize : 0);
+
+  // After this much silent input, all outputs and all buffers are silent (the impulse
+  // response has rung out, and so have all blocks on their way through the stages)
+  _ringOutLength = irLen + latency + _headBlockSize + 3 * _stageInputSize;
+
+  // All buffers of the stages (and of the direct head) live in one block of memory,
+  // the buffers of the inputs and of the outputs are placed back to back
+  size_t arenaSize = Arena::Bytes<Sample>(_inputCount * _stageInputSize);
+  if (_headMode == HeadDirect)
+  {
+    arenaSize += Arena::Bytes<Sample>(irCount * taps)
+               + Arena::Bytes<Sample>(_inputCount * (taps - 1 + _headBlockSize))
+               + Arena::Bytes<Sample>(_outputCount * _headBlockSize);
+  }
+  for (size_t i=0; i<blockSizes.size(); ++i)
+  {
+    arenaSize += 2 * Arena::Bytes<Sample>(_outputCount * blockSizes[i]) + Arena::Bytes<Sample>(_inputCount * blockSizes[i]);
+  }
+  _arena.allocate(arenaSize);
+
+  std::vector<std::shared_ptr<const PartitionedIR> > headIRs(irCount);
+  if (_headMode == HeadDirect)
+  {
+    // First head block: Time-domain FIR filter with reversed taps, so each output
+    // sample is the dot product of the taps and the most recent input samples
+    _directHeadIR.attach(_arena, irCount * taps);
+    for (size_t n=0; n<irCount; ++n)
+    {
+      for (size_t i=0; i<taps; ++i)
+      {
+        _directHeadIR[n * taps + i] = (taps-1-i < connectedLens[n]) ? _gain * connectedIRs[n][taps-1-i] : 0.0f;
+      }
+
+      // The leading taps of the impulse response are the last ones of the dot
+      // products, so the taps below the energy floor (e.g. a pre-delay) are left out
+      size_t leadingTaps = 0;
+      double leadingEnergy = 0.0;
+      while (leadingTaps < taps)
+      {
+        const double tap = static_cast<double>(_directHeadIR[n * taps + (taps-1-leadingTaps)]);
+        if (leadingEnergy + tap * tap > energyFloors[n])
+        {
+          break;
+        }
+        leadingEnergy += tap * tap;
+        ++leadingTaps;
+      }
+      _directHeadTaps.push_back(taps - leadingTaps);
+    }
+    _directHeadInput.attach(_arena, _inputCount * (taps - 1 + _headBlockSize));
+    _directHeadSilence.assign(_inputCount, taps - 1 + _headBlockSize);
+    _headPrecalculated.attach(_arena, _outputCount * _headBlockSize);
+    for (size_t o=0; o<_outputCount; ++o)
+    {
+      _headPrecalculatedOutputs.push_back(_headPrecalculated.data() + o * _headBlockSize);
+    }
+    _headInputs.resize(_inputCount, nullptr);
+
+    // Rest of the head: It begins one head block behind the begin of the impulse
+    // response, so it has one block period of time for computing its result
+    if (headIrLen > _headBlockSize)
+    {
+      for (size_t n=0; n<irCount; ++n)
+      {
+        const size_t end = std::min(connectedLens[n], headIrLen);
+        if (end > _headBlockSize)
+        {
+          headIRs[n] = createPartitionedIR(_headBlockSize, connectedIRs[n]+_headBlockSize, end-_headBlockSize, _gain);
+        }
+      }
+      _headConvolver.init(headIRs, _inputCount, false, energyFloors);
+    }
+  }
+  else
+  {
+    for (size_t n=0; n<irCount; ++n)
+    {
+      const size_t end = std::min(connectedLens[n], headIrLen);
+      if (end > 0)
+      {
+        headIRs[n] = createPartitionedIR(_headBlockSize, connectedIRs[n], end, _gain);
+      }
+    }
+    _headConvolver.init(headIRs, _inputCount, _headMode == HeadBuffered, energyFloors);
+  }
+
+  for (size_t i=0; i<blockSizes.size(); ++i)
+  {
+    const size_t blockSize = blockSizes[i];
+    const size_t irBegin = 2 * blockSize - latency;
+    const size_t irEnd = (i+1 < blockSizes.size()) ? 2 * blockSizes[i+1] - latency : irLen;
+
+    std::vector<std::shared_ptr<const PartitionedIR> > stageIRs(irCount);
+    for (size_t n=0; n<irCount; ++n)
+    {
+      const size_t end = std::min(connectedLens[n], irEnd);
+      if (end > irBegin)
+      {
+        stageIRs[n] = createPartitionedIR(blockSize, connectedIRs[n]+irBegin, end-irBegin, _gain);
+      }
+    }
+
+    Stage* stage = new Stage();
+    stage->blockSize = blockSize;
+    stage->convolver.init(stageIRs, _inputCount, false, energyFloors);
+    stage->output.attach(_arena, _outputCount * blockSize);
+    stage->precalculated.attach(_arena, _outputCount * blockSize);
+    stage->backgroundProcessingInput.attach(_arena, _inputCount * blockSize);
+    for (size_t n=0; n<_inputCount; ++n)
+    {
+      stage->inputs.push_back(stage->backgroundProcessingInput.data() + n * blockSize);
+    }
+    stage->outputs.resize(_outputCount, nullptr);
+    _stages.push_back(stage);
+  }
+
+  _stageInput.attach(_arena, _inputCount * _stageInputSize);
+  _stageInputFill = 0;
+
+  return true;
+}
+
+
+size_t MultiStageFFTConvolver::getInputCount() const
+{
+  return _inputChannelCount;
+}
+
+
+size_t MultiStageFFTConvolver::getOutputCount() const
+{
+  return _outputChannelCount;
+}
+
+
+void MultiStageFFTConvolver::process(const Sample* input, Sample* output, size_t len)
+{
+  if (_headBlockSize == 0)
+  {
+    ::memset(output, 0, len * sizeof(Sample));
+    return;
+  }
+
+  assert(_inputChannelCount == 1 && _outputChannelCount == 1);
+  process(&input, &output, len);
+}
+
+
+void MultiStageFFTConvolver::process(const Sample* input, Sample* const* outputs, size_t len)
+{
+  assert(_inputChannelCount <= 1);
+  process(&input, outputs, len);
+}
+
+
+void MultiStageFFTConvolver::process(const Sample* const* inputs, Sample* const* outputs, size_t len)
+{
+  if (_headBlockSize == 0)
+  {
+    for (size_t o=0; o<_outputChannelCount; ++o)
+    {
+      ::memset(outputs[o], 0, len * sizeof(Sample));
+    }
+    return;
+  }
+
+  // From here on, only the connected inputs and outputs are processed
+  for (size_t n=0; n<_inputCount; ++n)
+  {
+    _processInputs[n] = inputs[_inputChannels[n]];
+  }
+  size_t connected = 0;
+  for (size_t o=0; o<_outputChannelCount; ++o)
+  {
+    if (connected < _outputCount && _outputChannels[connected] == o)
+    {
+      _processOutputs[connected++] = outputs[o];
+    }
+    else
+    {
+      ::memset(outputs[o], 0, len * sizeof(Sample));
+    }
+  }
+  inputs = _processInputs.data();
+  outputs = _processOutputs.data();
+
+  // Everything has rung out and the input is still silent => Nothing to do at all.
+  // All buffers are silent (below -120 dB, see IsSilent()), so pausing is just a shift
+  // in time, which doesn't change the output of the convolver once the input is back.
+  bool silentInput = true;
+  for (size_t n=0; n<_inputCount && silentInput; ++n)
+  {
+    silentInput = IsSilent(inputs[n], len);
+  }
+  if (silentInput && _silentInputLength >= _ringOutLength)
+  {
+    for (size_t o=0; o<_outputCount; ++o)
+    {
+      ::memset(outputs[o], 0, len * sizeof(Sample));
+    }
+    return;
+  }
+  _silentInputLength = silentInput ? std::min(_silentInputLength + len, _ringOutLength) : 0;
+
+  // Head
+  if (_headMode != HeadDirect)
+  {
+    _headConvolver.process(inputs, outputs, len);
+    if (_stages.empty())
+    {
+      return;
+    }
+  }
+
+  // All block sizes are powers of 2, so each block boundary of a stage
+  // is also a block boundary of all the stages with smaller block sizes
+  const size_t stepSize = (_headMode == HeadDirect) ? _headBlockSize : _stages[0]->blockSize;
+  const size_t stageCount = _stages.size();
+  size_t processed = 0;
+  while (processed < len)
+  {
+    const size_t remaining = len - processed;
+    const size_t processing = std::min(remaining, stepSize - (_stageInputFill % stepSize));
+    assert(_stageInputFill + processing <= _stageInputSize);
+
+    if (_headMode == HeadDirect)
+    {
+      processDirectHead(inputs, outputs, processed, processing);
+    }
+
+    // Sum head and stages
+    for (size_t s=0; s<stageCount; ++s)
+    {
+      const Stage& stage = *_stages[s];
+      for (size_t o=0; o<_outputCount; ++o)
+      {
+        const Sample* precalculated = stage.precalculated.data() + o * stage.blockSize + (_stageInputFill % stage.blockSize);
+        Sample* out = outputs[o] + processed;
+        for (size_t i=0; i<processing; ++i)
+        {
+          out[i] += precalculated[i];
+        }
+      }
+    }
+
+    // Fill input buffers for the stages
+    for (size_t n=0; n<_inputCount; ++n)
+    {
+      ::memcpy(_stageInput.data()+n*_stageInputSize+_stageInputFill, inputs[n]+processed, processing * sizeof(Sample));
+    }
+    _stageInputFill += processing;
+    assert(_stageInputFill <= _stageInputSize);
+
+    // Rest of the direct head: Synchronously at each head block boundary
+    if (_headMode == HeadDirect && _stageInputFill % _headBlockSize == 0)
+    {
+      for (size_t n=0; n<_inputCount; ++n)
+      {
+        _headInputs[n] = _stageInput.data() + n * _stageInputSize + (_stageInputFill - _headBlockSize);
+      }
+      _headConvolver.process(_headInputs.data(), _headPrecalculatedOutputs.data(), _headBlockSize);
+    }
+
+    // Convolution: Each stage with a complete input block (might be done in some background thread)
+    for (size_t s=0; s<stageCount; ++s)
+    {
+      Stage& stage = *_stages[s];
+      if (_stageInputFill % stage.blockSize == 0)
+      {
+        waitForBackgroundProcessing(s);
+        SampleBuffer::Swap(stage.precalculated, stage.output);
+        bool silentBlock = true;
+        for (size_t n=0; n<_inputCount; ++n)
+        {
+          Sample* stageInput = stage.backgroundProcessingInput.data() + n * stage.blockSize;
+          ::memcpy(stageInput,
+                   _stageInput.data() + n * _stageInputSize + (_stageInputFill - stage.blockSize),
+                   stage.blockSize * sizeof(Sample));
+          silentBlock = silentBlock && IsSilent(stageInput, stage.blockSize);
+        }
+
+        // Silent block for an idle stage => Its output is silent, so there's no
+        // need to bother the background processing at all
+        if (silentBlock && stage.convolver.isIdle())
+        {
+          ::memset(stage.output.data(), 0, _outputCount * stage.blockSize * sizeof(Sample));
+        }
+        else
+        {
+          startBackgroundProcessing(s);
+        }
+      }
+    }
+
+    if (_stageInputFill == _stageInputSize)
+    {
+      _stageInputFill = 0;
+    }
+
+    processed += processing;
+  }
+}
+
+
+void MultiStageFFTConvolver::processDirectHead(const Sample* const* inputs, Sample* const* outputs, size_t offset, size_t len)
+{
+  assert(len <= _headBlockSize);
+  const size_t taps = _directHeadIR.size() / (_inputCount * _outputCount);
+  const size_t historyLen = taps - 1;
+  const size_t historySize = _directHeadInput.size() / _inputCount;
+  for (size_t n=0; n<_inputCount; ++n)
+  {
+    ::memcpy(_directHeadInput.data()+n*historySize+historyLen, inputs[n]+offset, len * sizeof(Sample));
+
+    // Number of silent samples at the end of the input history
+    _directHeadSilence[n] = IsSilent(inputs[n]+offset, len) ? std::min(_directHeadSilence[n] + len, historySize) : 0;
+  }
+
+  // The input histories are shared by all outputs
+  for (size_t o=0; o<_outputCount; ++o)
+  {
+    const Sample* precalculated = _headPrecalculatedOutputs[o] + (_stageInputFill % _headBlockSize);
+    Sample* output = outputs[o] + offset;
+    ::memcpy(output, precalculated, len * sizeof(Sample));
+    for (size_t n=0; n<_inputCount; ++n)
+    {
+      const size_t directHeadTaps = _directHeadTaps[n * _outputCount + o];
+      if (directHeadTaps == 0 || _directHeadSilence[n] >= historyLen + len)
+      {
+        continue; // All samples reached by the taps are silent
+      }
+      const Sample* directHeadIR = _directHeadIR.data() + (n * _outputCount + o) * taps;
+      const Sample* directHeadInput = _directHeadInput.data() + n * historySize;
+      for (size_t i=0; i<len; ++i)
+      {
+        output[i] += DotProduct(directHeadIR, directHeadInput+i, directHeadTaps);
+      }
+    }
+  }
+
+  // Keep the most recent input samples for the next call
+  for (size_t n=0; n<_inputCount; ++n)
+  {
+    Sample* directHeadInput = _directHeadInput.data() + n * historySize;
+    ::memmove(directHeadInput, directHeadInput+len, historyLen * sizeof(Sample));
+  }
+}
+
+
+std::shared_ptr<const PartitionedIR> MultiStageFFTConvolver::createPartitionedIR(size_t blockSize, const Sample* ir, size_t irLen, Sample gain)
+{
+  return PartitionedIR::Create(blockSize, ir, irLen, gain);
+}
+
+
+void MultiStageFFTConvolver::startBackgroundProcessing(size_t stage)
+{
+  doBackgroundProcessing(stage);
+}
+
+
+void MultiStageFFTConvolver::waitForBackgroundProcessing(size_t /*stage*/)
+{
+}
+
+
+void MultiStageFFTConvolver::doBackgroundProcessing(size_t stage)
+{
+  assert(stage < _stages.size());
+  Stage& s = *_stages[stage];
+  for (size_t o=0; o<s.outputs.size(); ++o)
+  {
+    s.outputs[o] = s.output.data() + o * s.blockSize;
+  }
+  s.convolver.process(s.inputs.data(), s.outputs.data(), s.blockSize);
+}
+
+} // End of namespace fftconvolver
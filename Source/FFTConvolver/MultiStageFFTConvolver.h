@@ -0,0 +1,353 @@
+// ==================================================================================
+// Copyright (c) 2012 HiFi-LoFi
+//
+// This is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+// ==================================================================================
+
+#ifndef _FFTCONVOLVER_MULTISTAGEFFTCONVOLVER_H
+#define _FFTCONVOLVER_MULTISTAGEFFTCONVOLVER_H
+
+#include "FFTConvolver.h"
+#include "Utilities.h"
+
+#include <memory>
+#include <vector>
+
+
+namespace fftconvolver
+{
+
+/**
+* @class MultiStageFFTConvolver
+* @brief FFT convolver using a non-uniform partitioning with an arbitrary number of block sizes
+*
+* The multi-stage convolver generalizes the 2-stage convolver: The impulse response
+* is split into segments which grow with their distance to the begin of the impulse
+* response (e.g. 64/256/1024/4096/16384), and each segment is processed by its own
+* uniformly partitioned convolver using a block size of its own:
+*
+* - The head convolver processes the begin of the impulse response directly in the
+*   processing call, using the head block size.
+*
+* - For tiny head block sizes (up to DirectHeadMaxBlockSize) the small FFTs of the head
+*   convolver in each processing call cost more than they save. In this case the first
+*   DirectHeadLength samples of the impulse response are convolved directly in the time
+*   domain (FIR filter), and the rest of the head is processed by a uniformly partitioned
+*   convolver with block size DirectHeadLength, which is executed only at each of its
+*   block boundaries (its part of the impulse response begins one block behind the begin,
+*   so it doesn't need to compute its result earlier).
+*
+* - If some latency is acceptable (e.g. compensated by the host), the head convolver
+*   can process buffered with a latency of one head block (see FFTConvolver). Then the
+*   head block size is the latency instead of the (much smaller) processing block size,
+*   and the head and all stages begin earlier in the impulse response by the latency.
+*
+* - Each following stage with block size B processes the impulse response from
+*   offset 2*B on, so it has one full block period of time to compute its result.
+*
+* The block sizes are chosen by a simple CPU cost model (see CalculateSchedule()), which
+* weighs the FFT costs of small blocks against the costs of the complex multiplications
+* of many partitions.
+*
+* Like the 2-stage convolver, this class provides virtual methods which allow to move the
+* processing of the stages into the background (see startBackgroundProcessing()/
+* waitForBackgroundProcessing()). Each stage may be processed independently of the others.
+*
+* The convolver can be initialized with several impulse responses, each of them producing
+* an output of its own. All of them share the input (and its forward FFTs in the head and
+* each stage, see FFTConvolver), the stages are laid out for the longest one. More generally,
+* it can be initialized with a matrix of impulse responses from several inputs to several
+* outputs, then the head and each stage sum up the inputs feeding an output in the frequency
+* domain, using one backward FFT per output. Inputs and outputs without any impulse
+* response are left out of the processing (unconnected outputs are just silent), so the
+* costs grow with the impulse response data rather than with the size of the matrix.
+*
+* Silent input is cheap as well: The head and the stages skip the silent blocks of each
+* input (see FFTConvolver), and the direct head skips inputs whose recent samples are
+* all silent, so the convolver is nearly idle once the impulse responses have rung out.
+*
+* The multi-stage convolver is suitable for real-time processing which means that no
+* "unpredictable" operations like allocations, locking, API calls, etc. are performed
+* during processing (all necessary allocations and preparations take place during
+* initialization).
+*/
+class MultiStageFFTConvolver
+{
+public:
+  MultiStageFFTConvolver();
+  virtual ~MultiStageFFTConvolver();
+
+  /**
+  * @brief Initializes the convolver using a partition schedule calculated by CalculateSchedule()
+  * @param headBlockSize The head block size (usually the block size of the processing calls)
+  * @param maxBlockSize The maximum block size of any stage
+  * @param ir The impulse response
+  * @param irLen Length of the impulse response in samples
+  * @return true: Success - false: Failed
+  */
+  bool init(size_t headBlockSize, size_t maxBlockSize, const Sample* ir, size_t irLen);
+
+  /**
+  * @brief Initializes the convolver using a partition schedule calculated by CalculateSchedule()
+  * @param headBlockSize The head block size (usually the block size of the processing calls)
+  * @param maxBlockSize The maximum block size of any stage
+  * @param ir The impulse response
+  * @param irLen Length of the impulse response in samples
+  * @param maxLatency The maximum latency the convolver may introduce (see CalculateLatency())
+  * @return true: Success - false: Failed
+  */
+  bool init(size_t headBlockSize, size_t maxBlockSize, const Sample* ir, size_t irLen, size_t maxLatency);
+
+  /**
+  * @brief Initializes the convolver with several impulse responses sharing the input, using a partition schedule calculated by CalculateSchedule()
+  * @param headBlockSize The head block size (usually the block size of the processing calls)
+  * @param maxBlockSize The maximum block size of any stage
+  * @param irs The impulse responses, one per output
+  * @param irLens Lengths of the impulse responses in samples (0: silent output)
+  * @param maxLatency The maximum latency the convolver may introduce (see CalculateLatency())
+  * @return true: Success - false: Failed
+  */
+  bool init(size_t headBlockSize, size_t maxBlockSize, const std::vector<const Sample*>& irs, const std::vector<size_t>& irLens, size_t maxLatency);
+
+  /**
+  * @brief Initializes the convolver with a matrix of impulse responses from several inputs to several outputs, using a partition schedule calculated by CalculateSchedule()
+  * @param headBlockSize The head block size (usually the block size of the processing calls)
+  * @param maxBlockSize The maximum block size of any stage
+  * @param inputCount The number of inputs (the number of outputs is irs.size() / inputCount)
+  * @param irs The impulse responses, irs[input * outputCount + output]
+  * @param irLens Lengths of the impulse responses in samples (0: no connection)
+  * @param maxLatency The maximum latency the convolver may introduce (see CalculateLatency())
+  * @return true: Success - false: Failed
+  */
+  bool init(size_t headBlockSize, size_t maxBlockSize, size_t inputCount, const std::vector<const Sample*>& irs, const std::vector<size_t>& irLens, size_t maxLatency);
+
+  /**
+  * @brief Sets the energy threshold of the segments of the impulse responses (applied by the next initialization)
+  *
+  * Segments of the head and the stages with less energy relative to the energy of the whole
+  * impulse response are skipped, and so are the leading taps of the direct head up to this
+  * energy, so e.g. a pre-delay doesn't cost anything.
+  *
+  * @param threshold The relative energy threshold (FFTConvolver::DefaultSegmentThreshold by default, 0: only silent segments)
+  */
+  void setSegmentThreshold(double threshold);
+
+  /**
+  * @brief Sets a static gain of the convolution result (applied by the next initialization)
+  *
+  * The gain is folded into the impulse responses, so it doesn't cost anything during
+  * the processing, and it changes together with the impulse responses.
+  *
+  * @param gain The gain (1 by default)
+  */
+  void setGain(Sample gain);
+
+  /**
+  * @brief Convolves the the given input samples and immediately outputs the result
+  * @param input The input samples
+  * @param output The convolution result
+  * @param len Number of input/output samples
+  */
+  void process(const Sample* input, Sample* output, size_t len);
+
+  /**
+  * @brief Convolves the the given input samples with all impulse responses and immediately outputs the results
+  * @param input The input samples
+  * @param outputs The convolution results, one array per output (see getOutputCount())
+  * @param len Number of input/output samples
+  */
+  void process(const Sample* input, Sample* const* outputs, size_t len);
+
+  /**
+  * @brief Convolves the the given samples of all inputs and immediately outputs the results (the sums over all inputs)
+  * @param inputs The input samples, one array per input (see getInputCount())
+  * @param outputs The convolution results, one array per output (see getOutputCount())
+  * @param len Number of input/output samples
+  */
+  void process(const Sample* const* inputs, Sample* const* outputs, size_t len);
+
+  /**
+  * @brief Resets the convolver and discards the set impulse response
+  */
+  void reset();
+
+  /**
+  * @brief Returns the latency of the output
+  * @return The latency in samples (0 unless the head is buffered)
+  */
+  size_t getLatency() const;
+
+  /**
+  * @brief Returns the number of inputs
+  * @return The number of inputs
+  */
+  size_t getInputCount() const;
+
+  /**
+  * @brief Returns the number of outputs
+  * @return The number of outputs
+  */
+  size_t getOutputCount() const;
+
+  /**
+  * @brief Returns the number of stages following the head convolver
+  * @return The number of stages
+  */
+  size_t getStageCount() const;
+
+  /**
+  * @brief Returns the block size of a stage
+  * @param stage The index of the stage (0 is the first stage following the head convolver)
+  * @return The block size of the stage
+  */
+  size_t getStageBlockSize(size_t stage) const;
+
+  /**
+  * @brief Calculates the partition schedule with the lowest estimated CPU costs
+  *
+  * All block sizes are powers of 2 between the head block size and the maximum
+  * block size, each stage uses a larger block size than its predecessor.
+  *
+  * @param headBlockSize The head block size
+  * @param maxBlockSize The maximum block size of any stage
+  * @param irLen Length of the impulse response in samples
+  * @return The block sizes of the head and the following stages
+  */
+  static std::vector<size_t> CalculateSchedule(size_t headBlockSize, size_t maxBlockSize, size_t irLen);
+
+  /**
+  * @brief Calculates the latency of a convolver initialized with the given head block size and maximum latency
+  *
+  * The latency is the largest power of 2 not above the maximum latency, unless this
+  * is less than the head block size (buffering doesn't pay off then, so the convolver
+  * works without latency).
+  *
+  * @param headBlockSize The head block size
+  * @param maxLatency The maximum latency
+  * @return The latency in samples
+  */
+  static size_t CalculateLatency(size_t headBlockSize, size_t maxLatency);
+
+  /**
+  * @brief Largest head block size for which the begin of the impulse response is convolved in the time domain
+  */
+  static const size_t DirectHeadMaxBlockSize = 64;
+
+  /**
+  * @brief Number of samples of the impulse response convolved in the time domain (if any)
+  */
+  static const size_t DirectHeadLength = 128;
+
+protected:
+  /**
+  * @brief Called during the initialization to partition the impulse response of the head or a stage
+  *
+  * The default implementation just calls PartitionedIR::Create(). Overload it if you
+  * want to share the partitioned impulse responses with other convolvers.
+  *
+  * @param blockSize The block size of the head or the stage
+  * @param ir The part of the impulse response processed by the head or the stage
+  * @param irLen Length of the part of the impulse response
+  * @param gain The static gain to apply to the impulse response
+  * @return The partitioned impulse response
+  */
+  virtual std::shared_ptr<const PartitionedIR> createPartitionedIR(size_t blockSize, const Sample* ir, size_t irLen, Sample gain);
+
+  /**
+  * @brief Method called by the convolver if work for background processing of a stage is available
+  *
+  * The default implementation just calls doBackgroundProcessing() to perform the
+  * convolution of the stage. However, if you want to perform the majority of work in
+  * some background thread (which is recommended), you can overload this method and trigger
+  * the execution of doBackgroundProcessing() really in some background thread.
+  *
+  * @param stage The index of the stage
+  */
+  virtual void startBackgroundProcessing(size_t stage);
+
+  /**
+  * @brief Called by the convolver if it expects the result of its previous call to startBackgroundProcessing() for a stage
+  *
+  * After returning from this method, the background processing of the stage has to be completed.
+  *
+  * @param stage The index of the stage
+  */
+  virtual void waitForBackgroundProcessing(size_t stage);
+
+  /**
+  * @brief Actually performs the background processing work of a stage
+  * @param stage The index of the stage
+  */
+  void doBackgroundProcessing(size_t stage);
+
+private:
+  // Processing modes of the head
+  enum HeadMode
+  {
+    HeadFFT,      // FFT convolver processing the head in each processing call (no latency)
+    HeadDirect,   // Time-domain FIR filter followed by an FFT convolver (no latency)
+    HeadBuffered  // Buffered FFT convolver (latency of one head block)
+  };
+
+  void processDirectHead(const Sample* const* inputs, Sample* const* outputs, size_t offset, size_t len);
+
+  // The input/output buffers hold the blocks of all inputs/outputs back to back
+  struct Stage
+  {
+    size_t blockSize;
+    FFTConvolver convolver;
+    SampleBuffer output;
+    SampleBuffer precalculated;
+    SampleBuffer backgroundProcessingInput;
+    std::vector<const Sample*> inputs;
+    std::vector<Sample*> outputs;
+  };
+
+  size_t _headBlockSize;
+  FFTConvolver _headConvolver;
+  HeadMode _headMode;
+  SampleBuffer _directHeadIR;
+  std::vector<size_t> _directHeadTaps;
+  SampleBuffer _directHeadInput;
+  std::vector<size_t> _directHeadSilence;
+  SampleBuffer _headPrecalculated;
+  std::vector<Sample*> _headPrecalculatedOutputs;
+  std::vector<const Sample*> _headInputs;
+  std::vector<Stage*> _stages;
+  SampleBuffer _stageInput;
+  size_t _stageInputSize;
+  size_t _stageInputFill;
+  size_t _ringOutLength;
+  size_t _silentInputLength; // Number of silent input samples so far (up to _ringOutLength)
+  // Counts of the connected inputs/outputs, which are the only ones processed
+  size_t _inputCount;
+  size_t _outputCount;
+  size_t _inputChannelCount;
+  size_t _outputChannelCount;
+  std::vector<size_t> _inputChannels;
+  std::vector<size_t> _outputChannels;
+  std::vector<const Sample*> _processInputs;
+  std::vector<Sample*> _processOutputs;
+  Arena _arena;
+  double _segmentThreshold;
+  Sample _gain;
+
+  // Prevent uncontrolled usage
+  MultiStageFFTConvolver(const MultiStageFFTConvolver&);
+  MultiStageFFTConvolver& operator=(const MultiStageFFTConvolver&);
+};
+
+} // End of namespace fftconvolver
+
+#endif // Header guard
@@ -0,0 +1,210 @@
+// ==================================================================================
+// Copyright (c) 2012 HiFi-LoFi
+//
+// This is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+// ==================================================================================
+
+#include "Resampler.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+namespace fftconvolver
+{
+
+// Half length of the filter in zero crossings of the sinc function
+static const size_t ZeroCrossings = 32;
+
+// Cutoff frequency of the filter relative to the lower of both Nyquist frequencies
+static const double Rolloff = 0.95;
+
+// Shape of the Kaiser window (about 90 dB stopband attenuation)
+static const double KaiserBeta = 9.0;
+
+// Maximum number of phases used for an exact ratio
+static const size_t MaxExactPhaseCount = 1024;
+
+// Number of phases between which the output samples are interpolated for other ratios
+static const size_t InterpolatedPhaseCount = 512;
+
+static const double Pi = 3.1415926535897932384626433832795;
+
+
+static double BesselI0(double x)
+{
+  double sum = 1.0;
+  double term = 1.0;
+  for (int k=1; k<64 && term > sum * 1e-12; ++k)
+  {
+    const double factor = x / (2.0 * static_cast<double>(k));
+    term *= factor * factor;
+    sum += term;
+  }
+  return sum;
+}
+
+
+static bool IsInteger(double x)
+{
+  return (x >= 1.0 && ::fabs(x - ::floor(x + 0.5)) < 0.000001);
+}
+
+
+static unsigned long long GreatestCommonDivisor(unsigned long long a, unsigned long long b)
+{
+  while (b != 0)
+  {
+    const unsigned long long r = a % b;
+    a = b;
+    b = r;
+  }
+  return a;
+}
+
+
+Resampler::Resampler(double inputSampleRate, double outputSampleRate) :
+  _inputSampleRate(inputSampleRate),
+  _outputSampleRate(outputSampleRate),
+  _exact(false),
+  _interpolation(InterpolatedPhaseCount),
+  _decimation(1),
+  _tapCount(0),
+  _phaseStride(0),
+  _phases()
+{
+  InitSIMDKernel();
+
+  if (IsInteger(inputSampleRate) && IsInteger(outputSampleRate))
+  {
+    const unsigned long long in = static_cast<unsigned long long>(::floor(inputSampleRate + 0.5));
+    const unsigned long long out = static_cast<unsigned long long>(::floor(outputSampleRate + 0.5));
+    const unsigned long long gcd = GreatestCommonDivisor(in, out);
+    if (out / gcd <= MaxExactPhaseCount)
+    {
+      _exact = true;
+      _interpolation = static_cast<size_t>(out / gcd);
+      _decimation = static_cast<size_t>(in / gcd);
+    }
+  }
+
+  // When downsampling, the filter gets longer in order to keep its steepness
+  const double scale = std::min(1.0, outputSampleRate / inputSampleRate);
+  const double cutoff = 0.5 * Rolloff * scale; // Cycles per input sample
+  const size_t halfLength = static_cast<size_t>(::ceil(static_cast<double>(ZeroCrossings) / scale));
+  _tapCount = 2 * halfLength;
+  _phaseStride = AlignedSize<Sample>(_tapCount);
+
+  // Phase p delays by p/_interpolation input samples, the interpolation needs one more
+  // phase (i.e. the first phase shifted by one sample)
+  const size_t phaseCount = _exact ? _interpolation : (_interpolation + 1);
+  const double besselBeta = BesselI0(KaiserBeta);
+  _phases.resize(phaseCount * _phaseStride, 0.0f);
+  for (size_t p=0; p<phaseCount; ++p)
+  {
+    const double frac = static_cast<double>(p) / static_cast<double>(_interpolation);
+    Sample* coefficients = &_phases[p * _phaseStride];
+    double sum = 0.0;
+    for (size_t j=0; j<_tapCount; ++j)
+    {
+      // Distance of the input sample belonging to this tap from the output position
+      const double x = static_cast<double>(j) - static_cast<double>(halfLength - 1) - frac;
+      const double u = x / static_cast<double>(halfLength);
+      const double window = (::fabs(u) <= 1.0) ? BesselI0(KaiserBeta * ::sqrt(1.0 - u * u)) / besselBeta : 0.0;
+      const double arg = 2.0 * cutoff * x;
+      const double sinc = (::fabs(arg) < 1e-12) ? 1.0 : ::sin(Pi * arg) / (Pi * arg);
+      const double h = 2.0 * cutoff * sinc * window;
+      coefficients[j] = static_cast<Sample>(h);
+      sum += h;
+    }
+
+    // Unity gain at DC for each phase
+    if (::fabs(sum) > 1e-12)
+    {
+      for (size_t j=0; j<_tapCount; ++j)
+      {
+        coefficients[j] = static_cast<Sample>(static_cast<double>(coefficients[j]) / sum);
+      }
+    }
+  }
+}
+
+
+size_t Resampler::getOutputSize(size_t inputSize) const
+{
+  if (_exact)
+  {
+    return (inputSize * _interpolation + _decimation - 1) / _decimation;
+  }
+  return static_cast<size_t>(::ceil(static_cast<double>(inputSize) * _outputSampleRate / _inputSampleRate));
+}
+
+
+void Resampler::process(const Sample* input, size_t inputSize, Sample* output, size_t outputBegin, size_t outputEnd) const
+{
+  std::vector<Sample> window(_tapCount);
+  const long long halfLength = static_cast<long long>(_tapCount / 2);
+  if (_exact)
+  {
+    for (size_t n=outputBegin; n<outputEnd; ++n)
+    {
+      const unsigned long long pos = static_cast<unsigned long long>(n) * _decimation;
+      const long long inputPos = static_cast<long long>(pos / _interpolation);
+      const size_t phaseIndex = static_cast<size_t>(pos % _interpolation);
+      output[n] = calculateSample(input, inputSize, inputPos - (halfLength - 1), phaseIndex, window.data());
+    }
+  }
+  else
+  {
+    const double inputStep = _inputSampleRate / _outputSampleRate;
+    for (size_t n=outputBegin; n<outputEnd; ++n)
+    {
+      const double pos = static_cast<double>(n) * inputStep;
+      const double inputPos = ::floor(pos);
+      const double phasePos = (pos - inputPos) * static_cast<double>(_interpolation);
+      const size_t phaseIndex = std::min(static_cast<size_t>(phasePos), _interpolation - 1);
+      const Sample weight = static_cast<Sample>(phasePos - static_cast<double>(phaseIndex));
+      const long long inputStart = static_cast<long long>(inputPos) - (halfLength - 1);
+      const Sample a = calculateSample(input, inputSize, inputStart, phaseIndex, window.data());
+      const Sample b = calculateSample(input, inputSize, inputStart, phaseIndex + 1, window.data());
+      output[n] = a + weight * (b - a);
+    }
+  }
+}
+
+
+const Sample* Resampler::phase(size_t index) const
+{
+  return &_phases[index * _phaseStride];
+}
+
+
+Sample Resampler::calculateSample(const Sample* input, size_t inputSize, long long inputStart, size_t phaseIndex, Sample* window) const
+{
+  const long long inputEnd = inputStart + static_cast<long long>(_tapCount);
+  if (inputStart >= 0 && inputEnd <= static_cast<long long>(inputSize))
+  {
+    return DotProduct(input + inputStart, phase(phaseIndex), _tapCount);
+  }
+
+  // Near the begin and the end of the input, the samples outside of it are zero
+  for (size_t j=0; j<_tapCount; ++j)
+  {
+    const long long i = inputStart + static_cast<long long>(j);
+    window[j] = (i >= 0 && i < static_cast<long long>(inputSize)) ? input[i] : 0.0f;
+  }
+  return DotProduct(window, phase(phaseIndex), _tapCount);
+}
+
+} // End of namespace fftconvolver
@@ -0,0 +1,83 @@
+// ==================================================================================
+// Copyright (c) 2012 HiFi-LoFi
+//
+// This is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+// ==================================================================================
+
+#ifndef _FFTCONVOLVER_RESAMPLER_H
+#define _FFTCONVOLVER_RESAMPLER_H
+
+#include "Utilities.h"
+
+#include <cstddef>
+#include <vector>
+
+
+namespace fftconvolver
+{
+
+/**
+* @class Resampler
+* @brief Offline polyphase resampler using a Kaiser windowed sinc filter
+*
+* If both sample rates are integers whose ratio can be expressed by a fraction with a
+* small numerator (e.g. 44.1 kHz <=> 48 kHz <=> 96 kHz), each output sample is calculated
+* exactly by one phase of the filter. Otherwise (e.g. for stretching the impulse response),
+* the output samples are interpolated linearly between the two nearest phases.
+*
+* When downsampling, the cutoff frequency of the filter follows the output sample rate.
+*/
+class Resampler
+{
+public:
+  Resampler(double inputSampleRate, double outputSampleRate);
+
+  /**
+  * @brief Returns the number of output samples for the given number of input samples
+  * @param inputSize Number of input samples
+  * @return Number of output samples
+  */
+  size_t getOutputSize(size_t inputSize) const;
+
+  /**
+  * @brief Calculates a range of output samples (the input is treated as zero outside of its bounds)
+  * @param input The input samples
+  * @param inputSize Number of input samples
+  * @param output The output buffer (the complete output, not only the range)
+  * @param outputBegin Index of the first output sample to calculate
+  * @param outputEnd Index behind the last output sample to calculate
+  */
+  void process(const Sample* input, size_t inputSize, Sample* output, size_t outputBegin, size_t outputEnd) const;
+
+private:
+  const Sample* phase(size_t index) const;
+  Sample calculateSample(const Sample* input, size_t inputSize, long long inputStart, size_t phaseIndex, Sample* window) const;
+
+  double _inputSampleRate;
+  double _outputSampleRate;
+  bool _exact;
+  size_t _interpolation;     // Exact ratio: Output samples per _decimation input samples - Otherwise: Number of phases
+  size_t _decimation;
+  size_t _tapCount;          // Taps per phase
+  size_t _phaseStride;
+  std::vector<Sample> _phases;
+
+  // Prevent uncontrolled usage
+  Resampler(const Resampler&);
+  Resampler& operator=(const Resampler&);
+};
+
+} // End of namespace fftconvolver
+
+#endif // Header guard
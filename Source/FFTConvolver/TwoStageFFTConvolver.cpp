@@ -37,7 +37,8 @@ TwoStageFFTConvolver::TwoStageFFTConvolver() :
   _tailInput(),
   _tailInputFill(0),
   _precalculatedPos(0),
-  _backgroundProcessingInput()
+  _backgroundProcessingInput(),
+  _arena()
 {
 }
 
@@ -64,6 +65,7 @@ void TwoStageFFTConvolver::reset()
   _tailInputFill = 0;
   _precalculatedPos = 0;
   _backgroundProcessingInput.clear();
+  _arena.clear();
 }
 
   
@@ -103,26 +105,30 @@ bool TwoStageFFTConvolver::init(size_t headBlockSize,
   const size_t headIrLen = std::min(irLen, _tailBlockSize);
   _headConvolver.init(_headBlockSize, ir, headIrLen);
 
+  // All buffers of the tail live in one block of memory
+  const size_t tailBuffers = ((irLen > _tailBlockSize) ? 3 : 0) + ((irLen > 2 * _tailBlockSize) ? 3 : 0);
+  _arena.allocate(tailBuffers * Arena::Bytes<Sample>(_tailBlockSize));
+
   if (irLen > _tailBlockSize)
   {
     const size_t conv1IrLen = std::min(irLen-_tailBlockSize, _tailBlockSize);
     _tailConvolver0.init(_headBlockSize, ir+_tailBlockSize, conv1IrLen);
-    _tailOutput0.resize(_tailBlockSize);
-    _tailPrecalculated0.resize(_tailBlockSize);
+    _tailOutput0.attach(_arena, _tailBlockSize);
+    _tailPrecalculated0.attach(_arena, _tailBlockSize);
   }
 
   if (irLen > 2 * _tailBlockSize)
   {
     const size_t tailIrLen = irLen - (2*_tailBlockSize);
     _tailConvolver.init(_tailBlockSize, ir+(2*_tailBlockSize), tailIrLen);
-    _tailOutput.resize(_tailBlockSize);
-    _tailPrecalculated.resize(_tailBlockSize);
-    _backgroundProcessingInput.resize(_tailBlockSize);
+    _tailOutput.attach(_arena, _tailBlockSize);
+    _tailPrecalculated.attach(_arena, _tailBlockSize);
+    _backgroundProcessingInput.attach(_arena, _tailBlockSize);
   }
 
   if (_tailPrecalculated0.size() > 0 || _tailPrecalculated.size() > 0)
   {
-    _tailInput.resize(_tailBlockSize);
+    _tailInput.attach(_arena, _tailBlockSize);
   }
   _tailInputFill = 0;
   _precalculatedPos = 0;
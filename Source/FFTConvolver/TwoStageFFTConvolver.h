@@ -114,6 +114,7 @@ private:
   size_t _tailInputFill;
   size_t _precalculatedPos;
   SampleBuffer _backgroundProcessingInput;
+  Arena _arena;
 
   // Prevent uncontrolled usage
   TwoStageFFTConvolver(const TwoStageFFTConvolver&);
@@ -17,24 +17,206 @@
 
 #include "Utilities.h"
 
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <mutex>
+
+#if defined(_WIN32)
+  #include <malloc.h>
+#endif
+
+#if defined(__linux__)
+  #include <sys/mman.h>
+#endif
+
+
+#if defined(FFTCONVOLVER_USE_SSE) && !defined(FFTCONVOLVER_DONT_USE_AVX)
+  #if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+    #define FFTCONVOLVER_USE_AVX
+    #include <immintrin.h>
+    #if defined(_MSC_VER)
+      #include <intrin.h>
+    #endif
+  #endif
+#endif
+
+#if (defined(__ARM_NEON) || defined(__ARM_NEON__)) && !defined(FFTCONVOLVER_DONT_USE_NEON)
+  #define FFTCONVOLVER_USE_NEON
+  #include <arm_neon.h>
+#endif
+
+#if defined(FFTCONVOLVER_USE_AVX) && (defined(__GNUC__) || defined(__clang__))
+  #define FFTCONVOLVER_TARGET_AVX2 __attribute__((target("avx2,fma")))
+  #define FFTCONVOLVER_TARGET_AVX512 __attribute__((target("avx512f")))
+#else
+  #define FFTCONVOLVER_TARGET_AVX2
+  #define FFTCONVOLVER_TARGET_AVX512
+#endif
+
 
 namespace fftconvolver
 {
 
-bool SSEEnabled()
+// Blocks of at least this size are aligned to (and advised to use) huge pages
+static const size_t HugePageSize = 2 * 1024 * 1024;
+
+// Samples below -120 dB (the amplitude equivalent of FFTConvolver::DefaultSegmentThreshold)
+// count as silent, so denormal residue or dither doesn't keep the convolvers busy
+static const Sample SilenceThreshold = 1e-6f;
+
+
+static char* AllocateAligned(size_t bytes, size_t alignment)
 {
-#if defined(FFTCONVOLVER_USE_SSE)
-  return true;
+#if defined(_WIN32)
+  char* memory = static_cast<char*>(::_aligned_malloc(bytes, alignment));
 #else
-  return false;
+  void* allocated = 0;
+  char* memory = (::posix_memalign(&allocated, alignment, bytes) == 0) ? static_cast<char*>(allocated) : 0;
 #endif
+  if (!memory)
+  {
+    throw std::bad_alloc();
+  }
+  return memory;
 }
 
 
-void Sum(Sample* FFTCONVOLVER_RESTRICT result,
-         const Sample* FFTCONVOLVER_RESTRICT a,
-         const Sample* FFTCONVOLVER_RESTRICT b,
-         size_t len)
+static void FreeAligned(char* memory)
+{
+#if defined(_WIN32)
+  ::_aligned_free(memory);
+#else
+  ::free(memory);
+#endif
+}
+
+
+// ==================================================================================
+
+
+Arena::Arena() :
+  _memory(0),
+  _size(0),
+  _used(0)
+{
+}
+
+
+Arena::~Arena()
+{
+  clear();
+}
+
+
+void Arena::allocate(size_t bytes)
+{
+  clear();
+  if (bytes > 0)
+  {
+    // The block isn't touched here, each buffer is zeroed when it's taken (see take())
+    const size_t alignment = (bytes >= HugePageSize) ? HugePageSize : BufferAlignment;
+    _memory = AllocateAligned(bytes, alignment);
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if (alignment == HugePageSize)
+    {
+      ::madvise(_memory, (bytes / HugePageSize) * HugePageSize, MADV_HUGEPAGE);
+    }
+#endif
+    _size = bytes;
+  }
+}
+
+
+void Arena::clear()
+{
+  if (_memory)
+  {
+    FreeAligned(_memory);
+  }
+  _memory = 0;
+  _size = 0;
+  _used = 0;
+}
+
+
+size_t Arena::size() const
+{
+  return _size;
+}
+
+
+// ==================================================================================
+
+
+typedef void (*SumFunction)(Sample* FFTCONVOLVER_RESTRICT result,
+                            const Sample* FFTCONVOLVER_RESTRICT a,
+                            const Sample* FFTCONVOLVER_RESTRICT b,
+                            size_t len);
+
+typedef Sample (*DotProductFunction)(const Sample* a,
+                                     const Sample* b,
+                                     size_t len);
+
+typedef void (*ComplexMultiplyAccumulateFunction)(Sample* FFTCONVOLVER_RESTRICT re,
+                                                  Sample* FFTCONVOLVER_RESTRICT im,
+                                                  const Sample* FFTCONVOLVER_RESTRICT reA,
+                                                  const Sample* FFTCONVOLVER_RESTRICT imA,
+                                                  const Sample* FFTCONVOLVER_RESTRICT reB,
+                                                  const Sample* FFTCONVOLVER_RESTRICT imB,
+                                                  const size_t len);
+
+typedef void (*ComplexMultiplyAccumulateSegmentsFunction)(Sample* FFTCONVOLVER_RESTRICT re,
+                                                          Sample* FFTCONVOLVER_RESTRICT im,
+                                                          const Sample* reA,
+                                                          const Sample* imA,
+                                                          size_t strideA,
+                                                          const Sample* reB,
+                                                          const Sample* imB,
+                                                          size_t strideB,
+                                                          size_t count,
+                                                          const size_t len);
+
+
+static void ComplexMultiplyAccumulateSegmentsTail(Sample* FFTCONVOLVER_RESTRICT re,
+                                                  Sample* FFTCONVOLVER_RESTRICT im,
+                                                  const Sample* reA,
+                                                  const Sample* imA,
+                                                  size_t strideA,
+                                                  const Sample* reB,
+                                                  const Sample* imB,
+                                                  size_t strideB,
+                                                  size_t count,
+                                                  size_t begin,
+                                                  const size_t len)
+{
+  for (size_t i=begin; i<len; ++i)
+  {
+    Sample real = re[i];
+    Sample imag = im[i];
+    for (size_t k=0; k<count; ++k)
+    {
+      const size_t a = k * strideA + i;
+      const size_t b = k * strideB + i;
+      real += reA[a] * reB[b] - imA[a] * imB[b];
+      imag += reA[a] * imB[b] + imA[a] * reB[b];
+    }
+    re[i] = real;
+    im[i] = imag;
+  }
+}
+
+
+// ================================================================
+// Scalar
+// ================================================================
+
+#if !defined(FFTCONVOLVER_USE_SSE) && !defined(FFTCONVOLVER_USE_NEON)
+
+static void SumScalar(Sample* FFTCONVOLVER_RESTRICT result,
+                      const Sample* FFTCONVOLVER_RESTRICT a,
+                      const Sample* FFTCONVOLVER_RESTRICT b,
+                      size_t len)
 {
   const size_t end4 = 4 * (len / 4);
   for (size_t i=0; i<end4; i+=4)
@@ -51,23 +233,169 @@ void Sum(Sample* FFTCONVOLVER_RESTRICT result,
 }
 
 
-void ComplexMultiplyAccumulate(SplitComplex& result, const SplitComplex& a, const SplitComplex& b)
+static Sample DotProductScalar(const Sample* a,
+                               const Sample* b,
+                               size_t len)
 {
-  assert(result.size() == a.size());
-  assert(result.size() == b.size());
-  ComplexMultiplyAccumulate(result.re(), result.im(), a.re(), a.im(), b.re(), b.im(), result.size());
+  Sample sum0 = 0;
+  Sample sum1 = 0;
+  Sample sum2 = 0;
+  Sample sum3 = 0;
+  const size_t end4 = 4 * (len / 4);
+  for (size_t i=0; i<end4; i+=4)
+  {
+    sum0 += a[i+0] * b[i+0];
+    sum1 += a[i+1] * b[i+1];
+    sum2 += a[i+2] * b[i+2];
+    sum3 += a[i+3] * b[i+3];
+  }
+  for (size_t i=end4; i<len; ++i)
+  {
+    sum0 += a[i] * b[i];
+  }
+  return (sum0 + sum1) + (sum2 + sum3);
 }
 
 
-void ComplexMultiplyAccumulate(Sample* FFTCONVOLVER_RESTRICT re, 
-                               Sample* FFTCONVOLVER_RESTRICT im,
-                               const Sample* FFTCONVOLVER_RESTRICT reA,
-                               const Sample* FFTCONVOLVER_RESTRICT imA,
-                               const Sample* FFTCONVOLVER_RESTRICT reB,
-                               const Sample* FFTCONVOLVER_RESTRICT imB,
-                               const size_t len)
+static void ComplexMultiplyAccumulateScalar(Sample* FFTCONVOLVER_RESTRICT re,
+                                            Sample* FFTCONVOLVER_RESTRICT im,
+                                            const Sample* FFTCONVOLVER_RESTRICT reA,
+                                            const Sample* FFTCONVOLVER_RESTRICT imA,
+                                            const Sample* FFTCONVOLVER_RESTRICT reB,
+                                            const Sample* FFTCONVOLVER_RESTRICT imB,
+                                            const size_t len)
+{
+  const size_t end4 = 4 * (len / 4);
+  for (size_t i=0; i<end4; i+=4)
+  {
+    re[i+0] += reA[i+0] * reB[i+0] - imA[i+0] * imB[i+0];
+    re[i+1] += reA[i+1] * reB[i+1] - imA[i+1] * imB[i+1];
+    re[i+2] += reA[i+2] * reB[i+2] - imA[i+2] * imB[i+2];
+    re[i+3] += reA[i+3] * reB[i+3] - imA[i+3] * imB[i+3];
+    im[i+0] += reA[i+0] * imB[i+0] + imA[i+0] * reB[i+0];
+    im[i+1] += reA[i+1] * imB[i+1] + imA[i+1] * reB[i+1];
+    im[i+2] += reA[i+2] * imB[i+2] + imA[i+2] * reB[i+2];
+    im[i+3] += reA[i+3] * imB[i+3] + imA[i+3] * reB[i+3];
+  }
+  for (size_t i=end4; i<len; ++i)
+  {
+    re[i] += reA[i] * reB[i] - imA[i] * imB[i];
+    im[i] += reA[i] * imB[i] + imA[i] * reB[i];
+  }
+}
+
+
+static void ComplexMultiplyAccumulateSegmentsScalar(Sample* FFTCONVOLVER_RESTRICT re,
+                                                    Sample* FFTCONVOLVER_RESTRICT im,
+                                                    const Sample* reA,
+                                                    const Sample* imA,
+                                                    size_t strideA,
+                                                    const Sample* reB,
+                                                    const Sample* imB,
+                                                    size_t strideB,
+                                                    size_t count,
+                                                    const size_t len)
 {
+  const size_t end4 = 4 * (len / 4);
+  for (size_t i=0; i<end4; i+=4)
+  {
+    Sample real0 = re[i+0];
+    Sample real1 = re[i+1];
+    Sample real2 = re[i+2];
+    Sample real3 = re[i+3];
+    Sample imag0 = im[i+0];
+    Sample imag1 = im[i+1];
+    Sample imag2 = im[i+2];
+    Sample imag3 = im[i+3];
+    const Sample* ra = reA + i;
+    const Sample* ia = imA + i;
+    const Sample* rb = reB + i;
+    const Sample* ib = imB + i;
+    for (size_t k=0; k<count; ++k)
+    {
+      real0 += ra[0] * rb[0] - ia[0] * ib[0];
+      real1 += ra[1] * rb[1] - ia[1] * ib[1];
+      real2 += ra[2] * rb[2] - ia[2] * ib[2];
+      real3 += ra[3] * rb[3] - ia[3] * ib[3];
+      imag0 += ra[0] * ib[0] + ia[0] * rb[0];
+      imag1 += ra[1] * ib[1] + ia[1] * rb[1];
+      imag2 += ra[2] * ib[2] + ia[2] * rb[2];
+      imag3 += ra[3] * ib[3] + ia[3] * rb[3];
+      ra += strideA;
+      ia += strideA;
+      rb += strideB;
+      ib += strideB;
+    }
+    re[i+0] = real0;
+    re[i+1] = real1;
+    re[i+2] = real2;
+    re[i+3] = real3;
+    im[i+0] = imag0;
+    im[i+1] = imag1;
+    im[i+2] = imag2;
+    im[i+3] = imag3;
+  }
+  ComplexMultiplyAccumulateSegmentsTail(re, im, reA, imA, strideA, reB, imB, strideB, count, end4, len);
+}
+
+#endif // !FFTCONVOLVER_USE_SSE && !FFTCONVOLVER_USE_NEON
+
+
+// ================================================================
+// SSE (4-wide)
+// ================================================================
+
 #if defined(FFTCONVOLVER_USE_SSE)
+
+static void SumSSE(Sample* FFTCONVOLVER_RESTRICT result,
+                   const Sample* FFTCONVOLVER_RESTRICT a,
+                   const Sample* FFTCONVOLVER_RESTRICT b,
+                   size_t len)
+{
+  const size_t end4 = 4 * (len / 4);
+  for (size_t i=0; i<end4; i+=4)
+  {
+    _mm_storeu_ps(&result[i], _mm_add_ps(_mm_loadu_ps(&a[i]), _mm_loadu_ps(&b[i])));
+  }
+  for (size_t i=end4; i<len; ++i)
+  {
+    result[i] = a[i] + b[i];
+  }
+}
+
+
+static Sample DotProductSSE(const Sample* a,
+                            const Sample* b,
+                            size_t len)
+{
+  __m128 sum0 = _mm_setzero_ps();
+  __m128 sum1 = _mm_setzero_ps();
+  const size_t end8 = 8 * (len / 8);
+  for (size_t i=0; i<end8; i+=8)
+  {
+    sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(&a[i+0]), _mm_loadu_ps(&b[i+0])));
+    sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(&a[i+4]), _mm_loadu_ps(&b[i+4])));
+  }
+  __m128 sum = _mm_add_ps(sum0, sum1);
+  sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+  sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+  Sample result = _mm_cvtss_f32(sum);
+  for (size_t i=end8; i<len; ++i)
+  {
+    result += a[i] * b[i];
+  }
+  return result;
+}
+
+
+static void ComplexMultiplyAccumulateSSE(Sample* FFTCONVOLVER_RESTRICT re,
+                                         Sample* FFTCONVOLVER_RESTRICT im,
+                                         const Sample* FFTCONVOLVER_RESTRICT reA,
+                                         const Sample* FFTCONVOLVER_RESTRICT imA,
+                                         const Sample* FFTCONVOLVER_RESTRICT reB,
+                                         const Sample* FFTCONVOLVER_RESTRICT imB,
+                                         const size_t len)
+{
   const size_t end4 = 4 * (len / 4);
   for (size_t i=0; i<end4; i+=4)
   {
@@ -89,25 +417,662 @@ void ComplexMultiplyAccumulate(Sample* FFTCONVOLVER_RESTRICT re,
     re[i] += reA[i] * reB[i] - imA[i] * imB[i];
     im[i] += reA[i] * imB[i] + imA[i] * reB[i];
   }
+}
+
+
+static void ComplexMultiplyAccumulateSegmentsSSE(Sample* FFTCONVOLVER_RESTRICT re,
+                                                 Sample* FFTCONVOLVER_RESTRICT im,
+                                                 const Sample* reA,
+                                                 const Sample* imA,
+                                                 size_t strideA,
+                                                 const Sample* reB,
+                                                 const Sample* imB,
+                                                 size_t strideB,
+                                                 size_t count,
+                                                 const size_t len)
+{
+  const size_t end16 = 16 * (len / 16);
+  for (size_t i=0; i<end16; i+=16)
+  {
+    __m128 real[4];
+    __m128 imag[4];
+    for (size_t v=0; v<4; ++v)
+    {
+      real[v] = _mm_loadu_ps(&re[i+4*v]);
+      imag[v] = _mm_loadu_ps(&im[i+4*v]);
+    }
+    const Sample* ra = reA + i;
+    const Sample* ia = imA + i;
+    const Sample* rb = reB + i;
+    const Sample* ib = imB + i;
+    for (size_t k=0; k<count; ++k)
+    {
+      for (size_t v=0; v<4; ++v)
+      {
+        const __m128 a = _mm_loadu_ps(ra+4*v);
+        const __m128 b = _mm_loadu_ps(rb+4*v);
+        const __m128 c = _mm_loadu_ps(ia+4*v);
+        const __m128 d = _mm_loadu_ps(ib+4*v);
+        real[v] = _mm_add_ps(real[v], _mm_sub_ps(_mm_mul_ps(a, b), _mm_mul_ps(c, d)));
+        imag[v] = _mm_add_ps(imag[v], _mm_add_ps(_mm_mul_ps(a, d), _mm_mul_ps(c, b)));
+      }
+      ra += strideA;
+      ia += strideA;
+      rb += strideB;
+      ib += strideB;
+    }
+    for (size_t v=0; v<4; ++v)
+    {
+      _mm_storeu_ps(&re[i+4*v], real[v]);
+      _mm_storeu_ps(&im[i+4*v], imag[v]);
+    }
+  }
+  ComplexMultiplyAccumulateSegmentsTail(re, im, reA, imA, strideA, reB, imB, strideB, count, end16, len);
+}
+
+#endif // FFTCONVOLVER_USE_SSE
+
+
+// ================================================================
+// AVX2/FMA (8-wide) and AVX-512 (16-wide)
+// ================================================================
+
+#if defined(FFTCONVOLVER_USE_AVX)
+
+FFTCONVOLVER_TARGET_AVX2
+static void SumAVX2(Sample* FFTCONVOLVER_RESTRICT result,
+                    const Sample* FFTCONVOLVER_RESTRICT a,
+                    const Sample* FFTCONVOLVER_RESTRICT b,
+                    size_t len)
+{
+  const size_t end8 = 8 * (len / 8);
+  for (size_t i=0; i<end8; i+=8)
+  {
+    _mm256_storeu_ps(&result[i], _mm256_add_ps(_mm256_loadu_ps(&a[i]), _mm256_loadu_ps(&b[i])));
+  }
+  for (size_t i=end8; i<len; ++i)
+  {
+    result[i] = a[i] + b[i];
+  }
+}
+
+
+FFTCONVOLVER_TARGET_AVX2
+static Sample DotProductAVX2(const Sample* a,
+                             const Sample* b,
+                             size_t len)
+{
+  __m256 sum0 = _mm256_setzero_ps();
+  __m256 sum1 = _mm256_setzero_ps();
+  const size_t end16 = 16 * (len / 16);
+  for (size_t i=0; i<end16; i+=16)
+  {
+    sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(&a[i+0]), _mm256_loadu_ps(&b[i+0]), sum0);
+    sum1 = _mm256_fmadd_ps(_mm256_loadu_ps(&a[i+8]), _mm256_loadu_ps(&b[i+8]), sum1);
+  }
+  const __m256 sum8 = _mm256_add_ps(sum0, sum1);
+  __m128 sum = _mm_add_ps(_mm256_castps256_ps128(sum8), _mm256_extractf128_ps(sum8, 1));
+  sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+  sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+  Sample result = _mm_cvtss_f32(sum);
+  for (size_t i=end16; i<len; ++i)
+  {
+    result += a[i] * b[i];
+  }
+  return result;
+}
+
+
+FFTCONVOLVER_TARGET_AVX2
+static void ComplexMultiplyAccumulateAVX2(Sample* FFTCONVOLVER_RESTRICT re,
+                                          Sample* FFTCONVOLVER_RESTRICT im,
+                                          const Sample* FFTCONVOLVER_RESTRICT reA,
+                                          const Sample* FFTCONVOLVER_RESTRICT imA,
+                                          const Sample* FFTCONVOLVER_RESTRICT reB,
+                                          const Sample* FFTCONVOLVER_RESTRICT imB,
+                                          const size_t len)
+{
+  const size_t end8 = 8 * (len / 8);
+  for (size_t i=0; i<end8; i+=8)
+  {
+    const __m256 ra = _mm256_loadu_ps(&reA[i]);
+    const __m256 rb = _mm256_loadu_ps(&reB[i]);
+    const __m256 ia = _mm256_loadu_ps(&imA[i]);
+    const __m256 ib = _mm256_loadu_ps(&imB[i]);
+    __m256 real = _mm256_loadu_ps(&re[i]);
+    __m256 imag = _mm256_loadu_ps(&im[i]);
+    real = _mm256_fmadd_ps(ra, rb, real);
+    real = _mm256_fnmadd_ps(ia, ib, real);
+    imag = _mm256_fmadd_ps(ra, ib, imag);
+    imag = _mm256_fmadd_ps(ia, rb, imag);
+    _mm256_storeu_ps(&re[i], real);
+    _mm256_storeu_ps(&im[i], imag);
+  }
+  for (size_t i=end8; i<len; ++i)
+  {
+    re[i] += reA[i] * reB[i] - imA[i] * imB[i];
+    im[i] += reA[i] * imB[i] + imA[i] * reB[i];
+  }
+}
+
+
+FFTCONVOLVER_TARGET_AVX2
+static void ComplexMultiplyAccumulateSegmentsAVX2(Sample* FFTCONVOLVER_RESTRICT re,
+                                                  Sample* FFTCONVOLVER_RESTRICT im,
+                                                  const Sample* reA,
+                                                  const Sample* imA,
+                                                  size_t strideA,
+                                                  const Sample* reB,
+                                                  const Sample* imB,
+                                                  size_t strideB,
+                                                  size_t count,
+                                                  const size_t len)
+{
+  const size_t end16 = 16 * (len / 16);
+  for (size_t i=0; i<end16; i+=16)
+  {
+    __m256 real0 = _mm256_loadu_ps(&re[i]);
+    __m256 real1 = _mm256_loadu_ps(&re[i+8]);
+    __m256 imag0 = _mm256_loadu_ps(&im[i]);
+    __m256 imag1 = _mm256_loadu_ps(&im[i+8]);
+    const Sample* ra = reA + i;
+    const Sample* ia = imA + i;
+    const Sample* rb = reB + i;
+    const Sample* ib = imB + i;
+    for (size_t k=0; k<count; ++k)
+    {
+      const __m256 ra0 = _mm256_loadu_ps(ra);
+      const __m256 ra1 = _mm256_loadu_ps(ra+8);
+      const __m256 ia0 = _mm256_loadu_ps(ia);
+      const __m256 ia1 = _mm256_loadu_ps(ia+8);
+      const __m256 rb0 = _mm256_loadu_ps(rb);
+      const __m256 rb1 = _mm256_loadu_ps(rb+8);
+      const __m256 ib0 = _mm256_loadu_ps(ib);
+      const __m256 ib1 = _mm256_loadu_ps(ib+8);
+      real0 = _mm256_fmadd_ps(ra0, rb0, real0);
+      real1 = _mm256_fmadd_ps(ra1, rb1, real1);
+      imag0 = _mm256_fmadd_ps(ra0, ib0, imag0);
+      imag1 = _mm256_fmadd_ps(ra1, ib1, imag1);
+      real0 = _mm256_fnmadd_ps(ia0, ib0, real0);
+      real1 = _mm256_fnmadd_ps(ia1, ib1, real1);
+      imag0 = _mm256_fmadd_ps(ia0, rb0, imag0);
+      imag1 = _mm256_fmadd_ps(ia1, rb1, imag1);
+      ra += strideA;
+      ia += strideA;
+      rb += strideB;
+      ib += strideB;
+    }
+    _mm256_storeu_ps(&re[i], real0);
+    _mm256_storeu_ps(&re[i+8], real1);
+    _mm256_storeu_ps(&im[i], imag0);
+    _mm256_storeu_ps(&im[i+8], imag1);
+  }
+  ComplexMultiplyAccumulateSegmentsTail(re, im, reA, imA, strideA, reB, imB, strideB, count, end16, len);
+}
+
+
+FFTCONVOLVER_TARGET_AVX512
+static void SumAVX512(Sample* FFTCONVOLVER_RESTRICT result,
+                      const Sample* FFTCONVOLVER_RESTRICT a,
+                      const Sample* FFTCONVOLVER_RESTRICT b,
+                      size_t len)
+{
+  const size_t end16 = 16 * (len / 16);
+  for (size_t i=0; i<end16; i+=16)
+  {
+    _mm512_storeu_ps(&result[i], _mm512_add_ps(_mm512_loadu_ps(&a[i]), _mm512_loadu_ps(&b[i])));
+  }
+  for (size_t i=end16; i<len; ++i)
+  {
+    result[i] = a[i] + b[i];
+  }
+}
+
+
+FFTCONVOLVER_TARGET_AVX512
+static Sample DotProductAVX512(const Sample* a,
+                               const Sample* b,
+                               size_t len)
+{
+  __m512 sum0 = _mm512_setzero_ps();
+  __m512 sum1 = _mm512_setzero_ps();
+  const size_t end32 = 32 * (len / 32);
+  for (size_t i=0; i<end32; i+=32)
+  {
+    sum0 = _mm512_fmadd_ps(_mm512_loadu_ps(&a[i+0]), _mm512_loadu_ps(&b[i+0]), sum0);
+    sum1 = _mm512_fmadd_ps(_mm512_loadu_ps(&a[i+16]), _mm512_loadu_ps(&b[i+16]), sum1);
+  }
+  Sample lanes[16];
+  _mm512_storeu_ps(lanes, _mm512_add_ps(sum0, sum1));
+  Sample result = 0;
+  for (size_t i=0; i<16; ++i)
+  {
+    result += lanes[i];
+  }
+  for (size_t i=end32; i<len; ++i)
+  {
+    result += a[i] * b[i];
+  }
+  return result;
+}
+
+
+FFTCONVOLVER_TARGET_AVX512
+static void ComplexMultiplyAccumulateAVX512(Sample* FFTCONVOLVER_RESTRICT re,
+                                            Sample* FFTCONVOLVER_RESTRICT im,
+                                            const Sample* FFTCONVOLVER_RESTRICT reA,
+                                            const Sample* FFTCONVOLVER_RESTRICT imA,
+                                            const Sample* FFTCONVOLVER_RESTRICT reB,
+                                            const Sample* FFTCONVOLVER_RESTRICT imB,
+                                            const size_t len)
+{
+  const size_t end16 = 16 * (len / 16);
+  for (size_t i=0; i<end16; i+=16)
+  {
+    const __m512 ra = _mm512_loadu_ps(&reA[i]);
+    const __m512 rb = _mm512_loadu_ps(&reB[i]);
+    const __m512 ia = _mm512_loadu_ps(&imA[i]);
+    const __m512 ib = _mm512_loadu_ps(&imB[i]);
+    __m512 real = _mm512_loadu_ps(&re[i]);
+    __m512 imag = _mm512_loadu_ps(&im[i]);
+    real = _mm512_fmadd_ps(ra, rb, real);
+    real = _mm512_fnmadd_ps(ia, ib, real);
+    imag = _mm512_fmadd_ps(ra, ib, imag);
+    imag = _mm512_fmadd_ps(ia, rb, imag);
+    _mm512_storeu_ps(&re[i], real);
+    _mm512_storeu_ps(&im[i], imag);
+  }
+  for (size_t i=end16; i<len; ++i)
+  {
+    re[i] += reA[i] * reB[i] - imA[i] * imB[i];
+    im[i] += reA[i] * imB[i] + imA[i] * reB[i];
+  }
+}
+
+
+FFTCONVOLVER_TARGET_AVX512
+static void ComplexMultiplyAccumulateSegmentsAVX512(Sample* FFTCONVOLVER_RESTRICT re,
+                                                    Sample* FFTCONVOLVER_RESTRICT im,
+                                                    const Sample* reA,
+                                                    const Sample* imA,
+                                                    size_t strideA,
+                                                    const Sample* reB,
+                                                    const Sample* imB,
+                                                    size_t strideB,
+                                                    size_t count,
+                                                    const size_t len)
+{
+  const size_t end32 = 32 * (len / 32);
+  for (size_t i=0; i<end32; i+=32)
+  {
+    __m512 real0 = _mm512_loadu_ps(&re[i]);
+    __m512 real1 = _mm512_loadu_ps(&re[i+16]);
+    __m512 imag0 = _mm512_loadu_ps(&im[i]);
+    __m512 imag1 = _mm512_loadu_ps(&im[i+16]);
+    const Sample* ra = reA + i;
+    const Sample* ia = imA + i;
+    const Sample* rb = reB + i;
+    const Sample* ib = imB + i;
+    for (size_t k=0; k<count; ++k)
+    {
+      const __m512 ra0 = _mm512_loadu_ps(ra);
+      const __m512 ra1 = _mm512_loadu_ps(ra+16);
+      const __m512 ia0 = _mm512_loadu_ps(ia);
+      const __m512 ia1 = _mm512_loadu_ps(ia+16);
+      const __m512 rb0 = _mm512_loadu_ps(rb);
+      const __m512 rb1 = _mm512_loadu_ps(rb+16);
+      const __m512 ib0 = _mm512_loadu_ps(ib);
+      const __m512 ib1 = _mm512_loadu_ps(ib+16);
+      real0 = _mm512_fmadd_ps(ra0, rb0, real0);
+      real1 = _mm512_fmadd_ps(ra1, rb1, real1);
+      imag0 = _mm512_fmadd_ps(ra0, ib0, imag0);
+      imag1 = _mm512_fmadd_ps(ra1, ib1, imag1);
+      real0 = _mm512_fnmadd_ps(ia0, ib0, real0);
+      real1 = _mm512_fnmadd_ps(ia1, ib1, real1);
+      imag0 = _mm512_fmadd_ps(ia0, rb0, imag0);
+      imag1 = _mm512_fmadd_ps(ia1, rb1, imag1);
+      ra += strideA;
+      ia += strideA;
+      rb += strideB;
+      ib += strideB;
+    }
+    _mm512_storeu_ps(&re[i], real0);
+    _mm512_storeu_ps(&re[i+16], real1);
+    _mm512_storeu_ps(&im[i], imag0);
+    _mm512_storeu_ps(&im[i+16], imag1);
+  }
+  ComplexMultiplyAccumulateSegmentsTail(re, im, reA, imA, strideA, reB, imB, strideB, count, end32, len);
+}
+
+
+static bool CPUSupportsAVX2()
+{
+#if defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7)
+  {
+    return false;
+  }
+  __cpuid(info, 1);
+  const bool osxsave = (info[2] & (1 << 27)) != 0;
+  const bool fma = (info[2] & (1 << 12)) != 0;
+  if (!osxsave || !fma || (_xgetbv(0) & 0x6) != 0x6)
+  {
+    return false;
+  }
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
 #else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+}
+
+
+static bool CPUSupportsAVX512()
+{
+#if defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7)
+  {
+    return false;
+  }
+  __cpuid(info, 1);
+  const bool osxsave = (info[2] & (1 << 27)) != 0;
+  if (!osxsave || (_xgetbv(0) & 0xE6) != 0xE6)
+  {
+    return false;
+  }
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 16)) != 0;
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx512f");
+#endif
+}
+
+#endif // FFTCONVOLVER_USE_AVX
+
+
+// ================================================================
+// NEON (4-wide)
+// ================================================================
+
+#if defined(FFTCONVOLVER_USE_NEON)
+
+static void SumNEON(Sample* FFTCONVOLVER_RESTRICT result,
+                    const Sample* FFTCONVOLVER_RESTRICT a,
+                    const Sample* FFTCONVOLVER_RESTRICT b,
+                    size_t len)
+{
   const size_t end4 = 4 * (len / 4);
   for (size_t i=0; i<end4; i+=4)
   {
-    re[i+0] += reA[i+0] * reB[i+0] - imA[i+0] * imB[i+0];
-    re[i+1] += reA[i+1] * reB[i+1] - imA[i+1] * imB[i+1];
-    re[i+2] += reA[i+2] * reB[i+2] - imA[i+2] * imB[i+2];
-    re[i+3] += reA[i+3] * reB[i+3] - imA[i+3] * imB[i+3];
-    im[i+0] += reA[i+0] * imB[i+0] + imA[i+0] * reB[i+0];
-    im[i+1] += reA[i+1] * imB[i+1] + imA[i+1] * reB[i+1];
-    im[i+2] += reA[i+2] * imB[i+2] + imA[i+2] * reB[i+2];
-    im[i+3] += reA[i+3] * imB[i+3] + imA[i+3] * reB[i+3];
+    vst1q_f32(&result[i], vaddq_f32(vld1q_f32(&a[i]), vld1q_f32(&b[i])));
+  }
+  for (size_t i=end4; i<len; ++i)
+  {
+    result[i] = a[i] + b[i];
+  }
+}
+
+
+static Sample DotProductNEON(const Sample* a,
+                             const Sample* b,
+                             size_t len)
+{
+  float32x4_t sum0 = vdupq_n_f32(0.0f);
+  float32x4_t sum1 = vdupq_n_f32(0.0f);
+  const size_t end8 = 8 * (len / 8);
+  for (size_t i=0; i<end8; i+=8)
+  {
+    sum0 = vmlaq_f32(sum0, vld1q_f32(&a[i+0]), vld1q_f32(&b[i+0]));
+    sum1 = vmlaq_f32(sum1, vld1q_f32(&a[i+4]), vld1q_f32(&b[i+4]));
+  }
+  const float32x4_t sum4 = vaddq_f32(sum0, sum1);
+  const float32x2_t sum2 = vadd_f32(vget_low_f32(sum4), vget_high_f32(sum4));
+  Sample result = vget_lane_f32(vpadd_f32(sum2, sum2), 0);
+  for (size_t i=end8; i<len; ++i)
+  {
+    result += a[i] * b[i];
+  }
+  return result;
+}
+
+
+static void ComplexMultiplyAccumulateNEON(Sample* FFTCONVOLVER_RESTRICT re,
+                                          Sample* FFTCONVOLVER_RESTRICT im,
+                                          const Sample* FFTCONVOLVER_RESTRICT reA,
+                                          const Sample* FFTCONVOLVER_RESTRICT imA,
+                                          const Sample* FFTCONVOLVER_RESTRICT reB,
+                                          const Sample* FFTCONVOLVER_RESTRICT imB,
+                                          const size_t len)
+{
+  const size_t end4 = 4 * (len / 4);
+  for (size_t i=0; i<end4; i+=4)
+  {
+    const float32x4_t ra = vld1q_f32(&reA[i]);
+    const float32x4_t rb = vld1q_f32(&reB[i]);
+    const float32x4_t ia = vld1q_f32(&imA[i]);
+    const float32x4_t ib = vld1q_f32(&imB[i]);
+    float32x4_t real = vld1q_f32(&re[i]);
+    float32x4_t imag = vld1q_f32(&im[i]);
+    real = vmlaq_f32(real, ra, rb);
+    real = vmlsq_f32(real, ia, ib);
+    imag = vmlaq_f32(imag, ra, ib);
+    imag = vmlaq_f32(imag, ia, rb);
+    vst1q_f32(&re[i], real);
+    vst1q_f32(&im[i], imag);
   }
   for (size_t i=end4; i<len; ++i)
   {
     re[i] += reA[i] * reB[i] - imA[i] * imB[i];
     im[i] += reA[i] * imB[i] + imA[i] * reB[i];
   }
+}
+
+
+static void ComplexMultiplyAccumulateSegmentsNEON(Sample* FFTCONVOLVER_RESTRICT re,
+                                                  Sample* FFTCONVOLVER_RESTRICT im,
+                                                  const Sample* reA,
+                                                  const Sample* imA,
+                                                  size_t strideA,
+                                                  const Sample* reB,
+                                                  const Sample* imB,
+                                                  size_t strideB,
+                                                  size_t count,
+                                                  const size_t len)
+{
+  const size_t end16 = 16 * (len / 16);
+  for (size_t i=0; i<end16; i+=16)
+  {
+    float32x4_t real[4];
+    float32x4_t imag[4];
+    for (size_t v=0; v<4; ++v)
+    {
+      real[v] = vld1q_f32(&re[i+4*v]);
+      imag[v] = vld1q_f32(&im[i+4*v]);
+    }
+    const Sample* ra = reA + i;
+    const Sample* ia = imA + i;
+    const Sample* rb = reB + i;
+    const Sample* ib = imB + i;
+    for (size_t k=0; k<count; ++k)
+    {
+      for (size_t v=0; v<4; ++v)
+      {
+        const float32x4_t a = vld1q_f32(ra+4*v);
+        const float32x4_t b = vld1q_f32(rb+4*v);
+        const float32x4_t c = vld1q_f32(ia+4*v);
+        const float32x4_t d = vld1q_f32(ib+4*v);
+        real[v] = vmlsq_f32(vmlaq_f32(real[v], a, b), c, d);
+        imag[v] = vmlaq_f32(vmlaq_f32(imag[v], a, d), c, b);
+      }
+      ra += strideA;
+      ia += strideA;
+      rb += strideB;
+      ib += strideB;
+    }
+    for (size_t v=0; v<4; ++v)
+    {
+      vst1q_f32(&re[i+4*v], real[v]);
+      vst1q_f32(&im[i+4*v], imag[v]);
+    }
+  }
+  ComplexMultiplyAccumulateSegmentsTail(re, im, reA, imA, strideA, reB, imB, strideB, count, end16, len);
+}
+
+#endif // FFTCONVOLVER_USE_NEON
+
+
+// ================================================================
+// Dispatch
+// ================================================================
+
+#if defined(FFTCONVOLVER_USE_SSE)
+  static std::atomic<SIMDKernel> ActiveKernel(SIMDKernelSSE);
+  static std::atomic<SumFunction> ActiveSum(SumSSE);
+  static std::atomic<DotProductFunction> ActiveDotProduct(DotProductSSE);
+  static std::atomic<ComplexMultiplyAccumulateFunction> ActiveComplexMultiplyAccumulate(ComplexMultiplyAccumulateSSE);
+  static std::atomic<ComplexMultiplyAccumulateSegmentsFunction> ActiveComplexMultiplyAccumulateSegments(ComplexMultiplyAccumulateSegmentsSSE);
+#elif defined(FFTCONVOLVER_USE_NEON)
+  static std::atomic<SIMDKernel> ActiveKernel(SIMDKernelNEON);
+  static std::atomic<SumFunction> ActiveSum(SumNEON);
+  static std::atomic<DotProductFunction> ActiveDotProduct(DotProductNEON);
+  static std::atomic<ComplexMultiplyAccumulateFunction> ActiveComplexMultiplyAccumulate(ComplexMultiplyAccumulateNEON);
+  static std::atomic<ComplexMultiplyAccumulateSegmentsFunction> ActiveComplexMultiplyAccumulateSegments(ComplexMultiplyAccumulateSegmentsNEON);
+#else
+  static std::atomic<SIMDKernel> ActiveKernel(SIMDKernelScalar);
+  static std::atomic<SumFunction> ActiveSum(SumScalar);
+  static std::atomic<DotProductFunction> ActiveDotProduct(DotProductScalar);
+  static std::atomic<ComplexMultiplyAccumulateFunction> ActiveComplexMultiplyAccumulate(ComplexMultiplyAccumulateScalar);
+  static std::atomic<ComplexMultiplyAccumulateSegmentsFunction> ActiveComplexMultiplyAccumulateSegments(ComplexMultiplyAccumulateSegmentsScalar);
 #endif
+
+
+static void SelectSIMDKernel()
+{
+#if defined(FFTCONVOLVER_USE_AVX)
+  if (CPUSupportsAVX512())
+  {
+    ActiveSum.store(SumAVX512);
+    ActiveDotProduct.store(DotProductAVX512);
+    ActiveComplexMultiplyAccumulate.store(ComplexMultiplyAccumulateAVX512);
+    ActiveComplexMultiplyAccumulateSegments.store(ComplexMultiplyAccumulateSegmentsAVX512);
+    ActiveKernel.store(SIMDKernelAVX512);
+  }
+  else if (CPUSupportsAVX2())
+  {
+    ActiveSum.store(SumAVX2);
+    ActiveDotProduct.store(DotProductAVX2);
+    ActiveComplexMultiplyAccumulate.store(ComplexMultiplyAccumulateAVX2);
+    ActiveComplexMultiplyAccumulateSegments.store(ComplexMultiplyAccumulateSegmentsAVX2);
+    ActiveKernel.store(SIMDKernelAVX2);
+  }
+#endif
+}
+
+
+void InitSIMDKernel()
+{
+  static std::once_flag selected;
+  std::call_once(selected, SelectSIMDKernel);
+}
+
+
+SIMDKernel ActiveSIMDKernel()
+{
+  InitSIMDKernel();
+  return ActiveKernel.load();
+}
+
+
+const char* SIMDKernelName(SIMDKernel kernel)
+{
+  switch (kernel)
+  {
+    case SIMDKernelSSE: return "SSE";
+    case SIMDKernelAVX2: return "AVX2/FMA";
+    case SIMDKernelAVX512: return "AVX-512";
+    case SIMDKernelNEON: return "NEON";
+    case SIMDKernelScalar: break;
+  }
+  return "None";
+}
+
+
+bool SSEEnabled()
+{
+  const SIMDKernel kernel = ActiveSIMDKernel();
+  return (kernel == SIMDKernelSSE || kernel == SIMDKernelAVX2 || kernel == SIMDKernelAVX512);
+}
+
+
+void Sum(Sample* FFTCONVOLVER_RESTRICT result,
+         const Sample* FFTCONVOLVER_RESTRICT a,
+         const Sample* FFTCONVOLVER_RESTRICT b,
+         size_t len)
+{
+  ActiveSum.load(std::memory_order_relaxed)(result, a, b, len);
+}
+
+
+Sample DotProduct(const Sample* a, const Sample* b, size_t len)
+{
+  return ActiveDotProduct.load(std::memory_order_relaxed)(a, b, len);
+}
+
+
+bool IsSilent(const Sample* data, size_t len)
+{
+  for (size_t i=0; i<len; ++i)
+  {
+    if (!(::fabs(data[i]) <= SilenceThreshold))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+void ComplexMultiplyAccumulate(SplitComplex& result, const SplitComplex& a, const SplitComplex& b)
+{
+  assert(result.size() == a.size());
+  assert(result.size() == b.size());
+  ComplexMultiplyAccumulate(result.re(), result.im(), a.re(), a.im(), b.re(), b.im(), result.size());
+}
+
+
+void ComplexMultiplyAccumulate(Sample* FFTCONVOLVER_RESTRICT re,
+                               Sample* FFTCONVOLVER_RESTRICT im,
+                               const Sample* FFTCONVOLVER_RESTRICT reA,
+                               const Sample* FFTCONVOLVER_RESTRICT imA,
+                               const Sample* FFTCONVOLVER_RESTRICT reB,
+                               const Sample* FFTCONVOLVER_RESTRICT imB,
+                               const size_t len)
+{
+  ActiveComplexMultiplyAccumulate.load(std::memory_order_relaxed)(re, im, reA, imA, reB, imB, len);
+}
+
+
+void ComplexMultiplyAccumulate(Sample* FFTCONVOLVER_RESTRICT re,
+                               Sample* FFTCONVOLVER_RESTRICT im,
+                               const Sample* reA,
+                               const Sample* imA,
+                               size_t strideA,
+                               const Sample* reB,
+                               const Sample* imB,
+                               size_t strideB,
+                               size_t count,
+                               const size_t len)
+{
+  if (count > 0)
+  {
+    ActiveComplexMultiplyAccumulateSegments.load(std::memory_order_relaxed)(re, im, reA, imA, strideA, reB, imB, strideB, count, len);
+  }
 }
 
 } // End of namespace fftconvolver
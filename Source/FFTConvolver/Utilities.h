@@ -25,9 +25,6 @@
 #include <new>
 
 
-namespace fftconvolver
-{
-
 #if defined(__SSE__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
   #if !defined(FFTCONVOLVER_USE_SSE) && !defined(FFTCONVOLVER_DONT_USE_SSE)
     #define FFTCONVOLVER_USE_SSE
@@ -40,6 +37,10 @@ namespace fftconvolver
 #endif
 
 
+namespace fftconvolver
+{
+
+
 #if defined(__GNUC__)
   #define FFTCONVOLVER_RESTRICT __restrict__
 #else
@@ -48,15 +49,149 @@ namespace fftconvolver
 
 
 /**
-* @brief Returns whether SSE optimization for the convolver is enabled
+* @brief SIMD kernels available for the inner loops of the convolver
+*/
+enum SIMDKernel
+{
+  SIMDKernelScalar,
+  SIMDKernelSSE,
+  SIMDKernelAVX2,
+  SIMDKernelAVX512,
+  SIMDKernelNEON
+};
+
+
+/**
+* @brief Selects the fastest SIMD kernel supported by the CPU
+*
+* The detection (CPUID on x86) runs only once, subsequent calls return immediately.
+* The convolvers call this during their initialization, so usually there's no need
+* to call it explicitly.
+*/
+void InitSIMDKernel();
+
+
+/**
+* @brief Returns the SIMD kernel which is used by the convolver
+* @return The active SIMD kernel
+*/
+SIMDKernel ActiveSIMDKernel();
+
+
+/**
+* @brief Returns a human-readable name of a SIMD kernel
+* @param kernel The SIMD kernel
+* @return The name (e.g. "AVX2/FMA")
+*/
+const char* SIMDKernelName(SIMDKernel kernel);
+
+
+/**
+* @brief Returns whether SSE (or any wider x86 SIMD) optimization for the convolver is active
 * @return true: Enabled - false: Disabled
 */
 bool SSEEnabled();
 
 
+/**
+* @brief Alignment of buffers in bytes (one cache line)
+*/
+const size_t BufferAlignment = 64;
+
+
+/**
+* @brief Rounds up a number of elements so that arrays placed back to back keep the buffer alignment
+* @param count The number of elements
+* @return The aligned number of elements
+*/
+template<typename T>
+size_t AlignedSize(size_t count)
+{
+  const size_t elementsPerAlignment = BufferAlignment / sizeof(T);
+  return ((count + elementsPerAlignment - 1) / elementsPerAlignment) * elementsPerAlignment;
+}
+
+
+/**
+* @class Arena
+* @brief One block of memory holding several buffers back to back
+*
+* The sizes of all buffers of a convolver are known at its initialization, so
+* instead of allocating each buffer separately, the convolver sums up their
+* sizes, allocates a single block and attaches the buffers to it (see
+* Buffer::attach()). Clearing the arena frees all of them at once.
+*
+* Each buffer starts at a cache line boundary. Large blocks are aligned to
+* huge page boundaries (and advised to use huge pages where supported). The
+* memory of a buffer is only touched when the buffer is taken.
+*/
+class Arena
+{
+public:
+  Arena();
+  ~Arena();
+
+  /**
+  * @brief Returns the number of bytes a buffer occupies in an arena
+  * @param count The number of elements of the buffer
+  * @return The number of bytes (including the padding for the alignment)
+  */
+  template<typename T>
+  static size_t Bytes(size_t count)
+  {
+    return AlignedSize<T>(count) * sizeof(T);
+  }
+
+  /**
+  * @brief Allocates a new block of memory (the previous one is freed)
+  * @param bytes Size of the block (the sum of the sizes returned by Bytes())
+  */
+  void allocate(size_t bytes);
+
+  /**
+  * @brief Frees the block of memory
+  */
+  void clear();
+
+  /**
+  * @brief Takes the next portion of the block
+  * @param count Number of elements
+  * @return The zeroed elements
+  */
+  template<typename T>
+  T* take(size_t count)
+  {
+    const size_t bytes = Bytes<T>(count);
+    assert(_used + bytes <= _size);
+    T* data = reinterpret_cast<T*>(_memory + _used);
+    ::memset(data, 0, bytes);
+    _used += bytes;
+    return data;
+  }
+
+  /**
+  * @brief Returns the size of the block
+  * @return The size in bytes
+  */
+  size_t size() const;
+
+private:
+  char* _memory;
+  size_t _size;
+  size_t _used;
+
+  // Prevent uncontrolled usage
+  Arena(const Arena&);
+  Arena& operator=(const Arena&);
+};
+
+
 /**
 * @class Buffer
-* @brief Simple buffer implementation (uses 16-byte alignment if SSE optimization is enabled)
+* @brief Simple buffer implementation (uses cache line alignment if SSE optimization is enabled)
+*
+* The buffer either owns its memory (see resize()) or uses a portion of an
+* arena (see attach()).
 */
 template<typename T>
 class Buffer
@@ -64,7 +199,8 @@ class Buffer
 public:  
   explicit Buffer(size_t initialSize = 0) :
     _data(0),
-    _size(0)
+    _size(0),
+    _owner(false)
   {
     resize(initialSize);
   }
@@ -76,14 +212,18 @@ public:
 
   void clear()
   {
-    deallocate(_data);
+    if (_owner)
+    {
+      deallocate(_data);
+    }
     _data = 0;
     _size = 0;
+    _owner = false;
   }
 
   void resize(size_t size)
   {
-    if (_size != size)
+    if (_size != size || !_owner)
     {
       clear();
 
@@ -92,11 +232,22 @@ public:
         assert(!_data && _size == 0);
         _data = allocate(size);
         _size = size;
+        _owner = true;
       }
     }
     setZero();
   }
 
+  void attach(Arena& arena, size_t size)
+  {
+    clear();
+    if (size > 0)
+    {
+      _data = arena.template take<T>(size);
+      _size = size;
+    }
+  }
+
   size_t size() const
   {
     return _size;
@@ -104,7 +255,10 @@ public:
 
   void setZero()
   {
-    ::memset(_data, 0, _size * sizeof(T));
+    if (_size > 0)
+    {
+      ::memset(_data, 0, _size * sizeof(T));
+    }
   }
 
   void copyFrom(const Buffer<T>& other)
@@ -147,13 +301,14 @@ public:
   {
     std::swap(a._data, b._data);
     std::swap(a._size, b._size);
+    std::swap(a._owner, b._owner);
   }
 
 private:
   T* allocate(size_t size)
   {
 #if defined(FFTCONVOLVER_USE_SSE)
-    return static_cast<T*>(_mm_malloc(size * sizeof(T), 16));
+    return static_cast<T*>(_mm_malloc(size * sizeof(T), BufferAlignment));
 #else
     return new T[size];
 #endif
@@ -170,6 +325,7 @@ private:
 
   T* _data;
   size_t _size;
+  bool _owner;
 
   // Prevent uncontrolled usage
   Buffer(const Buffer&);
@@ -227,6 +383,13 @@ public:
     _size = newSize;
   }
 
+  void attach(Arena& arena, size_t newSize)
+  {
+    _re.attach(arena, newSize);
+    _im.attach(arena, newSize);
+    _size = newSize;
+  }
+
   void setZero()
   {
     _re.setZero();
@@ -305,6 +468,25 @@ void Sum(Sample* FFTCONVOLVER_RESTRICT result,
          size_t len);
 
 
+/**
+* @brief Calculates the dot product of two given sample arrays
+* @param a The 1st array
+* @param b The 2nd array
+* @param len The length of the arrays
+* @return The sum of the products of all pairs of samples
+*/
+Sample DotProduct(const Sample* a, const Sample* b, size_t len);
+
+
+/**
+* @brief Checks whether a given sample array is silent
+* @param data The array
+* @param len The length of the array
+* @return true: All samples are below -120 dB (e.g. zero, denormals or dither) - false: Otherwise
+*/
+bool IsSilent(const Sample* data, size_t len);
+
+
 /**
 * @brief Copies a source array into a destination buffer and pads the destination buffer with zeros
 * @param dest The destination buffer
@@ -345,6 +527,36 @@ void ComplexMultiplyAccumulate(Sample* FFTCONVOLVER_RESTRICT re,
                                const Sample* FFTCONVOLVER_RESTRICT reB,
                                const Sample* FFTCONVOLVER_RESTRICT imB,
                                const size_t len);
+
+
+/**
+* @brief Adds the sum of the complex products of several pairs of split-complex arrays to a result array
+*
+* This is the fused version of calling ComplexMultiplyAccumulate() once per pair: The
+* pairs are walked for one cache line sized stripe of bins at a time while the
+* accumulator stays in registers, so the result is loaded and stored only once.
+*
+* @param re The real part of the result buffer
+* @param im The imaginary part of the result buffer
+* @param reA The real part of the 1st factor of the 1st pair
+* @param imA The imaginary part of the 1st factor of the 1st pair
+* @param strideA Distance in samples between the 1st factors of consecutive pairs
+* @param reB The real part of the 2nd factor of the 1st pair
+* @param imB The imaginary part of the 2nd factor of the 1st pair
+* @param strideB Distance in samples between the 2nd factors of consecutive pairs
+* @param count Number of pairs
+* @param len Length of each array
+*/
+void ComplexMultiplyAccumulate(Sample* FFTCONVOLVER_RESTRICT re, 
+                               Sample* FFTCONVOLVER_RESTRICT im,
+                               const Sample* reA,
+                               const Sample* imA,
+                               size_t strideA,
+                               const Sample* reB,
+                               const Sample* imB,
+                               size_t strideB,
+                               size_t count,
+                               const size_t len);
   
 } // End of namespace fftconvolver
 
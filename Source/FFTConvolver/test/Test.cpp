@@ -18,6 +18,7 @@
 #include <algorithm>
 #include <cstring>
 #include <numeric>
+#include <thread>
 #include <vector>
 
 #include <cmath>
@@ -25,6 +26,8 @@
 #include <cstdlib>
 
 #include "../FFTConvolver.h"
+#include "../MultiStageFFTConvolver.h"
+#include "../Resampler.h"
 #include "../TwoStageFFTConvolver.h"
 #include "../Utilities.h"
 
@@ -243,15 +246,834 @@ static bool TestTwoStageConvolver(size_t inputSize,
 }
 
 
+static bool TestMultiStageConvolver(size_t inputSize,
+                                    size_t irSize,
+                                    size_t blockSizeMin,
+                                    size_t blockSizeMax,
+                                    size_t blockSizeHead,
+                                    size_t blockSizeMaxStage,
+                                    size_t maxLatency,
+                                    bool refCheck)
+{
+  // Prepare input and IR
+  std::vector<fftconvolver::Sample> in(inputSize);
+  for (size_t i=0; i<inputSize; ++i)
+  {
+    in[i] = 0.1f * static_cast<fftconvolver::Sample>(i+1);
+  }
+
+  std::vector<fftconvolver::Sample> ir(irSize);
+  for (size_t i=0; i<irSize; ++i)
+  {
+    ir[i] = 0.1f * static_cast<fftconvolver::Sample>(i+1);
+  }
+  
+  // Simple convolver
+  std::vector<fftconvolver::Sample> outSimple(in.size() + ir.size() - 1, fftconvolver::Sample(0.0));
+  if (refCheck)
+  {
+    SimpleConvolve(&in[0], in.size(), &ir[0], ir.size(), &outSimple[0]);
+  }
+  
+  // FFT convolver (output delayed by its latency)
+  std::vector<fftconvolver::Sample> out(in.size() + ir.size() - 1 + maxLatency, fftconvolver::Sample(0.0));
+  size_t latency = 0;
+  {
+    fftconvolver::MultiStageFFTConvolver convolver;
+    convolver.init(blockSizeHead, blockSizeMaxStage, &ir[0], ir.size(), maxLatency);
+    latency = convolver.getLatency();
+    std::vector<fftconvolver::Sample> inBuf(blockSizeMax);
+    size_t processedOut = 0;
+    size_t processedIn = 0;
+    while (processedOut < out.size())
+    {
+      const size_t blockSize = blockSizeMin + (static_cast<size_t>(rand()) % (1+(blockSizeMax-blockSizeMin))); 
+      
+      const size_t remainingOut = out.size() - processedOut;
+      const size_t remainingIn = in.size() - processedIn;
+      
+      const size_t processingOut = std::min(remainingOut, blockSize);
+      const size_t processingIn = std::min(remainingIn, blockSize);
+      
+      memset(&inBuf[0], 0, inBuf.size() * sizeof(fftconvolver::Sample));
+      if (processingIn > 0)
+      {
+        memcpy(&inBuf[0], &in[processedIn], processingIn * sizeof(fftconvolver::Sample));
+      }
+      
+      convolver.process(&inBuf[0], &out[processedOut], processingOut);
+      
+      processedOut += processingOut;
+      processedIn += processingIn;
+    }
+  }
+  
+  if (refCheck)
+  {
+    size_t diffSamples = (latency == fftconvolver::MultiStageFFTConvolver::CalculateLatency(blockSizeHead, maxLatency)) ? 0 : 1;
+    const double absTolerance = 0.001 * static_cast<double>(ir.size());
+    const double relTolerance = 0.0001 * ::log(static_cast<double>(ir.size()));   
+    for (size_t i=0; i<outSimple.size(); ++i)
+    {      
+      const double a = static_cast<double>(out[i+latency]);
+      const double b = static_cast<double>(outSimple[i]);
+      if (::fabs(a) > 1.0 && ::fabs(b) > 1.0)
+      {
+        const double absError = ::fabs(a-b);
+        const double relError = absError / b;
+        if (relError > relTolerance && absError > absTolerance)
+        {
+          ++diffSamples;
+        }
+      }
+    }
+    printf("Correctness Test (multi-stage, input %d, IR %d, blocksize %d-%d, latency %d) => %s\n", static_cast<int>(inputSize), static_cast<int>(irSize), static_cast<int>(blockSizeMin), static_cast<int>(blockSizeMax), static_cast<int>(latency), (diffSamples == 0) ? "[OK]" : "[FAILED]");
+    return (diffSamples == 0);
+  }
+  else
+  {
+    printf("Performance Test (multi-stage, input %d, IR %d, blocksize %d-%d) => Completed\n", static_cast<int>(inputSize), static_cast<int>(irSize), static_cast<int>(blockSizeMin), static_cast<int>(blockSizeMax));
+    return true;
+  }
+}
+
+
+static bool TestSharedPartitionedIR(size_t inputSize, size_t irSize, size_t blockSize)
+{
+  // Prepare input and IR
+  std::vector<fftconvolver::Sample> in(inputSize);
+  for (size_t i=0; i<inputSize; ++i)
+  {
+    in[i] = 0.1f * static_cast<fftconvolver::Sample>(i+1);
+  }
+
+  std::vector<fftconvolver::Sample> ir(irSize);
+  for (size_t i=0; i<irSize; ++i)
+  {
+    ir[i] = 0.1f * static_cast<fftconvolver::Sample>(i+1);
+  }
+
+  // Convolver with its own impulse response
+  std::vector<fftconvolver::Sample> outOwn(in.size());
+  {
+    fftconvolver::FFTConvolver convolver;
+    convolver.init(blockSize, &ir[0], ir.size());
+    convolver.process(&in[0], &outOwn[0], in.size());
+  }
+
+  // Two convolvers sharing one partitioned impulse response must behave like independent ones
+  std::vector<fftconvolver::Sample> outShared1(in.size());
+  std::vector<fftconvolver::Sample> outShared2(in.size());
+  {
+    std::shared_ptr<const fftconvolver::PartitionedIR> partitionedIR = fftconvolver::PartitionedIR::Create(blockSize, &ir[0], ir.size());
+    fftconvolver::FFTConvolver convolver1;
+    fftconvolver::FFTConvolver convolver2;
+    convolver1.init(partitionedIR);
+    convolver2.init(partitionedIR);
+    partitionedIR.reset();
+    convolver1.process(&in[0], &outShared1[0], in.size() / 2);
+    convolver2.process(&in[0], &outShared2[0], in.size());
+    convolver1.process(&in[in.size() / 2], &outShared1[in.size() / 2], in.size() - (in.size() / 2));
+  }
+
+  size_t diffSamples = 0;
+  for (size_t i=0; i<in.size(); ++i)
+  {
+    if (::fabs(outOwn[i] - outShared2[i]) > 0.0f || ::fabs(outShared1[i] - outShared2[i]) > 0.001f * ::fabs(outShared2[i]))
+    {
+      ++diffSamples;
+    }
+  }
+  printf("Correctness Test (shared IR, input %d, IR %d, blocksize %d) => %s\n", static_cast<int>(inputSize), static_cast<int>(irSize), static_cast<int>(blockSize), (diffSamples == 0) ? "[OK]" : "[FAILED]");
+  return (diffSamples == 0);
+}
+
+
+static bool TestChunkedPartitionedIR(size_t irSize, size_t blockSize)
+{
+  std::vector<fftconvolver::Sample> ir(irSize);
+  for (size_t i=0; i<irSize; ++i)
+  {
+    ir[i] = ::sin(0.01f * static_cast<fftconvolver::Sample>(i)) / static_cast<fftconvolver::Sample>(1+i/1000);
+  }
+
+  // The chunks are run concurrently in reverse order, which must make no difference
+  size_t chunks = 0;
+  fftconvolver::PartitionedIR::ChunkRunner runChunks = [&](size_t chunkCount, const std::function<void(size_t)>& prepareChunk)
+  {
+    chunks = chunkCount;
+    std::vector<std::thread> threads;
+    for (size_t c=chunkCount; c>0; --c)
+    {
+      threads.push_back(std::thread(prepareChunk, c-1));
+    }
+    for (size_t t=0; t<threads.size(); ++t)
+    {
+      threads[t].join();
+    }
+  };
+  std::shared_ptr<const fftconvolver::PartitionedIR> sequential = fftconvolver::PartitionedIR::Create(blockSize, &ir[0], ir.size(), 0.5f);
+  std::shared_ptr<const fftconvolver::PartitionedIR> chunked = fftconvolver::PartitionedIR::Create(blockSize, &ir[0], ir.size(), 0.5f, runChunks);
+
+  size_t diffSegments = 0;
+  const size_t complexSize = audiofft::AudioFFT::ComplexSize(2 * sequential->getBlockSize());
+  for (size_t i=0; i<sequential->getSegmentCount(); ++i)
+  {
+    if (::memcmp(sequential->segmentRe(i), chunked->segmentRe(i), complexSize * sizeof(fftconvolver::Sample)) != 0 ||
+        ::memcmp(sequential->segmentIm(i), chunked->segmentIm(i), complexSize * sizeof(fftconvolver::Sample)) != 0 ||
+        sequential->getSegmentEnergy(i) != chunked->getSegmentEnergy(i))
+    {
+      ++diffSegments;
+    }
+  }
+  const bool ok = (chunks > 1 && chunked->getSegmentCount() == sequential->getSegmentCount() && diffSegments == 0);
+  printf("Correctness Test (chunked IR, IR %d, blocksize %d, chunks %d) => %s\n", static_cast<int>(irSize), static_cast<int>(blockSize), static_cast<int>(chunks), ok ? "[OK]" : "[FAILED]");
+  return ok;
+}
+
+
+static bool TestConvolverGain(size_t inputSize, size_t irSize, size_t blockSize, fftconvolver::Sample gain)
+{
+  // Prepare input and IR
+  std::vector<fftconvolver::Sample> in(inputSize);
+  for (size_t i=0; i<inputSize; ++i)
+  {
+    in[i] = 0.1f * static_cast<fftconvolver::Sample>(i+1);
+  }
+
+  std::vector<fftconvolver::Sample> ir(irSize);
+  for (size_t i=0; i<irSize; ++i)
+  {
+    ir[i] = 0.1f * static_cast<fftconvolver::Sample>(i+1);
+  }
+
+  // Reference: Unity gain convolver, scaled afterwards
+  std::vector<fftconvolver::Sample> outRef(in.size());
+  {
+    fftconvolver::FFTConvolver convolver;
+    convolver.init(blockSize, &ir[0], ir.size());
+    convolver.process(&in[0], &outRef[0], in.size());
+  }
+
+  // Gain folded into the impulse response
+  std::vector<fftconvolver::Sample> out(in.size());
+  {
+    fftconvolver::FFTConvolver convolver;
+    convolver.init(blockSize, &ir[0], ir.size(), gain);
+    convolver.process(&in[0], &out[0], in.size());
+  }
+
+  // Same for the multi-stage convolver (including its direct head)
+  std::vector<fftconvolver::Sample> outMultiStageRef(in.size());
+  std::vector<fftconvolver::Sample> outMultiStage(in.size());
+  {
+    fftconvolver::MultiStageFFTConvolver convolverRef;
+    convolverRef.init(64, 4 * blockSize, &ir[0], ir.size());
+    convolverRef.process(&in[0], &outMultiStageRef[0], in.size());
+    fftconvolver::MultiStageFFTConvolver convolver;
+    convolver.setGain(gain);
+    convolver.init(64, 4 * blockSize, &ir[0], ir.size());
+    convolver.process(&in[0], &outMultiStage[0], in.size());
+  }
+
+  // FFT rounding errors are relative to the largest output sample
+  fftconvolver::Sample maxMagnitude = 0.0f;
+  for (size_t i=0; i<in.size(); ++i)
+  {
+    maxMagnitude = std::max(maxMagnitude, static_cast<fftconvolver::Sample>(::fabs(gain * outRef[i])));
+  }
+  size_t diffSamples = 0;
+  for (size_t i=0; i<in.size(); ++i)
+  {
+    if (::fabs(out[i] - gain * outRef[i]) > 0.00001f * maxMagnitude ||
+        ::fabs(outMultiStage[i] - gain * outMultiStageRef[i]) > 0.00001f * maxMagnitude)
+    {
+      ++diffSamples;
+    }
+  }
+  printf("Correctness Test (gain %.3f, input %d, IR %d, blocksize %d) => %s\n", static_cast<double>(gain), static_cast<int>(inputSize), static_cast<int>(irSize), static_cast<int>(blockSize), (diffSamples == 0) ? "[OK]" : "[FAILED]");
+  return (diffSamples == 0);
+}
+
+
+static bool TestBufferedConvolver(size_t inputSize, size_t irSize, size_t blockSizeMin, size_t blockSizeMax, size_t blockSizeConvolver)
+{
+  // Prepare input and IR
+  std::vector<fftconvolver::Sample> in(inputSize + blockSizeConvolver, fftconvolver::Sample(0.0));
+  for (size_t i=0; i<inputSize; ++i)
+  {
+    in[i] = 0.1f * static_cast<fftconvolver::Sample>(i+1);
+  }
+
+  std::vector<fftconvolver::Sample> ir(irSize);
+  for (size_t i=0; i<irSize; ++i)
+  {
+    ir[i] = 0.1f * static_cast<fftconvolver::Sample>(i+1);
+  }
+
+  // Unbuffered convolver
+  std::vector<fftconvolver::Sample> outUnbuffered(in.size());
+  {
+    fftconvolver::FFTConvolver convolver;
+    convolver.init(blockSizeConvolver, &ir[0], ir.size());
+    convolver.process(&in[0], &outUnbuffered[0], in.size());
+  }
+
+  // Buffered convolver: Same result, but delayed by its latency
+  std::vector<fftconvolver::Sample> outBuffered(in.size());
+  size_t latency = 0;
+  {
+    fftconvolver::FFTConvolver convolver;
+    convolver.init(fftconvolver::PartitionedIR::Create(blockSizeConvolver, &ir[0], ir.size()), true);
+    latency = convolver.getLatency();
+    size_t processed = 0;
+    while (processed < in.size())
+    {
+      const size_t blockSize = blockSizeMin + (static_cast<size_t>(rand()) % (1+(blockSizeMax-blockSizeMin)));
+      const size_t processing = std::min(in.size() - processed, blockSize);
+      convolver.process(&in[processed], &outBuffered[processed], processing);
+      processed += processing;
+    }
+  }
+
+  size_t diffSamples = (latency == blockSizeConvolver) ? 0 : 1;
+  for (size_t i=0; i<latency; ++i)
+  {
+    if (outBuffered[i] != 0.0f)
+    {
+      ++diffSamples;
+    }
+  }
+  for (size_t i=latency; i<in.size(); ++i)
+  {
+    if (::fabs(outBuffered[i] - outUnbuffered[i-latency]) > 0.001f * ::fabs(outUnbuffered[i-latency]))
+    {
+      ++diffSamples;
+    }
+  }
+  printf("Correctness Test (buffered, input %d, IR %d, blocksizes %d-%d, blocksize %d) => %s\n", static_cast<int>(inputSize), static_cast<int>(irSize), static_cast<int>(blockSizeMin), static_cast<int>(blockSizeMax), static_cast<int>(blockSizeConvolver), (diffSamples == 0) ? "[OK]" : "[FAILED]");
+  return (diffSamples == 0);
+}
+
+
+static bool TestMultiOutputConvolver(size_t inputSize, size_t irSize, size_t blockSizeMin, size_t blockSizeMax, size_t blockSizeHead, size_t maxLatency)
+{
+  // Prepare input and IRs: Outputs with different IR lengths, one of them silent
+  std::vector<fftconvolver::Sample> in(inputSize);
+  for (size_t i=0; i<inputSize; ++i)
+  {
+    in[i] = 0.1f * static_cast<fftconvolver::Sample>(i+1);
+  }
+
+  const size_t outputCount = 3;
+  std::vector<std::vector<fftconvolver::Sample> > irs(outputCount);
+  irs[0].resize(irSize);
+  irs[1].resize(irSize / 3 + 1);
+  for (size_t i=0; i<irs[0].size(); ++i)
+  {
+    irs[0][i] = 0.1f * static_cast<fftconvolver::Sample>(i+1);
+  }
+  for (size_t i=0; i<irs[1].size(); ++i)
+  {
+    irs[1][i] = 0.1f * static_cast<fftconvolver::Sample>((i*7) % 13) - 0.5f;
+  }
+  std::vector<const fftconvolver::Sample*> irPointers(outputCount, nullptr);
+  std::vector<size_t> irLens(outputCount, 0);
+  for (size_t o=0; o<outputCount; ++o)
+  {
+    irPointers[o] = irs[o].empty() ? nullptr : &irs[o][0];
+    irLens[o] = irs[o].size();
+  }
+
+  // Reference: One convolver per output
+  std::vector<std::vector<fftconvolver::Sample> > outRef(outputCount, std::vector<fftconvolver::Sample>(in.size()));
+  for (size_t o=0; o<outputCount; ++o)
+  {
+    fftconvolver::MultiStageFFTConvolver convolver;
+    convolver.init(blockSizeHead, 16384, irPointers[o], irLens[o], maxLatency);
+    convolver.process(&in[0], &outRef[o][0], in.size());
+  }
+
+  // One convolver for all outputs, processing blocks of random sizes
+  std::vector<std::vector<fftconvolver::Sample> > out(outputCount, std::vector<fftconvolver::Sample>(in.size()));
+  size_t latency = 0;
+  {
+    fftconvolver::MultiStageFFTConvolver convolver;
+    convolver.init(blockSizeHead, 16384, irPointers, irLens, maxLatency);
+    latency = convolver.getLatency();
+    std::vector<fftconvolver::Sample*> outputs(outputCount, nullptr);
+    size_t processed = 0;
+    while (processed < in.size())
+    {
+      const size_t blockSize = blockSizeMin + (static_cast<size_t>(rand()) % (1+(blockSizeMax-blockSizeMin)));
+      const size_t processing = std::min(in.size() - processed, blockSize);
+      for (size_t o=0; o<outputCount; ++o)
+      {
+        outputs[o] = &out[o][processed];
+      }
+      convolver.process(&in[processed], &outputs[0], processing);
+      processed += processing;
+    }
+  }
+
+  // FFT rounding errors are relative to the largest output sample (the partitioning
+  // of the reference convolvers may differ)
+  size_t diffSamples = (latency == fftconvolver::MultiStageFFTConvolver::CalculateLatency(blockSizeHead, maxLatency)) ? 0 : 1;
+  for (size_t o=0; o<outputCount; ++o)
+  {
+    fftconvolver::Sample maxMagnitude = 0.0f;
+    for (size_t i=0; i<in.size(); ++i)
+    {
+      maxMagnitude = std::max(maxMagnitude, static_cast<fftconvolver::Sample>(::fabs(outRef[o][i])));
+    }
+    for (size_t i=0; i<in.size(); ++i)
+    {
+      if (::fabs(out[o][i] - outRef[o][i]) > 0.00001f * maxMagnitude)
+      {
+        ++diffSamples;
+      }
+    }
+  }
+  printf("Correctness Test (multi-output, input %d, IR %d, blocksize %d-%d, latency %d) => %s\n", static_cast<int>(inputSize), static_cast<int>(irSize), static_cast<int>(blockSizeMin), static_cast<int>(blockSizeMax), static_cast<int>(latency), (diffSamples == 0) ? "[OK]" : "[FAILED]");
+  return (diffSamples == 0);
+}
+
+
+static bool TestMatrixConvolver(size_t inputSize, size_t irSize, size_t blockSizeMin, size_t blockSizeMax, size_t blockSizeHead, size_t maxLatency)
+{
+  // Prepare inputs and IRs: 3 inputs x 3 outputs with different IR lengths, one connection
+  // missing, and the middle input and output not connected at all
+  const size_t inputCount = 3;
+  const size_t outputCount = 3;
+  std::vector<std::vector<fftconvolver::Sample> > in(inputCount, std::vector<fftconvolver::Sample>(inputSize));
+  for (size_t i=0; i<inputSize; ++i)
+  {
+    in[0][i] = 0.1f * static_cast<fftconvolver::Sample>(i+1);
+    in[1][i] = 1000.0f;
+    in[2][i] = 0.1f * static_cast<fftconvolver::Sample>((i*5) % 11) - 0.5f;
+  }
+
+  std::vector<std::vector<fftconvolver::Sample> > irs(inputCount * outputCount);
+  irs[0].resize(irSize);
+  irs[2].resize(irSize / 3 + 1);
+  irs[8].resize(irSize / 2 + 7);
+  for (size_t n=0; n<irs.size(); ++n)
+  {
+    for (size_t i=0; i<irs[n].size(); ++i)
+    {
+      irs[n][i] = 0.1f * static_cast<fftconvolver::Sample>((i*(2*n+3)) % 17);
+    }
+  }
+  std::vector<const fftconvolver::Sample*> irPointers(irs.size(), nullptr);
+  std::vector<size_t> irLens(irs.size(), 0);
+  for (size_t n=0; n<irs.size(); ++n)
+  {
+    irPointers[n] = irs[n].empty() ? nullptr : &irs[n][0];
+    irLens[n] = irs[n].size();
+  }
+
+  // Reference: One convolver per connection, summed up per output
+  std::vector<std::vector<fftconvolver::Sample> > outRef(outputCount, std::vector<fftconvolver::Sample>(inputSize, 0.0f));
+  std::vector<fftconvolver::Sample> tmp(inputSize);
+  for (size_t n=0; n<irs.size(); ++n)
+  {
+    fftconvolver::MultiStageFFTConvolver convolver;
+    convolver.init(blockSizeHead, 16384, irPointers[n], irLens[n], maxLatency);
+    convolver.process(&in[n / outputCount][0], &tmp[0], inputSize);
+    for (size_t i=0; i<inputSize; ++i)
+    {
+      outRef[n % outputCount][i] += tmp[i];
+    }
+  }
+
+  // One convolver for the whole matrix, processing blocks of random sizes
+  std::vector<std::vector<fftconvolver::Sample> > out(outputCount, std::vector<fftconvolver::Sample>(inputSize, 1.0f));
+  size_t latency = 0;
+  {
+    fftconvolver::MultiStageFFTConvolver convolver;
+    convolver.init(blockSizeHead, 16384, inputCount, irPointers, irLens, maxLatency);
+    latency = convolver.getLatency();
+    std::vector<const fftconvolver::Sample*> inputs(inputCount, nullptr);
+    std::vector<fftconvolver::Sample*> outputs(outputCount, nullptr);
+    size_t processed = 0;
+    while (processed < inputSize)
+    {
+      const size_t blockSize = blockSizeMin + (static_cast<size_t>(rand()) % (1+(blockSizeMax-blockSizeMin)));
+      const size_t processing = std::min(inputSize - processed, blockSize);
+      for (size_t n=0; n<inputCount; ++n)
+      {
+        inputs[n] = &in[n][processed];
+      }
+      for (size_t o=0; o<outputCount; ++o)
+      {
+        outputs[o] = &out[o][processed];
+      }
+      convolver.process(&inputs[0], &outputs[0], processing);
+      processed += processing;
+    }
+  }
+
+  // FFT rounding errors are relative to the largest output sample
+  size_t diffSamples = (latency == fftconvolver::MultiStageFFTConvolver::CalculateLatency(blockSizeHead, maxLatency)) ? 0 : 1;
+  for (size_t o=0; o<outputCount; ++o)
+  {
+    fftconvolver::Sample maxMagnitude = 0.0f;
+    for (size_t i=0; i<inputSize; ++i)
+    {
+      maxMagnitude = std::max(maxMagnitude, static_cast<fftconvolver::Sample>(::fabs(outRef[o][i])));
+    }
+    for (size_t i=0; i<inputSize; ++i)
+    {
+      if (::fabs(out[o][i] - outRef[o][i]) > 0.00001f * maxMagnitude)
+      {
+        ++diffSamples;
+      }
+    }
+  }
+  printf("Correctness Test (matrix 3x3, input %d, IR %d, blocksize %d-%d, latency %d) => %s\n", static_cast<int>(inputSize), static_cast<int>(irSize), static_cast<int>(blockSizeMin), static_cast<int>(blockSizeMax), static_cast<int>(latency), (diffSamples == 0) ? "[OK]" : "[FAILED]");
+  return (diffSamples == 0);
+}
+
+
+static bool TestSilentInput(size_t irSize, size_t blockSizeMin, size_t blockSizeMax, size_t blockSizeHead, size_t maxLatency)
+{
+  // Prepare input and IR: Some bursts separated by silence longer than the IR, so
+  // the convolvers become idle (and pause completely) in between and have to wake up again.
+  // The silence isn't exactly zero but contains some residue far below -120 dB.
+  const size_t inputSize = 40000;
+  std::vector<fftconvolver::Sample> in(inputSize, 0.0f);
+  for (size_t i=0; i<inputSize; ++i)
+  {
+    in[i] = 1e-7f * static_cast<fftconvolver::Sample>(static_cast<int>((i*13) % 5) - 2);
+  }
+  for (size_t i=0; i<1000; ++i)
+  {
+    in[i] = 0.1f * static_cast<fftconvolver::Sample>((i*5) % 11);
+  }
+  for (size_t i=16000; i<16300; ++i)
+  {
+    in[i] = 0.1f * static_cast<fftconvolver::Sample>((i*3) % 7);
+  }
+  in[32000] = 1.0f;
+
+  std::vector<fftconvolver::Sample> ir(irSize);
+  for (size_t i=0; i<irSize; ++i)
+  {
+    ir[i] = 0.1f * static_cast<fftconvolver::Sample>((i*7) % 17);
+  }
+
+  std::vector<fftconvolver::Sample> outSimple(in.size() + ir.size() - 1, 0.0f);
+  SimpleConvolve(&in[0], in.size(), &ir[0], ir.size(), &outSimple[0]);
+  outSimple.resize(inputSize);
+  fftconvolver::Sample maxMagnitude = 0.0f;
+  for (size_t i=0; i<inputSize; ++i)
+  {
+    maxMagnitude = std::max(maxMagnitude, static_cast<fftconvolver::Sample>(::fabs(outSimple[i])));
+  }
+
+  // Uniformly partitioned and multi-stage convolver, processing blocks of random sizes
+  std::vector<fftconvolver::Sample> out(inputSize, 1.0f);
+  std::vector<fftconvolver::Sample> outMultiStage(inputSize, 1.0f);
+  size_t latency = 0;
+  bool idle = false;
+  {
+    fftconvolver::FFTConvolver convolver;
+    convolver.init(blockSizeHead, &ir[0], ir.size());
+    fftconvolver::MultiStageFFTConvolver multiStageConvolver;
+    multiStageConvolver.init(blockSizeHead, 1024, &ir[0], ir.size(), maxLatency);
+    latency = multiStageConvolver.getLatency();
+    size_t processed = 0;
+    while (processed < inputSize)
+    {
+      const size_t blockSize = blockSizeMin + (static_cast<size_t>(rand()) % (1+(blockSizeMax-blockSizeMin)));
+      const size_t processing = std::min(inputSize - processed, blockSize);
+      convolver.process(&in[processed], &out[processed], processing);
+      multiStageConvolver.process(&in[processed], &outMultiStage[processed], processing);
+      processed += processing;
+      if (processed >= 16300 + irSize + blockSizeHead && processed < 32000)
+      {
+        idle = idle || convolver.isIdle();
+      }
+    }
+  }
+
+  size_t diffSamples = (latency == fftconvolver::MultiStageFFTConvolver::CalculateLatency(blockSizeHead, maxLatency)) ? 0 : 1;
+  if (!idle)
+  {
+    ++diffSamples;
+  }
+  for (size_t i=0; i<inputSize; ++i)
+  {
+    if (::fabs(out[i] - outSimple[i]) > 0.00001f * maxMagnitude)
+    {
+      ++diffSamples;
+    }
+    const fftconvolver::Sample ref = (i >= latency) ? outSimple[i-latency] : 0.0f;
+    if (::fabs(outMultiStage[i] - ref) > 0.00001f * maxMagnitude)
+    {
+      ++diffSamples;
+    }
+  }
+  printf("Correctness Test (silent input, IR %d, blocksize %d-%d, latency %d) => %s\n", static_cast<int>(irSize), static_cast<int>(blockSizeMin), static_cast<int>(blockSizeMax), static_cast<int>(latency), (diffSamples == 0) ? "[OK]" : "[FAILED]");
+  return (diffSamples == 0);
+}
+
+
+static bool TestSparseIR(size_t irSize, size_t preDelay, size_t blockSizeMin, size_t blockSizeMax, size_t blockSizeHead, size_t maxLatency)
+{
+  // Prepare input and IR: The IR begins with a pre-delay, and it has a gated
+  // (silent) and a nearly silent region in between
+  const size_t inputSize = 20000;
+  std::vector<fftconvolver::Sample> in(inputSize);
+  for (size_t i=0; i<inputSize; ++i)
+  {
+    in[i] = 0.1f * static_cast<fftconvolver::Sample>((i*5) % 11);
+  }
+
+  std::vector<fftconvolver::Sample> ir(irSize, 0.0f);
+  for (size_t i=preDelay; i<irSize; ++i)
+  {
+    if (i < irSize/3 || i >= irSize/2)
+    {
+      ir[i] = 0.1f * static_cast<fftconvolver::Sample>((i*7) % 17);
+    }
+    else if (i >= 2*irSize/5)
+    {
+      ir[i] = 1e-9f * static_cast<fftconvolver::Sample>((i*3) % 5);
+    }
+  }
+
+  std::vector<fftconvolver::Sample> outSimple(in.size() + ir.size() - 1, 0.0f);
+  SimpleConvolve(&in[0], in.size(), &ir[0], ir.size(), &outSimple[0]);
+  outSimple.resize(inputSize);
+  fftconvolver::Sample maxMagnitude = 0.0f;
+  for (size_t i=0; i<inputSize; ++i)
+  {
+    maxMagnitude = std::max(maxMagnitude, static_cast<fftconvolver::Sample>(::fabs(outSimple[i])));
+  }
+
+  // Segments are skipped by the uniformly partitioned convolver (relative to the
+  // segments passed to it) and by the multi-stage convolver (relative to the whole IR)
+  std::vector<fftconvolver::Sample> out(inputSize);
+  std::vector<fftconvolver::Sample> outMultiStage(inputSize);
+  size_t latency = 0;
+  {
+    fftconvolver::FFTConvolver convolver;
+    convolver.init(blockSizeHead, &ir[0], ir.size());
+    fftconvolver::MultiStageFFTConvolver multiStageConvolver;
+    multiStageConvolver.init(blockSizeHead, 4096, &ir[0], ir.size(), maxLatency);
+    latency = multiStageConvolver.getLatency();
+    size_t processed = 0;
+    while (processed < inputSize)
+    {
+      const size_t blockSize = blockSizeMin + (static_cast<size_t>(rand()) % (1+(blockSizeMax-blockSizeMin)));
+      const size_t processing = std::min(inputSize - processed, blockSize);
+      convolver.process(&in[processed], &out[processed], processing);
+      multiStageConvolver.process(&in[processed], &outMultiStage[processed], processing);
+      processed += processing;
+    }
+  }
+
+  size_t diffSamples = (latency == fftconvolver::MultiStageFFTConvolver::CalculateLatency(blockSizeHead, maxLatency)) ? 0 : 1;
+  for (size_t i=0; i<inputSize; ++i)
+  {
+    if (::fabs(out[i] - outSimple[i]) > 0.00001f * maxMagnitude)
+    {
+      ++diffSamples;
+    }
+    const fftconvolver::Sample ref = (i >= latency) ? outSimple[i-latency] : 0.0f;
+    if (::fabs(outMultiStage[i] - ref) > 0.00001f * maxMagnitude)
+    {
+      ++diffSamples;
+    }
+  }
+  printf("Correctness Test (sparse IR, IR %d, pre-delay %d, blocksize %d-%d, latency %d) => %s\n", static_cast<int>(irSize), static_cast<int>(preDelay), static_cast<int>(blockSizeMin), static_cast<int>(blockSizeMax), static_cast<int>(latency), (diffSamples == 0) ? "[OK]" : "[FAILED]");
+  return (diffSamples == 0);
+}
+
+
+static bool TestArena()
+{
+  // Buffers attached to an arena are aligned, zeroed and don't overlap
+  fftconvolver::Arena arena;
+  arena.allocate(fftconvolver::Arena::Bytes<fftconvolver::Sample>(3)
+               + 2 * fftconvolver::Arena::Bytes<fftconvolver::Sample>(1000)
+               + fftconvolver::Arena::Bytes<fftconvolver::Sample>(17));
+  fftconvolver::SampleBuffer a;
+  fftconvolver::SplitComplex b;
+  fftconvolver::SampleBuffer c;
+  a.attach(arena, 3);
+  b.attach(arena, 1000);
+  c.attach(arena, 17);
+  bool ok = (a.size() == 3 && b.size() == 1000 && c.size() == 17);
+  const fftconvolver::Sample* buffers[] = { a.data(), b.re(), b.im(), c.data() };
+  const size_t sizes[] = { 3, 1000, 1000, 17 };
+  for (size_t i=0; i<4; ++i)
+  {
+    ok = ok && (reinterpret_cast<size_t>(buffers[i]) % fftconvolver::BufferAlignment == 0);
+    ok = ok && (i == 0 || buffers[i] >= buffers[i-1] + sizes[i-1]);
+    for (size_t j=0; j<sizes[i]; ++j)
+    {
+      ok = ok && (buffers[i][j] == 0.0f);
+    }
+  }
+
+  // A buffer can leave the arena and own its memory again
+  c.resize(5);
+  ok = ok && (c.size() == 5 && c.data() != buffers[3]);
+  a.clear();
+  b.clear();
+  arena.clear();
+  ok = ok && (arena.size() == 0);
+
+  // Large arenas have exactly the requested size and are aligned to huge pages
+  const size_t largeSize = 3 * 1024 * 1024 / sizeof(fftconvolver::Sample);
+  arena.allocate(fftconvolver::Arena::Bytes<fftconvolver::Sample>(largeSize));
+  a.attach(arena, largeSize);
+  ok = ok && (arena.size() == largeSize * sizeof(fftconvolver::Sample));
+  ok = ok && (reinterpret_cast<size_t>(a.data()) % (2 * 1024 * 1024) == 0);
+  ok = ok && (a[0] == 0.0f && a[largeSize-1] == 0.0f);
+  a.clear();
+  arena.clear();
+  printf("Correctness Test (arena) => %s\n", ok ? "[OK]" : "[FAILED]");
+  return ok;
+}
+
+
+static bool TestDotProduct(size_t len)
+{
+  std::vector<fftconvolver::Sample> a(len + 1);
+  std::vector<fftconvolver::Sample> b(len + 1);
+  double ref = 0.0;
+  for (size_t i=0; i<len; ++i)
+  {
+    a[i+1] = static_cast<fftconvolver::Sample>((i % 7) + 1) * 0.25f;
+    b[i+1] = static_cast<fftconvolver::Sample>((i % 5) + 1) * 0.5f;
+    ref += static_cast<double>(a[i+1]) * static_cast<double>(b[i+1]);
+  }
+  fftconvolver::InitSIMDKernel();
+  // Unaligned on purpose
+  const double result = static_cast<double>(fftconvolver::DotProduct(&a[1], &b[1], len));
+  const bool ok = (::fabs(result - ref) <= 0.0001 * std::max(1.0, ::fabs(ref)));
+  printf("Correctness Test (dot product, length %d) => %s\n", static_cast<int>(len), ok ? "[OK]" : "[FAILED]");
+  return ok;
+}
+
+
+static bool TestResampler(double inputSampleRate, double outputSampleRate, double frequency, double aliasFrequency)
+{
+  // Sine (plus a sine above the output Nyquist frequency, which has to be removed)
+  const double Pi = 3.1415926535897932384626433832795;
+  const size_t inputSize = 20000;
+  std::vector<float> in(inputSize);
+  for (size_t i=0; i<inputSize; ++i)
+  {
+    const double t = static_cast<double>(i) / inputSampleRate;
+    in[i] = static_cast<float>(0.5 * ::sin(2.0 * Pi * frequency * t) + ((aliasFrequency > 0.0) ? 0.25 * ::sin(2.0 * Pi * aliasFrequency * t) : 0.0));
+  }
+
+  fftconvolver::Resampler resampler(inputSampleRate, outputSampleRate);
+  const size_t outputSize = resampler.getOutputSize(inputSize);
+  const size_t expectedSize = static_cast<size_t>(::ceil(static_cast<double>(inputSize) * outputSampleRate / inputSampleRate - 0.000001));
+  std::vector<float> out(outputSize);
+  resampler.process(&in[0], in.size(), &out[0], 0, outputSize / 2);
+  resampler.process(&in[0], in.size(), &out[0], outputSize / 2, outputSize);
+
+  // Away from the edges, the output is the sine at the output sample rate
+  const size_t margin = outputSize / 10;
+  double maxError = 0.0;
+  for (size_t i=margin; i+margin<outputSize; ++i)
+  {
+    const double ref = 0.5 * ::sin(2.0 * Pi * frequency * static_cast<double>(i) / outputSampleRate);
+    maxError = std::max(maxError, ::fabs(static_cast<double>(out[i]) - ref));
+  }
+  const bool ok = (outputSize == expectedSize && maxError < 0.001);
+  printf("Correctness Test (resampler, %.0f Hz => %.0f Hz, sine %.0f Hz, alias %.0f Hz, error %.6f) => %s\n", inputSampleRate, outputSampleRate, frequency, aliasFrequency, maxError, ok ? "[OK]" : "[FAILED]");
+  return ok;
+}
+
+
+static bool TestFFTBackends(size_t size)
+{
+  std::vector<float> in(size);
+  for (size_t i=0; i<size; ++i)
+  {
+    in[i] = static_cast<float>((i * 7919) % 101) / 50.0f - 1.0f;
+  }
+
+  // Reference: Naive DFT in double precision
+  const size_t complexSize = audiofft::AudioFFT::ComplexSize(size);
+  std::vector<double> refRe(complexSize, 0.0);
+  std::vector<double> refIm(complexSize, 0.0);
+  double maxMagnitude = 1.0;
+  for (size_t k=0; k<complexSize; ++k)
+  {
+    for (size_t n=0; n<size; ++n)
+    {
+      const double phase = -2.0 * 3.14159265358979323846 * static_cast<double>((k * n) % size) / static_cast<double>(size);
+      refRe[k] += static_cast<double>(in[n]) * ::cos(phase);
+      refIm[k] += static_cast<double>(in[n]) * ::sin(phase);
+    }
+    maxMagnitude = std::max(maxMagnitude, ::fabs(refRe[k]) + ::fabs(refIm[k]));
+  }
+
+  const audiofft::AudioFFT::Backend backends[] =
+  {
+    audiofft::AudioFFT::Backend::SIMD,
+    audiofft::AudioFFT::Backend::Ooura,
+    audiofft::AudioFFT::Backend::FFTW3,
+    audiofft::AudioFFT::Backend::AppleAccelerate
+  };
+  bool ok = true;
+  for (size_t b=0; b<sizeof(backends)/sizeof(backends[0]); ++b)
+  {
+    if (!audiofft::AudioFFT::IsBackendAvailable(backends[b]))
+    {
+      continue;
+    }
+    audiofft::AudioFFT fft(backends[b]);
+    fft.init(size);
+    std::vector<float> re(complexSize);
+    std::vector<float> im(complexSize);
+    std::vector<float> out(size);
+    std::vector<float> outUnnormalized(size);
+    fft.fft(&in[0], &re[0], &im[0]);
+    fft.ifft(&out[0], &re[0], &im[0]);
+    fft.ifftUnnormalized(&outUnnormalized[0], &re[0], &im[0]);
+    bool backendOk = (fft.getBackend() == backends[b]);
+    for (size_t k=0; k<complexSize; ++k)
+    {
+      if (::fabs(re[k] - refRe[k]) > 0.00001 * maxMagnitude || ::fabs(im[k] - refIm[k]) > 0.00001 * maxMagnitude)
+      {
+        backendOk = false;
+      }
+    }
+    for (size_t i=0; i<size; ++i)
+    {
+      if (::fabs(out[i] - in[i]) > 0.0001f || ::fabs(outUnnormalized[i] - static_cast<float>(size) * in[i]) > 0.0001f * static_cast<float>(size))
+      {
+        backendOk = false;
+      }
+    }
+    printf("Correctness Test (FFT backend %s, size %d) => %s\n", audiofft::AudioFFT::GetBackendName(backends[b]), static_cast<int>(size), backendOk ? "[OK]" : "[FAILED]");
+    ok = ok && backendOk;
+  }
+  return ok;
+}
+
+
 #define TEST_CORRECTNESS
 //#define TEST_PERFORMANCE
 
 #define TEST_FFTCONVOLVER
 #define TEST_TWOSTAGEFFTCONVOLVER
+#define TEST_MULTISTAGEFFTCONVOLVER
 
 
 int main()
 { 
+  printf("SIMD kernel: %s\n", fftconvolver::SIMDKernelName(fftconvolver::ActiveSIMDKernel()));
+
 #if defined(TEST_CORRECTNESS) && defined(TEST_FFTCONVOLVER)
   TestConvolver(1, 1, 1, 1, 1, true);
   TestConvolver(2, 2, 2, 2, 2, true);
@@ -286,6 +1108,42 @@ int main()
   TestConvolver(100000, 4321, 100,  512,  512, true);
   TestConvolver(100000, 4321, 100, 1024, 1024, true);
   TestConvolver(100000, 4321, 100, 2048, 2048, true);
+
+  TestConvolver(2000, 300000, 100, 128, 128, true);
+  TestConvolver(2000, 300001,  33,  64,  64, true);
+
+  TestSharedPartitionedIR(10000, 4321, 128);
+  TestSharedPartitionedIR(10000, 1234, 1024);
+
+  TestChunkedPartitionedIR(300000, 128);
+  TestChunkedPartitionedIR(300001, 4096);
+
+  TestConvolverGain(10000, 4321, 256, 0.5f);
+  TestConvolverGain(10000, 1234, 1024, 0.001f);
+
+  TestBufferedConvolver(10000, 4321, 441, 441, 512);
+  TestBufferedConvolver(10000, 1234, 1, 1000, 256);
+
+  TestArena();
+
+  TestResampler(44100.0, 48000.0, 1000.0, 0.0);
+  TestResampler(96000.0, 44100.0, 1000.0, 30000.0);
+  TestResampler(44100.0, 44100.0 * 1.37, 3000.0, 0.0);
+  TestResampler(48000.0, 48000.0 * 0.61, 500.0, 20000.0);
+
+  TestDotProduct(0);
+  TestDotProduct(3);
+  TestDotProduct(37);
+  TestDotProduct(1000);
+
+  TestFFTBackends(2);
+  TestFFTBackends(4);
+  TestFFTBackends(8);
+  TestFFTBackends(32);
+  TestFFTBackends(64);
+  TestFFTBackends(128);
+  TestFFTBackends(1024);
+  TestFFTBackends(8192);
 #endif
   
 
@@ -333,6 +1191,58 @@ int main()
 #if defined(TEST_PERFORMANCE) && defined(TEST_TWOSTAGEFFTCONVOLVER)
   TestTwoStageConvolver(3*60*44100, 20*44100, 50, 100, 100, 2*8192, false);
 #endif
+
+#if defined(TEST_CORRECTNESS) && defined(TEST_MULTISTAGEFFTCONVOLVER)
+  TestMultiStageConvolver(1, 1, 1, 1, 1, 1, 0, true);
+  TestMultiStageConvolver(2, 2, 2, 2, 2, 2, 0, true);
+  TestMultiStageConvolver(3, 3, 3, 3, 3, 3, 0, true);
+
+  TestMultiStageConvolver(9, 4, 3, 3, 1, 4, 0, true);
+  TestMultiStageConvolver(171, 7, 5, 5, 1, 16, 0, true);
+  TestMultiStageConvolver(1979, 17, 7, 7, 1, 16, 0, true);
+  TestMultiStageConvolver(100, 100, 3, 5, 1, 16, 0, true);
+  TestMultiStageConvolver(45, 123, 12, 34, 4, 32, 0, true);
+  TestMultiStageConvolver(17, 1979, 7, 7, 1, 64, 0, true);
+
+  TestMultiStageConvolver(100000, 4321, 100,  128,  128, 16384, 0, true);
+  TestMultiStageConvolver(100000, 4321, 100,  512,  512, 16384, 0, true);
+  TestMultiStageConvolver(100000, 4321, 100, 2048, 2048, 16384, 0, true);
+  TestMultiStageConvolver(20000, 54321, 50,  100,  64, 16384, 0, true);
+  TestMultiStageConvolver(20000, 54321, 100, 2048, 2048, 16384, 0, true);
+
+  // Time-domain head (tiny head block sizes)
+  TestMultiStageConvolver(20000, 54321, 16, 16, 16, 16384, 0, true);
+  TestMultiStageConvolver(20000, 12345, 1, 40, 32, 16384, 0, true);
+  TestMultiStageConvolver(5000, 50, 7, 7, 64, 16384, 0, true);
+
+  // Buffered head (latency)
+  TestMultiStageConvolver(20000, 54321, 441, 441, 441, 16384, 1024, true);
+  TestMultiStageConvolver(20000, 12345, 1, 300, 32, 16384, 2000, true);
+  TestMultiStageConvolver(5000, 100, 64, 64, 64, 16384, 512, true);
+  TestMultiStageConvolver(5000, 4321, 256, 256, 256, 16384, 100, true);
+
+  // Several outputs sharing the input
+  TestMultiOutputConvolver(20000, 54321, 100, 2048, 256, 0);
+  TestMultiOutputConvolver(20000, 12345, 1, 40, 32, 0);
+  TestMultiOutputConvolver(20000, 12345, 441, 441, 441, 1024);
+  TestMatrixConvolver(20000, 54321, 100, 2048, 256, 0);
+  TestMatrixConvolver(20000, 12345, 1, 40, 32, 0);
+  TestMatrixConvolver(20000, 12345, 441, 441, 441, 1024);
+
+  TestSilentInput(3000, 1, 300, 64, 0);
+  TestSilentInput(3000, 100, 2048, 256, 0);
+  TestSilentInput(5000, 441, 441, 441, 1024);
+  TestSilentInput(12000, 1, 300, 64, 0);
+
+  TestSparseIR(6000, 37, 1, 300, 64, 0);
+  TestSparseIR(12000, 1200, 100, 2048, 256, 0);
+  TestSparseIR(12000, 1200, 441, 441, 441, 1024);
+  TestSparseIR(65536, 16000, 441, 441, 441, 1024);
+#endif
+
+#if defined(TEST_PERFORMANCE) && defined(TEST_MULTISTAGEFFTCONVOLVER)
+  TestMultiStageConvolver(3*60*44100, 20*44100, 50, 100, 100, 2*8192, 0, false);
+#endif
   
   return 0;
 }
@@ -17,15 +17,11 @@
 
 #include "IRAgent.h"
 
-#include "Parameters.h"
 #include "Processor.h"
 
 #include <algorithm>
 
 
-
-
-
 class ReferencingAudioSource : public AudioSource
 {
 public:
@@ -102,20 +98,13 @@ IRAgent::IRAgent(Processor& processor, size_t inputChannel, size_t outputChannel
   _fileSampleRate(0.0),
   _fileChannel(0),
   _irBuffer(nullptr),
-  _convolverMutex(),
-  _convolver(nullptr),
-  _fadeFactor(0.0),
-  _fadeIncrement(0.0),
-  _eqLo(CookbookEq::HiPass2, Parameters::EqLowCutFreq.getMinValue(), 1.0f),
-  _eqHi(CookbookEq::LoPass2, Parameters::EqHighCutFreq.getMaxValue(), 1.0f)
+  _calculationCache()
 {
-  initialize();
 }
 
 
 IRAgent::~IRAgent()
 {
-  clear();
 }
 
 
@@ -137,47 +126,8 @@ size_t IRAgent::getOutputChannel() const
 }
 
 
-void IRAgent::initialize()
-{
-  const float eqSampleRate = static_cast<float>(_processor.getSampleRate());
-  const size_t eqBlockSize = _processor.getConvolverHeadBlockSize();
-  
-  const int eqLowType = _processor.getParameter(Parameters::EqLowType);
-  if (eqLowType == Parameters::Cut)
-  {
-    _eqLo.setType(CookbookEq::HiPass2);
-    _eqLo.setFreq(_processor.getParameter(Parameters::EqLowCutFreq));
-  }
-  else if (eqLowType == Parameters::Shelf)
-  {
-    _eqLo.setType(CookbookEq::LoShelf);
-    _eqLo.setFreq(_processor.getParameter(Parameters::EqLowShelfFreq));
-    _eqLo.setGain(_processor.getParameter(Parameters::EqLowShelfDecibels));
-  }
-
-  const int eqHighType = _processor.getParameter(Parameters::EqHighType);
-  if (eqHighType == Parameters::Cut)
-  {
-    _eqHi.setType(CookbookEq::LoPass2);
-    _eqHi.setFreq(_processor.getParameter(Parameters::EqHighCutFreq));
-  }
-  else if (eqHighType == Parameters::Shelf)
-  {
-    _eqHi.setType(CookbookEq::HiShelf);
-    _eqHi.setFreq(_processor.getParameter(Parameters::EqHighShelfFreq));
-    _eqHi.setGain(_processor.getParameter(Parameters::EqHighShelfDecibels));
-  }
-  
-  _eqLo.prepareToPlay(eqSampleRate, eqBlockSize);
-  _eqHi.prepareToPlay(eqSampleRate, eqBlockSize);
-}
-
-
 void IRAgent::clear()
 {
-  fadeOut();
-  waitForFadeOut();
-  setConvolver(nullptr);
   {
     ScopedLock lock(_mutex);
     _file = File();
@@ -188,6 +138,7 @@ void IRAgent::clear()
     _irBuffer = nullptr;
   }
   propagateChange();
+  updateConvolver();
 }
 
 
@@ -266,175 +217,30 @@ FloatBuffer::Ptr IRAgent::getImpulseResponse() const
 }
 
 
+IRCalculationCache& IRAgent::getCalculationCache()
+{
+  return _calculationCache;
+}
+
+
 void IRAgent::updateConvolver()
 {
   _processor.updateConvolvers();
 }
 
 
-void IRAgent::resetIR(const FloatBuffer::Ptr& irBuffer, Convolver* convolver)
+void IRAgent::resetIR(const FloatBuffer::Ptr& irBuffer)
 {
   {
     ScopedLock lock(_mutex);
     _irBuffer = irBuffer;
   }
-
-  {
-    ScopedPointer<Convolver> conv(convolver);
-    {
-      // Make sure that the convolver mutex is locked as short as
-      // possible and that all destruction and deallocation happens
-      // outside of the lock because this might block the audio thread
-      ScopedLock convolverLock(_convolverMutex);
-      if (_convolver != conv)
-      {
-        _convolver.swapWith(conv);
-      }
-    }
-  }
-
   propagateChange();
 }
 
 
-CriticalSection& IRAgent::getConvolverMutex()
-{
-  return _convolverMutex;
-}
-
-
-Convolver* IRAgent::getConvolver()
-{
-  return _convolver.get();
-}
-                  
-
-void IRAgent::setConvolver(Convolver* convolver)
-{
-  ScopedPointer<Convolver> conv(convolver);
-  {
-    // Make sure that the convolver mutex is locked as short as
-    // possible and that all destruction and deallocation happens
-    // outside of the lock because this might block the audio thread
-    ScopedLock convolverLock(_convolverMutex);
-    if (_convolver != conv)
-    {
-      _convolver.swapWith(conv);
-    }
-  }
-  conv = nullptr;
-}
-
-
 void IRAgent::propagateChange()
 {
   notifyAboutChange();
   _processor.notifyAboutChange();
 }
-
-
-void IRAgent::process(const float* input, float* output, size_t len)
-{
-  const float Epsilon = 0.0001f;
-  
-  // This is the hopefully one and only rare exception where we need to
-  // lock a mutex in the realtime audio thread :-/ (however, the according
-  // convolver mutex is locked somewhere else only once for a very short and
-  // rare swapping operation, so this shouldn't be a problem, and most operating
-  // systems internally try spinning before performing an expensive context switch,
-  // so we will never give up the context here probably).
-  juce::ScopedLock convolverLock(_convolverMutex);
-  
-  if (_convolver && (_fadeFactor > Epsilon || ::fabs(_fadeIncrement) > Epsilon))
-  {
-    _convolver->process(input, output, len);        
-    if (::fabs(_fadeIncrement) > Epsilon || _fadeFactor < (1.0-Epsilon))
-    {
-      for (size_t i=0; i<len; ++i)
-      {
-        _fadeFactor = std::max(0.0f, std::min(1.0f, _fadeFactor+_fadeIncrement));
-        output[i] *= _fadeFactor;
-      }
-      if (_fadeFactor < Epsilon || _fadeFactor > (1.0-Epsilon))
-      {
-        _fadeIncrement = 0.0;
-      }
-    }
-  }
-  else
-  {
-    ::memset(output, 0, len * sizeof(float));
-    _fadeFactor = 0.0;
-    _fadeIncrement = 0.0;
-  }
-  
-  // EQ low
-  const int eqLowType = _processor.getParameter(Parameters::EqLowType);
-  if (eqLowType == Parameters::Cut)
-  {    
-    const float eqLowCutFreq = _processor.getParameter(Parameters::EqLowCutFreq);
-    if (::fabs(eqLowCutFreq-Parameters::EqLowCutFreq.getMinValue()) > 0.0001f)
-    {
-      _eqLo.setType(CookbookEq::HiPass2);
-      _eqLo.setFreq(eqLowCutFreq);
-      _eqLo.filterOut(output, len);
-    }
-  }
-  else if (eqLowType == Parameters::Shelf)
-  {
-    const float eqLowShelfDecibels = _processor.getParameter(Parameters::EqLowShelfDecibels);
-    if (::fabs(eqLowShelfDecibels-0.0f) > 0.0001f)
-    {
-      _eqLo.setType(CookbookEq::LoShelf);
-      _eqLo.setFreq(_processor.getParameter(Parameters::EqLowShelfFreq));
-      _eqLo.setGain(eqLowShelfDecibels);
-      _eqLo.filterOut(output, len);
-    }
-  }
-  
-  // EQ high
-  const int eqHighType = _processor.getParameter(Parameters::EqHighType);
-  if (eqHighType == Parameters::Cut)
-  {
-    const float eqHighCutFreq = _processor.getParameter(Parameters::EqHighCutFreq);
-    if (::fabs(eqHighCutFreq-Parameters::EqHighCutFreq.getMaxValue()) > 0.0001f)
-    {
-      _eqHi.setType(CookbookEq::LoPass2);
-      _eqHi.setFreq(eqHighCutFreq);
-      _eqHi.filterOut(output, len);
-    }
-  }
-  else if (eqHighType == Parameters::Shelf)
-  {
-    const float eqHighShelfDecibels = _processor.getParameter(Parameters::EqHighShelfDecibels);
-    if (::fabs(eqHighShelfDecibels-0.0f) > 0.0001f)
-    {
-      _eqHi.setType(CookbookEq::HiShelf);
-      _eqHi.setFreq(_processor.getParameter(Parameters::EqHighShelfFreq));
-      _eqHi.setGain(eqHighShelfDecibels);
-      _eqHi.filterOut(output, len);
-    }
-  }
-}
-
-
-void IRAgent::fadeIn()
-{
-  _fadeIncrement = +0.005f;
-}
-
-
-void IRAgent::fadeOut()
-{
-  _fadeIncrement = -0.005f;
-}
-
-
-bool IRAgent::waitForFadeOut(size_t waitTimeMs)
-{
-  for (size_t i=0; i < waitTimeMs && _fadeFactor >= 0.0001; ++i)
-  {
-    Thread::sleep(1);
-  }
-  return (_fadeFactor < 0.0001);
-}
@@ -21,8 +21,6 @@
 #include "JuceHeader.h"
 
 #include "ChangeNotifier.h"
-#include "CookbookEq.h"
-#include "Convolver.h"
 
 #include <vector>
 
@@ -72,6 +70,50 @@ private:
 // ====================================================
 
 
+/**
+* @class IRCalculationCache
+* @brief Intermediate results of the last IR calculation of an agent
+*
+* Each result is stored together with a key describing all inputs it has been
+* calculated from (each key includes the key of the previous step), so
+* IRCalculation only needs to redo the steps whose inputs have changed,
+* e.g. changing the decay shape doesn't reload and resample the file.
+*/
+struct IRCalculationCache
+{
+  IRCalculationCache() :
+    importKey(),
+    imported(),
+    importedSampleRate(0.0),
+    resampleKey(),
+    resampled(),
+    cropKey(),
+    cropped(),
+    croppedEnergy(0.0),
+    irKey(),
+    ir()
+  {
+  }
+
+  juce::String importKey;
+  FloatBuffer::Ptr imported;
+  double importedSampleRate;
+
+  juce::String resampleKey;
+  FloatBuffer::Ptr resampled;
+
+  juce::String cropKey;
+  FloatBuffer::Ptr cropped;
+  double croppedEnergy;
+
+  juce::String irKey;
+  FloatBuffer::Ptr ir;
+};
+
+
+// ====================================================
+
+
 class IRAgent : public ChangeNotifier
 {
 public:
@@ -85,8 +127,6 @@ public:
   size_t getInputChannel() const;
   size_t getOutputChannel() const;
   
-  void initialize();
-  
   void clear();
   
   // IR File
@@ -100,20 +140,12 @@ public:
   
   FloatBuffer::Ptr getImpulseResponse() const;
   
-  void fadeIn();
-  void fadeOut();
-  bool waitForFadeOut(size_t waitTimeMs = 100);
+  // Only to be accessed by the IR calculation thread
+  IRCalculationCache& getCalculationCache();
   
-  // Convolver
+  // Convolver (the convolution itself is done by the ConvolutionEngine of the processor)
   void updateConvolver();
-  void clearConvolver();
-  void resetIR(const FloatBuffer::Ptr& irBuffer, Convolver* convolver);
-  
-  CriticalSection& getConvolverMutex();
-  Convolver* getConvolver();
-  void setConvolver(Convolver* convolver);
-  
-  void process(const float* input, float* output, size_t len);
+  void resetIR(const FloatBuffer::Ptr& irBuffer);
   
 private:
   void propagateChange();
@@ -131,15 +163,7 @@ private:
   size_t _fileChannel;
   
   FloatBuffer::Ptr _irBuffer;
-  
-  CriticalSection _convolverMutex;
-  ScopedPointer<Convolver> _convolver;
-  
-  float _fadeFactor;
-  float _fadeIncrement;
-  
-  CookbookEq _eqLo;
-  CookbookEq _eqHi;
+  IRCalculationCache _calculationCache;
   
   // Prevent uncontrolled usage
   IRAgent(const IRAgent&);
@@ -17,70 +17,59 @@
 
 #include "Processor.h"
 
+#include "ConvolutionEngine.h"
 #include "Convolver.h"
 #include "DecibelScaling.h"
 #include "Envelope.h"
+#include "FFTConvolver/Resampler.h"
 #include "IRCalculation.h"
 #include "IRAgent.h"
 #include "Parameters.h"
 #include "Processor.h"
 
 #include <algorithm>
+#include <functional>
 
 
-class FloatBufferSource : public AudioSource
+// Formats a parameter value for a key of the IRCalculationCache
+static juce::String ToKey(double value)
+{
+  return juce::String(value, 9);
+}
+
+
+// ===================================================================
+
+
+class IRCalculation::Job : public juce::ThreadPoolJob
 {
 public:
-  explicit FloatBufferSource(const FloatBuffer::Ptr& sourceBuffer) :
-    juce::AudioSource(),
-    _sourceBuffer(sourceBuffer),
-    _pos(0)
+  Job(const std::function<bool(size_t)>& function, size_t index) :
+    juce::ThreadPoolJob("IRCalculation::Job"),
+    _function(function),
+    _index(index),
+    _result(false)
   {
   }
 
-  virtual void prepareToPlay(int /*samplesPerBlockExpected*/, double /*sampleRate*/)
+  virtual JobStatus runJob()
   {
-    _pos = 0;
+    _result = _function(_index);
+    return jobHasFinished;
   }
 
-  virtual void releaseResources()
+  bool getResult() const
   {
-    _pos = 0;
-  }
-
-  virtual void getNextAudioBlock(const AudioSourceChannelInfo& bufferToFill)
-  {
-    AudioSampleBuffer* destBuffer = bufferToFill.buffer;
-    const int len = std::min(bufferToFill.numSamples, static_cast<int>(_sourceBuffer->getSize()-_pos));
-    if (destBuffer)
-    {
-      for (int channel=0; channel<destBuffer->getNumChannels(); ++channel)
-      {
-        if (channel == 0 && _sourceBuffer)
-        {
-          destBuffer->copyFrom(channel, bufferToFill.startSample, _sourceBuffer->data()+_pos, len);
-          if (len < bufferToFill.numSamples)
-          {
-            const int startClear = bufferToFill.startSample + len;
-            const int lenClear = bufferToFill.numSamples - len;
-            destBuffer->clear(startClear, lenClear);
-          }
-        }
-        else
-        {
-          destBuffer->clear(channel, bufferToFill.startSample, len);
-        }
-      }
-    }
-    _pos += len;
+    return _result;
   }
 
 private:
-  const FloatBuffer::Ptr& _sourceBuffer;
-  size_t _pos;
+  const std::function<bool(size_t)>& _function;
+  const size_t _index;
+  bool _result;
 
-  FloatBufferSource(const FloatBufferSource&);
-  FloatBufferSource& operator=(const FloatBufferSource&);
+  Job(const Job&);
+  Job& operator=(const Job&);
 };
 
 
@@ -89,7 +78,8 @@ private:
 
 IRCalculation::IRCalculation(Processor& processor) :
   juce::Thread("IRCalculation"),
-  _processor(processor)
+  _processor(processor),
+  _threadPool(ThreadPoolSize)
 {
   startThread();
 }
@@ -108,252 +98,398 @@ void IRCalculation::run()
     return;
   }
 
-  // Initiate fade out
+  // Each agent keeps the intermediate results of its previous calculation (see
+  // IRCalculationCache), so each step below is only done again if its inputs
+  // have changed since then. The agents are independent of each other, so
+  // each step processes all agents (or files) concurrently.
   IRAgentContainer agents = _processor.getAgents();
-  for (size_t i=0; i<agents.size(); ++i)
-  {
-    agents[i]->fadeOut();
-  }
-  
-  // Import the files
   std::vector<FloatBuffer::Ptr> buffers(agents.size(), nullptr);
-  std::vector<double> fileSampleRates(agents.size(), 0.0);
+
+  // Import the files: All agents referencing the same file share one import,
+  // which decodes all channels needed by them in a single pass over the file
+  struct FileImport
+  {
+    juce::File file;
+    juce::String fileKey;
+    std::vector<size_t> agentIndices;
+  };
+  std::vector<FileImport> fileImports;
+  std::vector<juce::String> importKeys(agents.size());
   for (size_t i=0; i<agents.size(); ++i)
   {
+    IRCalculationCache& cache = agents[i]->getCalculationCache();
     const juce::File file = agents[i]->getFile();
-    if (file.existsAsFile())
+    if (!file.existsAsFile())
     {
-      double sampleRate;
-      FloatBuffer::Ptr buffer = importAudioFile(file, agents[i]->getFileChannel(), sampleRate);
-      if (!buffer || sampleRate < 0.0001 || threadShouldExit())
+      cache = IRCalculationCache();
+      continue;
+    }
+
+    const juce::String fileKey = file.getFullPathName()
+                               + "|" + juce::String(file.getLastModificationTime().toMilliseconds())
+                               + "|" + juce::String(file.getSize());
+    importKeys[i] = fileKey + "|" + juce::String(static_cast<int>(agents[i]->getFileChannel()));
+    if (cache.importKey != importKeys[i])
+    {
+      size_t importIndex = 0;
+      while (importIndex < fileImports.size() && fileImports[importIndex].fileKey != fileKey)
+      {
+        ++importIndex;
+      }
+      if (importIndex == fileImports.size())
       {
-        return;
+        FileImport fileImport;
+        fileImport.file = file;
+        fileImport.fileKey = fileKey;
+        fileImports.push_back(fileImport);
       }
-      buffers[i] = buffer;
-      fileSampleRates[i] = sampleRate;
+      fileImports[importIndex].agentIndices.push_back(i);
+    }
+  }
+  const bool successImport = runConcurrently(fileImports.size(), [&](size_t f) -> bool
+  {
+    const FileImport& fileImport = fileImports[f];
+    std::vector<size_t> fileChannels;
+    for (size_t i=0; i<fileImport.agentIndices.size(); ++i)
+    {
+      fileChannels.push_back(agents[fileImport.agentIndices[i]]->getFileChannel());
+    }
+    double sampleRate;
+    std::vector<FloatBuffer::Ptr> imported = importAudioFile(fileImport.file, fileChannels, sampleRate);
+    if (imported.size() != fileChannels.size() || sampleRate < 0.0001 || threadShouldExit())
+    {
+      return false;
     }
+    for (size_t i=0; i<fileImport.agentIndices.size(); ++i)
+    {
+      IRCalculationCache& cache = agents[fileImport.agentIndices[i]]->getCalculationCache();
+      cache.importKey = importKeys[fileImport.agentIndices[i]];
+      cache.imported = imported[i];
+      cache.importedSampleRate = sampleRate;
+    }
+    return true;
+  });
+  if (!successImport)
+  {
+    return;
   }
 
-  // Sample rate
+  // Change the sample rate
   const double convolverSampleRate = _processor.getSampleRate();
   const double stretch = _processor.getStretch();
   const double stretchSampleRate = convolverSampleRate * stretch;
-  for (size_t i=0; i<agents.size(); ++i)
-  { 
-    if (buffers[i] != nullptr && fileSampleRates[i] > 0.00001)
+  const bool successResample = runConcurrently(agents.size(), [&](size_t i) -> bool
+  {
+    IRCalculationCache& cache = agents[i]->getCalculationCache();
+    if (!cache.imported)
+    {
+      return true;
+    }
+
+    const juce::String resampleKey = cache.importKey + "|" + ToKey(stretchSampleRate);
+    if (cache.resampleKey != resampleKey)
     {
-      FloatBuffer::Ptr resampled = changeSampleRate(buffers[i], fileSampleRates[i], stretchSampleRate);
+      FloatBuffer::Ptr resampled = changeSampleRate(cache.imported, cache.importedSampleRate, stretchSampleRate);
       if (!resampled || threadShouldExit())
       {
-        return;
+        return false;
       }
-      buffers[i] = resampled;
+      cache.resampleKey = resampleKey;
+      cache.resampled = resampled;
     }
-  }
-
-  // Unify buffer size
-  unifyBufferSize(buffers);
-  if (threadShouldExit())
-  { 
+    buffers[i] = cache.resampled;
+    return true;
+  });
+  if (!successResample)
+  {
     return;
   }
 
-  // Crop begin/end
-  buffers = cropBuffers(buffers, _processor.getIRBegin(), _processor.getIREnd());
-  if (threadShouldExit())
+  // Unify buffer size and crop begin/end
+  size_t unifiedSize = 0;
+  for (size_t i=0; i<buffers.size(); ++i)
+  {
+    if (buffers[i] != nullptr)
+    {
+      unifiedSize = std::max(unifiedSize, buffers[i]->getSize());
+    }
+  }
+  const double irBegin = _processor.getIRBegin();
+  const double irEnd = _processor.getIREnd();
+  const bool successCrop = runConcurrently(agents.size(), [&](size_t i) -> bool
+  {
+    if (buffers[i] != nullptr)
+    {
+      IRCalculationCache& cache = agents[i]->getCalculationCache();
+      const juce::String cropKey = cache.resampleKey
+                                 + "|" + juce::String(static_cast<juce::int64>(unifiedSize))
+                                 + "|" + ToKey(irBegin)
+                                 + "|" + ToKey(irEnd);
+      if (cache.cropKey != cropKey)
+      {
+        FloatBuffer::Ptr cropped = cropBuffer(padBuffer(buffers[i], unifiedSize), irBegin, irEnd);
+        const double energy = calculateEnergy(cropped);
+        if (threadShouldExit())
+        {
+          return false;
+        }
+        cache.cropKey = cropKey;
+        cache.cropped = cropped;
+        cache.croppedEnergy = energy;
+      }
+      buffers[i] = cache.cropped;
+    }
+    return true;
+  });
+  if (!successCrop)
   {
     return;
   }
 
   // Calculate auto gain (should be done before applying the envelope!)
-  const float autoGain = calculateAutoGain(buffers);
-  if (threadShouldExit())
+  double autoGain = 1.0;
+  for (size_t i=0; i<buffers.size(); ++i)
   {
-    return;
+    if (buffers[i] != nullptr)
+    {
+      autoGain = std::min(autoGain, 1.0 / std::sqrt(agents[i]->getCalculationCache().croppedEnergy));
+    }
   }
+  _processor.setParameter(Parameters::AutoGainDecibels, DecibelScaling::Gain2Db(static_cast<float>(autoGain)));
 
-  // Envelope
+  // Envelope, reverse and predelay
   const double attackLength = _processor.getAttackLength();
   const double attackShape = _processor.getAttackShape();
   const double decayShape = _processor.getDecayShape();
-  for (size_t i=0; i<buffers.size(); ++i)
+  const bool reverse = _processor.getReverse();
+  const double predelayMs = _processor.getPredelayMs();
+  const size_t predelaySamples = static_cast<size_t>((convolverSampleRate / 1000.0) * predelayMs);
+  const size_t headBlockSize = _processor.getConvolverHeadBlockSize();
+  const size_t tailBlockSize = _processor.getConvolverTailBlockSize();
+  const size_t latency = _processor.getConvolverLatency();
+  const bool backgroundProcessing = !_processor.isOfflineRendering();
+  const bool successEnvelope = runConcurrently(agents.size(), [&](size_t i) -> bool
   {
-    if (buffers[i] != nullptr)
+    if (buffers[i] != nullptr && buffers[i]->getSize() > 0)
     {
-      ApplyEnvelope(buffers[i]->data(), buffers[i]->getSize(), attackLength, attackShape, decayShape);
+      IRCalculationCache& cache = agents[i]->getCalculationCache();
+      const juce::String irKey = cache.cropKey
+                               + "|" + ToKey(attackLength)
+                               + "|" + ToKey(attackShape)
+                               + "|" + ToKey(decayShape)
+                               + "|" + juce::String(reverse ? 1 : 0)
+                               + "|" + juce::String(static_cast<juce::int64>(predelaySamples));
+      if (cache.irKey != irKey)
+      {
+        // The cached buffers are shared, so the envelope is applied to a copy
+        const size_t size = buffers[i]->getSize();
+        FloatBuffer::Ptr ir(new FloatBuffer(predelaySamples + size));
+        ::memset(ir->data(), 0, predelaySamples * sizeof(float));
+        ::memcpy(ir->data()+predelaySamples, buffers[i]->data(), size * sizeof(float));
+        ApplyEnvelope(ir->data()+predelaySamples, size, attackLength, attackShape, decayShape);
+        if (reverse)
+        {
+          std::reverse(ir->data()+predelaySamples, ir->data()+predelaySamples+size);
+        }
+        if (threadShouldExit())
+        {
+          return false;
+        }
+        cache.irKey = irKey;
+        cache.ir = ir;
+      }
+      buffers[i] = cache.ir;
     }
-    if (threadShouldExit())
+    else
     {
-      return;
+      buffers[i] = nullptr;
     }
-  }  
+    return true;
+  });
+  if (!successEnvelope)
+  {
+    return;
+  }
 
-  // Reverse
-  if (_processor.getReverse())
+  // Update convolver: The engine gets one matrix convolver for the impulse responses
+  // of all agents, sharing the input transforms and summing up in the frequency domain
+  ConvolutionEngine& engine = _processor.getEngine();
+  const size_t inputCount = engine.getInputCount();
+  const size_t outputCount = engine.getOutputCount();
+  std::vector<FloatBuffer::Ptr> engineBuffers(inputCount * outputCount, nullptr);
+  juce::String convolverKey = ToKey(convolverSampleRate)
+                            + "|" + juce::String(static_cast<juce::int64>(headBlockSize))
+                            + "|" + juce::String(static_cast<juce::int64>(tailBlockSize))
+                            + "|" + juce::String(static_cast<juce::int64>(latency))
+                            + "|" + juce::String(backgroundProcessing ? 1 : 0)
+                            + "|" + juce::String(static_cast<juce::int64>(inputCount))
+                            + "x" + juce::String(static_cast<juce::int64>(outputCount));
+  bool upToDate = true;
+  for (size_t n=0; n<engineBuffers.size(); ++n)
   {
-    for (size_t i=0; i<buffers.size(); ++i)
-    {
-      if (buffers[i] != nullptr)
-      {
-        reverseBuffer(buffers[i]);
-      }
-      if (threadShouldExit())
-      {
-        return;
-      }
-    }
+    IRAgent* agent = engine.getAgent(n / outputCount, n % outputCount);
+    const size_t agentIndex = static_cast<size_t>(std::find(agents.begin(), agents.end(), agent) - agents.begin());
+    engineBuffers[n] = (agentIndex < buffers.size()) ? buffers[agentIndex] : nullptr;
+    convolverKey += "|" + (engineBuffers[n] ? agent->getCalculationCache().irKey : juce::String("-"));
+    upToDate = upToDate && (!agent || agent->getImpulseResponse() == engineBuffers[n]);
+  }
+  if (upToDate && engine.getConvolverKey() == convolverKey)
+  {
+    return; // The engine is already playing these impulse responses
   }
 
-  // Predelay
-  const double predelayMs = _processor.getPredelayMs();
-  const size_t predelaySamples = static_cast<size_t>((convolverSampleRate / 1000.0) * predelayMs);
-  if (predelaySamples > 0)
+  std::vector<const float*> irs(engineBuffers.size(), nullptr);
+  std::vector<size_t> irLens(engineBuffers.size(), 0);
+  std::vector<juce::String> irKeys(engineBuffers.size());
+  size_t warmUpLength = 0;
+  for (size_t n=0; n<engineBuffers.size(); ++n)
   {
-    for (size_t i=0; i<buffers.size(); ++i)
+    if (engineBuffers[n])
     {
-      if (buffers[i] != nullptr)
-      {
-        FloatBuffer::Ptr buffer = new FloatBuffer(buffers[i]->getSize() + predelaySamples);
-        ::memset(buffer->data(), 0, predelaySamples * sizeof(float));
-        ::memcpy(buffer->data()+predelaySamples, buffers[i]->data(), buffers[i]->getSize() * sizeof(float));
-        buffers[i] = buffer;
-      }      
+      irs[n] = engineBuffers[n]->data();
+      irLens[n] = engineBuffers[n]->getSize();
+      irKeys[n] = engine.getAgent(n / outputCount, n % outputCount)->getCalculationCache().irKey;
+      warmUpLength = std::max(warmUpLength, irLens[n]);
     }
   }
-  
-  // Update convolvers
-  const size_t headBlockSize = _processor.getConvolverHeadBlockSize();
-  const size_t tailBlockSize = _processor.getConvolverTailBlockSize();
-  _processor.setParameter(Parameters::AutoGainDecibels, DecibelScaling::Gain2Db(autoGain));
-  for (size_t i=0; i<agents.size(); ++i)
+
+  std::unique_ptr<Convolver> convolver;
+  if (warmUpLength > 0)
   {
-    std::unique_ptr<Convolver> convolver(new Convolver());
-    if (buffers[i] != nullptr && buffers[i]->getSize() > 0)
-    {        
-      convolver.reset(new Convolver());
-      const bool successInit = convolver->init(headBlockSize, tailBlockSize, buffers[i]->data(), buffers[i]->getSize());
-      if (!successInit || threadShouldExit())
-      {
-        return;
-      }
+    convolver.reset(new Convolver(convolverSampleRate, backgroundProcessing));
+    convolver->setAutoGain(static_cast<float>(autoGain));
+    convolver->setIRKeys(irs, irLens, irKeys);
+    const bool successInit = convolver->init(headBlockSize, tailBlockSize, inputCount, irs, irLens, latency);
+    if (!successInit || threadShouldExit())
+    {
+      return;
     }
+  }
+  engine.getConvolverKey() = convolverKey;
 
-    while (!agents[i]->waitForFadeOut(1))
+  for (size_t n=0; n<engineBuffers.size(); ++n)
+  {
+    IRAgent* agent = engine.getAgent(n / outputCount, n % outputCount);
+    if (agent)
     {
-      if (threadShouldExit())
-      {
-        return;
-      }
+      agent->resetIR(engineBuffers[n]);
     }
-    agents[i]->resetIR(buffers[i], convolver.release());
-    agents[i]->fadeIn();
   }
+
+  // The engine warms up the new convolver (warming up with more input than the
+  // length of the impulse responses wouldn't change the output anymore) and
+  // crossfades to it, unless rendering offline
+  if (!engine.setConvolver(convolver.release(), warmUpLength))
+  {
+    engine.getConvolverKey() = juce::String(); // Not taken over => The next calculation has to start over
+  }
+}
+
+
+bool IRCalculation::runConcurrently(size_t count, const std::function<bool(size_t)>& function)
+{
+  juce::OwnedArray<Job> jobs;
+  for (size_t i=0; i<count; ++i)
+  {
+    jobs.add(new Job(function, i));
+    _threadPool.addJob(jobs.getLast(), false);
+  }
+  bool success = true;
+  for (int i=0; i<jobs.size(); ++i)
+  {
+    _threadPool.waitForJobToFinish(jobs[i], -1);
+    success = success && jobs[i]->getResult();
+  }
+  return success && !threadShouldExit();
 }
 
 
 
-FloatBuffer::Ptr IRCalculation::importAudioFile(const File& file, size_t fileChannel, double& fileSampleRate) const
+std::vector<FloatBuffer::Ptr> IRCalculation::importAudioFile(const File& file, const std::vector<size_t>& fileChannels, double& fileSampleRate) const
 {
   fileSampleRate = 0.0;
 
   if (!file.existsAsFile())
   {
-    return FloatBuffer::Ptr();
+    return std::vector<FloatBuffer::Ptr>();
   }
 
+  // WAV and AIFF files are memory mapped, so the samples are decoded directly from
+  // the mapped file, all other formats are read by their regular reader
   juce::AudioFormatManager formatManager;
   formatManager.registerBasicFormats();
-  ScopedPointer<AudioFormatReader> audioFormatReader(formatManager.createReaderFor(file));
+  ScopedPointer<AudioFormatReader> audioFormatReader;
+  AudioFormat* audioFormat = formatManager.findFormatForFileExtension(file.getFileExtension());
+  if (audioFormat)
+  {
+    ScopedPointer<MemoryMappedAudioFormatReader> mappedReader(audioFormat->createMemoryMappedReader(file));
+    if (mappedReader && mappedReader->mapEntireFile())
+    {
+      audioFormatReader = mappedReader.release();
+    }
+  }
   if (!audioFormatReader)
   {
-    return FloatBuffer::Ptr();
+    audioFormatReader = formatManager.createReaderFor(file);
   }
-
-  const int fileChannels = audioFormatReader->numChannels;
-  const size_t fileLen = static_cast<size_t>(audioFormatReader->lengthInSamples);
-  if (static_cast<int>(fileChannel) >= fileChannels)
+  if (!audioFormatReader)
   {
-    return FloatBuffer::Ptr();
+    return std::vector<FloatBuffer::Ptr>();
   }
-  FloatBuffer::Ptr buffer(new FloatBuffer(fileLen));
 
-  juce::AudioFormatReaderSource audioFormatReaderSource(audioFormatReader, false);
-  size_t pos = 0;
-  juce::AudioSampleBuffer importBuffer(fileChannels, 8192);
-  while (pos < fileLen)
+  // Each requested channel is decoded once, directly into its buffer (channels which
+  // aren't requested are skipped by the reader)
+  const int fileChannelCount = static_cast<int>(audioFormatReader->numChannels);
+  const size_t fileLen = static_cast<size_t>(audioFormatReader->lengthInSamples);
+  std::vector<FloatBuffer::Ptr> channelBuffers(static_cast<size_t>(fileChannelCount), nullptr);
+  std::vector<FloatBuffer::Ptr> buffers;
+  for (size_t i=0; i<fileChannels.size(); ++i)
   {
-    if (threadShouldExit())
+    if (static_cast<int>(fileChannels[i]) >= fileChannelCount)
     {
-      return FloatBuffer::Ptr();
+      return std::vector<FloatBuffer::Ptr>();
     }
-    const int loading = std::min(importBuffer.getNumSamples(), static_cast<int>(fileLen-pos));
-    juce::AudioSourceChannelInfo info;
-    info.buffer = &importBuffer;
-    info.startSample = 0;
-    info.numSamples = loading;
-    audioFormatReaderSource.getNextAudioBlock(info);
-    ::memcpy(buffer->data()+pos, importBuffer.getReadPointer(fileChannel), static_cast<size_t>(loading) * sizeof(float));
-    pos += static_cast<size_t>(loading);
-  }
-
-  fileSampleRate = audioFormatReader->sampleRate;
-  return buffer;
-}
-
-void IRCalculation::reverseBuffer(FloatBuffer::Ptr& buffer) const
-{
-  if (buffer)
-  {
-    const size_t bufferSize = buffer->getSize();
-    if (bufferSize > 0)
+    if (!channelBuffers[fileChannels[i]])
     {
-      float* a = buffer->data();
-      float* b = a + (bufferSize - 1);
-      while (a < b)
-      {
-        std::swap(*a, *b);
-        ++a;
-        --b;
-      }
+      channelBuffers[fileChannels[i]] = new FloatBuffer(fileLen);
     }
+    buffers.push_back(channelBuffers[fileChannels[i]]);
   }
-}
 
-
-std::vector<FloatBuffer::Ptr> IRCalculation::cropBuffers(const std::vector<FloatBuffer::Ptr>& buffers, double irBegin, double irEnd) const
-{
-  const double Epsilon = 0.00001;
-  irBegin = std::min(1.0, std::max(0.0, irBegin));
-  irEnd = std::min(1.0, std::max(0.0, irEnd));
-  if (irBegin < Epsilon && irEnd > 1.0-Epsilon)
-  {
-    return buffers;
-  }
-  std::vector<FloatBuffer::Ptr> croppedBuffers;
-  for (size_t i=0; i<buffers.size(); ++i)
+  const size_t blockSize = 65536;
+  std::vector<int*> destChannels(static_cast<size_t>(fileChannelCount), nullptr);
+  for (size_t pos=0; pos<fileLen; pos+=blockSize)
   {
     if (threadShouldExit())
     {
-      croppedBuffers.clear();
-      return croppedBuffers;
+      return std::vector<FloatBuffer::Ptr>();
+    }
+    const int loading = static_cast<int>(std::min(blockSize, fileLen-pos));
+    for (size_t channel=0; channel<channelBuffers.size(); ++channel)
+    {
+      destChannels[channel] = channelBuffers[channel] ? reinterpret_cast<int*>(channelBuffers[channel]->data()+pos) : nullptr;
+    }
+    if (!audioFormatReader->read(destChannels.data(), fileChannelCount, static_cast<juce::int64>(pos), loading, false))
+    {
+      return std::vector<FloatBuffer::Ptr>();
     }
-    FloatBuffer::Ptr cropped;
-    FloatBuffer::Ptr buffer = buffers[i];
-    if (buffer)
+  }
+
+  // Readers of integer formats deliver full scale 32 bit integers
+  if (!audioFormatReader->usesFloatingPointData)
+  {
+    for (size_t channel=0; channel<channelBuffers.size(); ++channel)
     {
-      const size_t bufferSize = buffer->getSize();
-      const size_t begin = static_cast<size_t>(irBegin * static_cast<double>(bufferSize));
-      const size_t end = static_cast<size_t>(irEnd * static_cast<double>(bufferSize));      
-      if (begin < end)
+      if (channelBuffers[channel])
       {
-        const size_t croppedSize = end - begin;
-        cropped = new FloatBuffer(croppedSize);
-        ::memcpy(cropped->data(), buffer->data()+begin, croppedSize * sizeof(float));
+        float* data = channelBuffers[channel]->data();
+        juce::FloatVectorOperations::convertFixedToFloat(data, reinterpret_cast<const int*>(data), 1.0f / static_cast<float>(0x7fffffff), static_cast<int>(fileLen));
       }
     }
-    croppedBuffers.push_back(cropped);
   }
-  return croppedBuffers;
+
+  fileSampleRate = audioFormatReader->sampleRate;
+  return buffers;
 }
 
 
@@ -372,95 +508,75 @@ FloatBuffer::Ptr IRCalculation::changeSampleRate(const FloatBuffer::Ptr& inputBu
   jassert(inputSampleRate >= 1.0);
   jassert(outputSampleRate >= 1.0);
 
-  const double samplesInPerOutputSample = inputSampleRate / outputSampleRate;
-  const int inputSampleCount = inputBuffer->getSize();
-  const int outputSampleCount = static_cast<int>(::ceil(static_cast<double>(inputSampleCount) / samplesInPerOutputSample));
-  const int blockSize = 8192;
-
-  FloatBufferSource inputSource(inputBuffer);
-  ResamplingAudioSource resamplingSource(&inputSource, false, 1);
-  resamplingSource.setResamplingRatio(samplesInPerOutputSample);
-  resamplingSource.prepareToPlay(blockSize, outputSampleRate);
+  const fftconvolver::Resampler resampler(inputSampleRate, outputSampleRate);
+  const size_t outputSampleCount = resampler.getOutputSize(inputBuffer->getSize());
+  const size_t blockSize = 8192;
 
   FloatBuffer::Ptr outputBuffer(new FloatBuffer(outputSampleCount));
-  juce::AudioSampleBuffer blockBuffer(1, blockSize);
-  int processed = 0;
-  while (processed < outputSampleCount)
+  for (size_t processed=0; processed<outputSampleCount; processed+=blockSize)
   {
     if (threadShouldExit())
     {
       return FloatBuffer::Ptr();
     }
-
-    const int remaining = outputSampleCount - processed;
-    const int processing = std::min(blockSize, remaining);
-
-    juce::AudioSourceChannelInfo info;
-    info.buffer = &blockBuffer;
-    info.startSample = 0;
-    info.numSamples = processing;
-    resamplingSource.getNextAudioBlock(info);      
-    ::memcpy(outputBuffer->data()+static_cast<size_t>(processed), blockBuffer.getReadPointer(0), processing * sizeof(float));
-    processed += processing;
+    const size_t processing = std::min(blockSize, outputSampleCount-processed);
+    resampler.process(inputBuffer->data(), inputBuffer->getSize(), outputBuffer->data(), processed, processed+processing);
   }
 
-  resamplingSource.releaseResources();
-
   return outputBuffer;
 }
 
 
-void IRCalculation::unifyBufferSize(std::vector<FloatBuffer::Ptr>& buffers) const
+FloatBuffer::Ptr IRCalculation::padBuffer(const FloatBuffer::Ptr& buffer, size_t size) const
 {
-  size_t bufferSize = 0;
-  for (size_t i=0; i<buffers.size(); ++i)
+  if (!buffer || buffer->getSize() >= size)
   {
-    if (buffers[i] != nullptr)
-    {
-      bufferSize = std::max(bufferSize, buffers[i]->getSize());
-    }
+    return buffer;
   }
-  for (size_t i=0; i<buffers.size(); ++i)
+  FloatBuffer::Ptr padded(new FloatBuffer(size));
+  const size_t copySize = buffer->getSize();
+  const size_t padSize = size - copySize;
+  ::memcpy(padded->data(), buffer->data(), copySize * sizeof(float));
+  ::memset(padded->data() + copySize, 0, padSize * sizeof(float));
+  return padded;
+}
+
+
+FloatBuffer::Ptr IRCalculation::cropBuffer(const FloatBuffer::Ptr& buffer, double irBegin, double irEnd) const
+{
+  const double Epsilon = 0.00001;
+  irBegin = std::min(1.0, std::max(0.0, irBegin));
+  irEnd = std::min(1.0, std::max(0.0, irEnd));
+  if (!buffer || (irBegin < Epsilon && irEnd > 1.0-Epsilon))
   {
-    if (threadShouldExit())
-    {
-      return;
-    }
-    if (buffers[i] && buffers[i]->getSize() < bufferSize)
-    {
-      FloatBuffer::Ptr buffer(new FloatBuffer(bufferSize));
-      const size_t copySize = buffers[i]->getSize();
-      const size_t padSize = bufferSize - copySize;
-      ::memcpy(buffer->data(), buffers[i]->data(), copySize * sizeof(float));
-      ::memset(buffer->data() + copySize, 0, padSize * sizeof(float));
-      buffers[i] = buffer;
-    }
+    return buffer;
   }
+  FloatBuffer::Ptr cropped;
+  const size_t bufferSize = buffer->getSize();
+  const size_t begin = static_cast<size_t>(irBegin * static_cast<double>(bufferSize));
+  const size_t end = static_cast<size_t>(irEnd * static_cast<double>(bufferSize));
+  if (begin < end)
+  {
+    const size_t croppedSize = end - begin;
+    cropped = new FloatBuffer(croppedSize);
+    ::memcpy(cropped->data(), buffer->data()+begin, croppedSize * sizeof(float));
+  }
+  return cropped;
 }
 
 
-float IRCalculation::calculateAutoGain(const std::vector<FloatBuffer::Ptr>& buffers) const
+double IRCalculation::calculateEnergy(const FloatBuffer::Ptr& buffer) const
 {
-  double autoGain = 1.0;
-  for (size_t buffer=0; buffer<buffers.size(); ++buffer)
+  double sum = 0.0;
+  if (buffer)
   {
-    if (threadShouldExit())
-    {
-      return -1.0f;
-    }
-    if (buffers[buffer] != nullptr)
+    const float* data = buffer->data();
+    const size_t len = buffer->getSize();
+    for (size_t i=0; i<len; ++i)
     {
-      const float* data = buffers[buffer]->data();
-      const size_t len = buffers[buffer]->getSize();
-      double sum = 0.0;
-      for (size_t i=0; i<len; ++i)
-      {
-        const double val = static_cast<double>(data[i]);
-        sum += val * val;
-      }
-      const double x = 1.0 / std::sqrt(sum);
-      autoGain = std::min(autoGain, x);
+      const double val = static_cast<double>(data[i]);
+      sum += val * val;
     }
   }
-  return static_cast<float>(autoGain);
+  return sum;
 }
@@ -22,6 +22,8 @@
 
 #include "Processor.h"
 
+#include <functional>
+
 
 class IRCalculation : public juce::Thread
 {
@@ -32,14 +34,20 @@ public:
   virtual void run();
   
 private:
-  FloatBuffer::Ptr importAudioFile(const File& file, size_t fileChannel, double& fileSampleRate) const;
-  void reverseBuffer(FloatBuffer::Ptr& buffer) const;
+  class Job;
+
+  // Number of threads processing the agents concurrently (enough for all agents of a true stereo setup)
+  static const int ThreadPoolSize = 4;
+
+  bool runConcurrently(size_t count, const std::function<bool(size_t)>& function);
+  std::vector<FloatBuffer::Ptr> importAudioFile(const File& file, const std::vector<size_t>& fileChannels, double& fileSampleRate) const;
   FloatBuffer::Ptr changeSampleRate(const FloatBuffer::Ptr& inputBuffer, double inputSampleRate, double outputSampleRate) const;
-  void unifyBufferSize(std::vector<FloatBuffer::Ptr>& buffers) const;  
-  float calculateAutoGain(const std::vector<FloatBuffer::Ptr>& buffers) const;
-  std::vector<FloatBuffer::Ptr> cropBuffers(const std::vector<FloatBuffer::Ptr>& buffers, double irBegin, double irEnd) const;
+  FloatBuffer::Ptr padBuffer(const FloatBuffer::Ptr& buffer, size_t size) const;
+  FloatBuffer::Ptr cropBuffer(const FloatBuffer::Ptr& buffer, double irBegin, double irEnd) const;
+  double calculateEnergy(const FloatBuffer::Ptr& buffer) const;
   
   Processor& _processor;
+  juce::ThreadPool _threadPool;
   
   // Prevent uncontrolled usage
   IRCalculation(const IRCalculation&);
@@ -0,0 +1,132 @@
+// ==================================================================================
+// Copyright (c) 2012 HiFi-LoFi
+//
+// This is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+// ==================================================================================
+
+#include "IRSpectrumCache.h"
+
+#include <algorithm>
+
+
+class IRSpectrumCache::Job : public juce::ThreadPoolJob
+{
+public:
+  Job(const std::function<void(size_t)>& function, size_t index) :
+    juce::ThreadPoolJob("IRSpectrumCache::Job"),
+    _function(function),
+    _index(index)
+  {
+  }
+
+  virtual JobStatus runJob()
+  {
+    _function(_index);
+    return jobHasFinished;
+  }
+
+private:
+  const std::function<void(size_t)>& _function;
+  const size_t _index;
+
+  Job(const Job&);
+  Job& operator=(const Job&);
+};
+
+
+// ===================================================================
+
+
+IRSpectrumCache::IRSpectrumCache() :
+  _mutex(),
+  _entries(),
+  _threadPool(std::max(1, juce::SystemStats::getNumCpus()))
+{
+}
+
+
+IRSpectrumCache::~IRSpectrumCache()
+{
+}
+
+
+std::shared_ptr<const fftconvolver::PartitionedIR> IRSpectrumCache::getPartitionedIR(const juce::String& irKey, size_t blockSize, const float* ir, size_t irLen, float gain)
+{
+  // Hashing the whole impulse response is only the fallback for callers which
+  // don't know how it has been calculated
+  const juce::String key = (irKey.isNotEmpty() ? irKey : juce::MD5(ir, irLen * sizeof(float)).toHexString())
+                         + "|" + juce::String(static_cast<juce::int64>(irLen))
+                         + "|" + juce::String(static_cast<juce::int64>(blockSize))
+                         + "|" + juce::String(gain, 9);
+  {
+    juce::ScopedLock lock(_mutex);
+    Entries::iterator it = _entries.find(key);
+    if (it != _entries.end())
+    {
+      std::shared_ptr<const fftconvolver::PartitionedIR> partitionedIR = it->second.lock();
+      if (partitionedIR)
+      {
+        return partitionedIR;
+      }
+    }
+  }
+
+  // Partitioning takes a while, so it's done without holding the lock
+  std::shared_ptr<const fftconvolver::PartitionedIR> partitionedIR = fftconvolver::PartitionedIR::Create(blockSize, ir, irLen, gain,
+    [this](size_t chunkCount, const std::function<void(size_t)>& prepareChunk)
+    {
+      runChunks(chunkCount, prepareChunk);
+    });
+  if (!partitionedIR)
+  {
+    return partitionedIR;
+  }
+
+  juce::ScopedLock lock(_mutex);
+  std::shared_ptr<const fftconvolver::PartitionedIR> cached = _entries[key].lock();
+  if (cached)
+  {
+    return cached; // Somebody else has been faster
+  }
+  _entries[key] = partitionedIR;
+
+  // Forget about the partitioned impulse responses which aren't used anymore
+  for (Entries::iterator it=_entries.begin(); it!=_entries.end(); )
+  {
+    if (it->second.expired())
+    {
+      _entries.erase(it++);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+  return partitionedIR;
+}
+
+
+void IRSpectrumCache::runChunks(size_t chunkCount, const std::function<void(size_t)>& prepareChunk)
+{
+  juce::OwnedArray<Job> jobs;
+  for (size_t i=0; i<chunkCount; ++i)
+  {
+    jobs.add(new Job(prepareChunk, i));
+    _threadPool.addJob(jobs.getLast(), false);
+  }
+  for (int i=0; i<jobs.size(); ++i)
+  {
+    _threadPool.waitForJobToFinish(jobs[i], -1);
+  }
+}
@@ -0,0 +1,88 @@
+// ==================================================================================
+// Copyright (c) 2012 HiFi-LoFi
+//
+// This is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+// ==================================================================================
+
+#ifndef _IRSPECTRUMCACHE_H
+#define _IRSPECTRUMCACHE_H
+
+// We need to include this before the Juce includes due to some
+// name clashes with Apple system headers, for more information see:
+// http://www.juce.com/forum/topic/reference-point-ambiguous
+#include "FFTConvolver/FFTConvolver.h"
+
+#include "JuceHeader.h"
+
+#include <functional>
+#include <map>
+#include <memory>
+
+
+/**
+* @class IRSpectrumCache
+* @brief Process-wide cache of partitioned impulse responses
+*
+* The spectra of a partitioned impulse response are read-only, so all convolvers of
+* all plugin instances using the same impulse response with the same block size share
+* one instance instead of each calculating and owning a private copy.
+*
+* The entries are identified by a key of the impulse response content, which is
+* normally the key of its calculation (see IRCalculationCache), so looking up an
+* impulse response doesn't need to touch its samples at all.
+*
+* The cache only holds weak references, i.e. a partitioned impulse response is freed as
+* soon as the last convolver using it is deleted.
+*
+* The segments of long impulse responses are prepared by a thread pool, which is shared
+* as well, so the number of threads doesn't grow with the number of plugin instances.
+*
+* Use it by juce::SharedResourcePointer<IRSpectrumCache> only.
+*/
+class IRSpectrumCache
+{
+public:
+  IRSpectrumCache();
+  ~IRSpectrumCache();
+
+  /**
+  * @brief Returns the partitioned impulse response, which is created if it isn't cached yet
+  * @param irKey Key identifying the content of the impulse response (e.g. the key of its
+  *              calculation, see IRCalculationCache), if empty, the content is hashed
+  * @param blockSize The block size
+  * @param ir The impulse response
+  * @param irLen Length of the impulse response
+  * @param gain The static gain applied to the impulse response
+  * @return The partitioned impulse response
+  */
+  std::shared_ptr<const fftconvolver::PartitionedIR> getPartitionedIR(const juce::String& irKey, size_t blockSize, const float* ir, size_t irLen, float gain);
+
+private:
+  class Job;
+
+  typedef std::map<juce::String, std::weak_ptr<const fftconvolver::PartitionedIR> > Entries;
+
+  void runChunks(size_t chunkCount, const std::function<void(size_t)>& prepareChunk);
+
+  juce::CriticalSection _mutex;
+  Entries _entries;
+  juce::ThreadPool _threadPool;
+
+  // Prevent uncontrolled usage
+  IRSpectrumCache(const IRSpectrumCache&);
+  IRSpectrumCache& operator=(const IRSpectrumCache&);
+};
+
+
+#endif // Header guard
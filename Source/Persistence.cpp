@@ -168,7 +168,7 @@ bool LoadState(const File& irDirectory, XmlElement& element, Processor& processo
       return false;
     }
     
-    IRAgent* irAgent = processor.getAgent(inputChannel, outputChannel);
+    IRAgent* irAgent = processor.createAgent(inputChannel, outputChannel);
     if (!irAgent)
     {
       return false;
@@ -180,7 +180,8 @@ bool LoadState(const File& irDirectory, XmlElement& element, Processor& processo
     irConfigurations.push_back(configuration);
   }
   
-  // Phase 2: Restore the state
+  // Phase 2: Restore the state (starting the IR calculation only once at the end)
+  processor.beginConvolverUpdate();
   processor.clearConvolvers();  
   processor.setParameterNotifyingHost(Parameters::WetOn, wetOn);
   processor.setParameterNotifyingHost(Parameters::WetDecibels, static_cast<float>(wetDecibels));
@@ -210,5 +211,6 @@ bool LoadState(const File& irDirectory, XmlElement& element, Processor& processo
     const File irFile = irDirectory.getChildFile(it->_file);
     irAgent->setFile(irFile, it->_fileChannel);
   }  
+  processor.endConvolverUpdate();
   return true;
 }
@@ -17,6 +17,7 @@
 
 #include "Processor.h"
 
+#include "ConvolutionEngine.h"
 #include "IRAgent.h"
 #include "IRCalculation.h"
 #include "Parameters.h"
@@ -27,12 +28,29 @@
 #include <algorithm>
 
 
+// Maximum time to wait for the impulse responses before rendering offline
+static const int OfflineIRCalculationTimeoutMs = 30000;
+
+
+static size_t CalculateTailBlockSize(size_t headBlockSize, size_t latency, bool offlineRendering)
+{
+  // Maximum block size of the convolver stages, the actual partitioning
+  // is chosen per impulse response by the convolver itself (when rendering
+  // offline, larger blocks are fine because there are no deadlines to meet)
+  const size_t maxTailBlockSize = offlineRendering ? 65536 : 16384;
+  return std::max(maxTailBlockSize, 2 * std::max(headBlockSize, latency));
+}
+
+
 //==============================================================================
 Processor::Processor() :
   AudioProcessor(),
   ChangeNotifier(),
   _wetBuffer(1, 0),
-  _convolutionBuffer(),
+  _dryDelayBuffer(1, 0),
+  _dryDelayPosition(0),
+  _engineInputs(),
+  _engineOutputs(),
   _parameterSet(),
   _levelMeasurementsDry(2),
   _levelMeasurementsWet(2),
@@ -40,10 +58,13 @@ Processor::Processor() :
   _settings(),
   _convolverMutex(),
   _agents(),
+  _engine(),
   _stretch(1.0),
   _reverse(false),
   _convolverHeadBlockSize(0),
   _convolverTailBlockSize(0),
+  _convolverLatency(0),
+  _offlineRendering(false),
   _irBegin(0.0),
   _irEnd(1.0),
   _predelayMs(0.0),
@@ -57,7 +78,9 @@ Processor::Processor() :
   _wetGain(DecibelScaling::Db2Gain(Parameters::WetDecibels.getDefaultValue())),
   _beatsPerMinute(0.0f),
   _irCalculationMutex(),
-  _irCalculation()
+  _irCalculation(),
+  _convolverUpdateDepth(0),
+  _convolverUpdatePending(false)
 { 
   _parameterSet.registerParameter(Parameters::WetOn);
   _parameterSet.registerParameter(Parameters::WetDecibels);
@@ -75,17 +98,39 @@ Processor::Processor() :
   _parameterSet.registerParameter(Parameters::AutoGainOn);
   _parameterSet.registerParameter(Parameters::AutoGainDecibels);
 
-  _agents.push_back(new IRAgent(*this, 0, 0));
-  _agents.push_back(new IRAgent(*this, 0, 1));
-  _agents.push_back(new IRAgent(*this, 1, 0));
-  _agents.push_back(new IRAgent(*this, 1, 1));
+  // One agent per pair of input and output channel, all of them share one engine
+  createAgents(static_cast<size_t>(getTotalNumInputChannels()), static_cast<size_t>(getTotalNumOutputChannels()));
+  _engine.reset(new ConvolutionEngine(*this));
+
+  // Switching between realtime and offline processing is handled by the change notification
+  addNotificationListener(this);
+
+  // The FFT backend and the FFTW3 plan cache are process-wide
+  audiofft::AudioFFT::SetDefaultBackend(_settings.getFFTBackend());
+  const juce::File wisdomFile = _settings.getFFTWisdomFile();
+  if (wisdomFile != juce::File())
+  {
+    audiofft::AudioFFT::SetWisdomFile(wisdomFile.getFullPathName().toStdString());
+  }
 }
 
 
 Processor::~Processor()
 {
+  removeNotificationListener(this);
   Processor::releaseResources();
 
+  // The IR calculation might still be handing a convolver over to the engine
+  {
+    juce::ScopedLock irCalculationlock(_irCalculationMutex);
+    if (_irCalculation)
+    {
+      _irCalculation->stopThread(-1);
+      _irCalculation = nullptr;
+    }
+  }
+  _engine.reset();
+
   for (size_t i=0; i<_agents.size(); ++i)
   {
     delete _agents[i];
@@ -185,6 +230,7 @@ double Processor::getTailLengthSeconds() const
 void Processor::numChannelsChanged()
 {
   juce::AudioProcessor::numChannelsChanged();
+  createAgents(static_cast<size_t>(getTotalNumInputChannels()), static_cast<size_t>(getTotalNumOutputChannels()));
   notifyAboutChange();
 }
 
@@ -215,42 +261,82 @@ void Processor::changeProgramName (int /*index*/, const String& /*newName*/)
 //==============================================================================
 void Processor::prepareToPlay(double /*sampleRate*/, int samplesPerBlock)
 {
+  const int numInputChannels = getTotalNumInputChannels();
+  const int numOutputChannels = getTotalNumOutputChannels();
+
   // Play safe to be clean
   releaseResources();
+  createAgents(static_cast<size_t>(numInputChannels), static_cast<size_t>(numOutputChannels));
 
   // Prepare convolvers
   {
     juce::ScopedLock convolverLock(_convolverMutex);
+    _offlineRendering = isNonRealtime();
     _convolverHeadBlockSize = 1;
     while (_convolverHeadBlockSize < static_cast<size_t>(samplesPerBlock))
     {
       _convolverHeadBlockSize *= 2;
     }
-    _convolverTailBlockSize = std::max(size_t(8192), 2 * _convolverHeadBlockSize);
+    // Optional latency in exchange for a larger (buffered) head block, it's
+    // reported to the host and the dry signal is delayed accordingly
+    _convolverLatency = fftconvolver::MultiStageFFTConvolver::CalculateLatency(_convolverHeadBlockSize, _settings.getLatencyBudget());
+    _convolverTailBlockSize = CalculateTailBlockSize(_convolverHeadBlockSize, _convolverLatency, _offlineRendering);
   }
+  setLatencySamples(static_cast<int>(_convolverLatency));
 
   // Prepare convolution buffers
-  _wetBuffer.setSize(2, samplesPerBlock);
-  _convolutionBuffer.resize(samplesPerBlock);
+  _wetBuffer.setSize(numOutputChannels, samplesPerBlock);
+  _engineInputs.assign(static_cast<size_t>(numInputChannels), nullptr);
+  _engineOutputs.assign(static_cast<size_t>(numOutputChannels), nullptr);
+  _dryDelayBuffer.setSize(numInputChannels, static_cast<int>(_convolverLatency));
+  _dryDelayBuffer.clear();
+  _dryDelayPosition = 0;
 
   // Initialize parameters
   _stereoWidth.initializeWidth(getParameter(Parameters::StereoWidth));
 
-  // Initialize IR agents
-  for (size_t i=0; i<_agents.size(); ++i)
+  // Initialize convolution engine for the current channels (the IR calculation
+  // must not run meanwhile, it's restarted by updateConvolvers() below)
   {
-    _agents[i]->initialize();
+    juce::ScopedLock irCalculationlock(_irCalculationMutex);
+    if (_irCalculation)
+    {
+      _irCalculation->stopThread(-1);
+      _irCalculation = nullptr;
+    }
+    _engine->initialize(static_cast<size_t>(numInputChannels), static_cast<size_t>(numOutputChannels));
   }
 
   notifyAboutChange();
   updateConvolvers();
+
+  // Rendering offline: The rendering shouldn't start before the convolvers
+  // are ready (nobody is waiting for the audio in realtime anyway)
+  if (_offlineRendering)
+  {
+    waitForIRCalculation(OfflineIRCalculationTimeoutMs);
+  }
+}
+
+
+void Processor::setNonRealtime(bool isNonRealtime) noexcept
+{
+  juce::AudioProcessor::setNonRealtime(isNonRealtime);
+
+  // Hosts may switch between realtime and offline processing without preparing
+  // to play again: The convolvers are replaced for the new mode by the change
+  // notification (see changeNotification()), the host mustn't be blocked here
+  notifyAboutChange();
 }
 
 
 void Processor::releaseResources()
 {
   _wetBuffer.setSize(1, 0, false, true, false);
-  _convolutionBuffer.clear();
+  _dryDelayBuffer.setSize(1, 0, false, true, false);
+  _dryDelayPosition = 0;
+  _engineInputs.clear();
+  _engineOutputs.clear();
   _beatsPerMinute.store(0);
   notifyAboutChange();
 }
@@ -262,62 +348,42 @@ void Processor::processBlock(AudioSampleBuffer& buffer, MidiBuffer& /*midiMessag
   const int numOutputChannels = getTotalNumOutputChannels();
   const size_t samplesToProcess = buffer.getNumSamples();
 
-  // Determine channel data
-  const float* channelData0 = nullptr;
-  const float* channelData1 = nullptr;
-  if (numInputChannels == 1)
-  {    
-    channelData0 = buffer.getReadPointer(0);
-    channelData1 = buffer.getReadPointer(0);
-  }
-  else if (numInputChannels == 2)
-  {
-    channelData0 = buffer.getReadPointer(0);
-    channelData1 = buffer.getReadPointer(1);
-  }
-
   // Convolution
   _wetBuffer.clear();
-  if (numInputChannels > 0 && numOutputChannels > 0)
+  if (numInputChannels > 0 && numOutputChannels > 0 &&
+      _engineInputs.size() == static_cast<size_t>(numInputChannels) &&
+      _engineOutputs.size() == static_cast<size_t>(numOutputChannels))
   {
-    float autoGain = 1.0f;
-    if (getParameter(Parameters::AutoGainOn))
+    // Convolve: One engine for all pairs of input and output channel, writing
+    // directly into the wet buffer (which applies the auto gain as well)
+    for (int i=0; i<numInputChannels; ++i)
     {
-      autoGain = DecibelScaling::Db2Gain(getParameter(Parameters::AutoGainDecibels));
+      _engineInputs[i] = buffer.getReadPointer(i);
     }
-
-    // Convolve
-    IRAgent* irAgent00 = getAgent(0, 0);
-    if (irAgent00 && irAgent00->getConvolver() && numInputChannels >= 1 && numOutputChannels >= 1)
+    for (int i=0; i<numOutputChannels; ++i)
     {
-      irAgent00->process(channelData0, &_convolutionBuffer[0], samplesToProcess);
-      _wetBuffer.addFrom(0, 0, &_convolutionBuffer[0], samplesToProcess, autoGain);
-    }
-
-    IRAgent* irAgent01 = getAgent(0, 1);
-    if (irAgent01 && irAgent01->getConvolver() && numInputChannels >= 1 && numOutputChannels >= 2)
-    {
-      irAgent01->process(channelData0, &_convolutionBuffer[0], samplesToProcess);
-      _wetBuffer.addFrom(1, 0, &_convolutionBuffer[0], samplesToProcess, autoGain);
+      _engineOutputs[i] = _wetBuffer.getWritePointer(i);
     }
+    _engine->process(_engineInputs.data(), _engineOutputs.data(), samplesToProcess);
+  }
 
-    IRAgent* irAgent10 = getAgent(1, 0);
-    if (irAgent10 && irAgent10->getConvolver() && numInputChannels >= 2 && numOutputChannels >= 1)
-    {      
-      irAgent10->process(channelData1, &_convolutionBuffer[0], samplesToProcess);
-      _wetBuffer.addFrom(0, 0, &_convolutionBuffer[0], samplesToProcess, autoGain);
-    }
+  // Keep the dry signal aligned with the delayed wet signal
+  if (_convolverLatency > 0)
+  {
+    delayDry(buffer, numInputChannels, samplesToProcess);
+  }
 
-    IRAgent* irAgent11 = getAgent(1, 1);
-    if (irAgent11 && irAgent11->getConvolver() && numInputChannels >= 2 && numOutputChannels >= 2)
-    {
-      irAgent11->process(channelData1, &_convolutionBuffer[0], samplesToProcess);
-      _wetBuffer.addFrom(1, 0, &_convolutionBuffer[0], samplesToProcess, autoGain);
-    }
+  // In case we have more outputs than inputs, we'll clear any output
+  // channels that didn't contain input data, (because these aren't
+  // guaranteed to be empty - they may contain garbage).
+  for (int i=numInputChannels; i<numOutputChannels; ++i)
+  {
+    buffer.clear(i, 0, buffer.getNumSamples());
   }
 
-  // Stereo width
-  if (numOutputChannels >= 2)
+  // Stereo width (only for plain stereo output, multichannel
+  // layouts have no meaningful pair of channels to widen)
+  if (numOutputChannels == 2)
   {
     _stereoWidth.updateWidth(getParameter(Parameters::StereoWidth));
     _stereoWidth.process(_wetBuffer.getWritePointer(0), _wetBuffer.getWritePointer(1), samplesToProcess);
@@ -343,7 +409,7 @@ void Processor::processBlock(AudioSampleBuffer& buffer, MidiBuffer& /*midiMessag
     _levelMeasurementsDry[0].process(samplesToProcess, buffer.getReadPointer(0));
     _levelMeasurementsDry[1].reset();
   }
-  else if (numInputChannels == 2)
+  else if (numInputChannels >= 2)
   {
     _levelMeasurementsDry[0].process(samplesToProcess, buffer.getReadPointer(0));
     _levelMeasurementsDry[1].process(samplesToProcess, buffer.getReadPointer(1));
@@ -360,13 +426,9 @@ void Processor::processBlock(AudioSampleBuffer& buffer, MidiBuffer& /*midiMessag
     float wetOnGain0, wetOnGain1;
     _wetOn.updateValue(getParameter(Parameters::WetOn) ? 1.0f : 0.0f);
     _wetOn.getSmoothValues(samplesToProcess, wetOnGain0, wetOnGain1);
-    if (numOutputChannels > 0)
-    {
-      buffer.addFromWithRamp(0, 0, _wetBuffer.getReadPointer(0), samplesToProcess, wetOnGain0, wetOnGain1);
-    }
-    if (numOutputChannels > 1)
+    for (int i=0; i<numOutputChannels; ++i)
     {
-      buffer.addFromWithRamp(1, 0, _wetBuffer.getReadPointer(1), samplesToProcess, wetOnGain0, wetOnGain1);
+      buffer.addFromWithRamp(i, 0, _wetBuffer.getReadPointer(i), samplesToProcess, wetOnGain0, wetOnGain1);
     }
   }
 
@@ -378,7 +440,7 @@ void Processor::processBlock(AudioSampleBuffer& buffer, MidiBuffer& /*midiMessag
     _levelMeasurementsOut[0].process(samplesToProcess, buffer.getReadPointer(0));
     _levelMeasurementsOut[1].reset();
   }
-  else if (numOutputChannels == 2)
+  else if (numOutputChannels >= 2)
   {
     _levelMeasurementsWet[0].process(samplesToProcess, _wetBuffer.getReadPointer(0));
     _levelMeasurementsWet[1].process(samplesToProcess, _wetBuffer.getReadPointer(1));
@@ -386,14 +448,6 @@ void Processor::processBlock(AudioSampleBuffer& buffer, MidiBuffer& /*midiMessag
     _levelMeasurementsOut[1].process(samplesToProcess, buffer.getReadPointer(1));
   }
 
-  // In case we have more outputs than inputs, we'll clear any output
-  // channels that didn't contain input data, (because these aren't
-  // guaranteed to be empty - they may contain garbage).
-  for (int i=numInputChannels; i<numOutputChannels; ++i)
-  {
-    buffer.clear(i, 0, buffer.getNumSamples());
-  }
-
   // Update beats per minute info
   float beatsPerMinute = 0.0f;
   juce::AudioPlayHead* playHead = getPlayHead();
@@ -411,6 +465,30 @@ void Processor::processBlock(AudioSampleBuffer& buffer, MidiBuffer& /*midiMessag
   }
 }
 
+
+void Processor::delayDry(juce::AudioSampleBuffer& buffer, int numChannels, size_t samples)
+{
+  // Ring buffer holding the most recent input: Swapping its samples with the
+  // current input outputs the input from one delay period ago
+  const size_t delay = static_cast<size_t>(_dryDelayBuffer.getNumSamples());
+  size_t processed = 0;
+  while (processed < samples)
+  {
+    const size_t processing = std::min(samples-processed, delay-_dryDelayPosition);
+    for (int channel=0; channel<numChannels; ++channel)
+    {
+      float* data = buffer.getWritePointer(channel, static_cast<int>(processed));
+      float* delayed = _dryDelayBuffer.getWritePointer(channel, static_cast<int>(_dryDelayPosition));
+      for (size_t i=0; i<processing; ++i)
+      {
+        std::swap(data[i], delayed[i]);
+      }
+    }
+    _dryDelayPosition = (_dryDelayPosition + processing) % delay;
+    processed += processing;
+  }
+}
+
 //==============================================================================
 bool Processor::hasEditor() const
 {
@@ -481,6 +559,7 @@ AudioProcessor* JUCE_CALLTYPE createPluginFilter()
 
 IRAgent* Processor::getAgent(size_t inputChannel, size_t outputChannel) const
 {
+  juce::ScopedLock convolverLock(_convolverMutex);
   for (size_t i=0; i<_agents.size(); ++i)
   {
     IRAgent* agent = _agents[i];
@@ -493,18 +572,57 @@ IRAgent* Processor::getAgent(size_t inputChannel, size_t outputChannel) const
 }
 
 
+IRAgent* Processor::createAgent(size_t inputChannel, size_t outputChannel)
+{
+  if (inputChannel >= JucePlugin_MaxNumInputChannels || outputChannel >= JucePlugin_MaxNumOutputChannels)
+  {
+    return nullptr;
+  }
+  juce::ScopedLock convolverLock(_convolverMutex);
+  IRAgent* agent = getAgent(inputChannel, outputChannel);
+  if (!agent)
+  {
+    agent = new IRAgent(*this, inputChannel, outputChannel);
+    _agents.push_back(agent);
+  }
+  return agent;
+}
+
+
 size_t Processor::getAgentCount() const
 {
+  juce::ScopedLock convolverLock(_convolverMutex);
   return _agents.size();
 }
 
 
 IRAgentContainer Processor::getAgents() const
 {
+  juce::ScopedLock convolverLock(_convolverMutex);
   return _agents;
 }
 
 
+void Processor::createAgents(size_t inputCount, size_t outputCount)
+{
+  // Agents are only created for the channels the host actually provides, and they're
+  // never deleted (others refer to them), i.e. a changed layout only adds the missing ones
+  for (size_t input=0; input<inputCount; ++input)
+  {
+    for (size_t output=0; output<outputCount; ++output)
+    {
+      createAgent(input, output);
+    }
+  }
+}
+
+
+ConvolutionEngine& Processor::getEngine() const
+{
+  return *_engine;
+}
+
+
 void Processor::clearConvolvers()
 {
   {
@@ -527,13 +645,17 @@ void Processor::clearConvolvers()
   setParameterNotifyingHost(Parameters::EqHighShelfDecibels, Parameters::EqHighShelfDecibels.getDefaultValue());
   setParameterNotifyingHost(Parameters::StereoWidth, Parameters::StereoWidth.getDefaultValue());
 
-  for (size_t i=0; i<_agents.size(); ++i)
+  // The agents are cleared outside the lock, they update the convolvers
+  beginConvolverUpdate();
+  const IRAgentContainer agents = getAgents();
+  for (size_t i=0; i<agents.size(); ++i)
   {
-    _agents[i]->clear();
+    agents[i]->clear();
   }
 
   notifyAboutChange();
   updateConvolvers();
+  endConvolverUpdate();
 }
 
 
@@ -780,8 +902,23 @@ size_t Processor::getConvolverTailBlockSize() const
 }
 
 
+size_t Processor::getConvolverLatency() const
+{
+  juce::ScopedLock convolverLock(_convolverMutex);
+  return _convolverLatency;
+}
+
+
+bool Processor::isOfflineRendering() const
+{
+  juce::ScopedLock convolverLock(_convolverMutex);
+  return _offlineRendering;
+}
+
+
 size_t Processor::getIRSampleCount() const
 {
+  juce::ScopedLock convolverLock(_convolverMutex);
   size_t maxSampleCount = 0;
   for (auto it=_agents.begin(); it!=_agents.end(); ++it)
   {
@@ -822,6 +959,7 @@ double Processor::getMaxFileDuration() const
 
 bool Processor::irAvailable() const
 {
+  juce::ScopedLock convolverLock(_convolverMutex);
   for (auto it=_agents.begin(); it!=_agents.end(); ++it)
   {
     if ((*it)->getFile().existsAsFile())
@@ -836,6 +974,11 @@ bool Processor::irAvailable() const
 void Processor::updateConvolvers()
 {
   juce::ScopedLock irCalculationlock(_irCalculationMutex);
+  if (_convolverUpdateDepth > 0)
+  {
+    _convolverUpdatePending = true;
+    return;
+  }
   if (_irCalculation)
   {
     _irCalculation->stopThread(-1);
@@ -845,6 +988,71 @@ void Processor::updateConvolvers()
 }
 
 
+void Processor::beginConvolverUpdate()
+{
+  juce::ScopedLock irCalculationlock(_irCalculationMutex);
+  ++_convolverUpdateDepth;
+}
+
+
+void Processor::endConvolverUpdate()
+{
+  bool pending = false;
+  {
+    juce::ScopedLock irCalculationlock(_irCalculationMutex);
+    jassert(_convolverUpdateDepth > 0);
+    if (_convolverUpdateDepth > 0 && --_convolverUpdateDepth == 0)
+    {
+      pending = _convolverUpdatePending;
+      _convolverUpdatePending = false;
+    }
+  }
+  if (pending)
+  {
+    updateConvolvers();
+  }
+}
+
+
+void Processor::changeNotification()
+{
+  // Switched between realtime and offline processing since preparing to play?
+  {
+    juce::ScopedLock convolverLock(_convolverMutex);
+    if (_offlineRendering == isNonRealtime() || _convolverHeadBlockSize == 0)
+    {
+      return;
+    }
+    _offlineRendering = isNonRealtime();
+    _convolverTailBlockSize = CalculateTailBlockSize(_convolverHeadBlockSize, _convolverLatency, _offlineRendering);
+  }
+  updateConvolvers();
+}
+
+
+void Processor::waitForIRCalculation(int timeoutMs)
+{
+  // The lock is only held for checking, so neither the calculation itself nor
+  // anybody replacing it is blocked by the waiting
+  const juce::uint32 startTime = juce::Time::getMillisecondCounter();
+  for (;;)
+  {
+    {
+      juce::ScopedLock irCalculationlock(_irCalculationMutex);
+      if (!_irCalculation || !_irCalculation->isThreadRunning())
+      {
+        return;
+      }
+    }
+    if (juce::Time::getMillisecondCounter() - startTime >= static_cast<juce::uint32>(timeoutMs))
+    {
+      return;
+    }
+    juce::Thread::sleep(5);
+  }
+}
+
+
 float Processor::getBeatsPerMinute() const
 {
   return _beatsPerMinute.load();
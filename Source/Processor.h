@@ -21,6 +21,7 @@
 #include "JuceHeader.h"
 
 #include "ChangeNotifier.h"
+#include "ConvolutionEngine.h"
 #include "IRAgent.h"
 #include "LevelMeasurement.h"
 #include "ParameterSet.h"
@@ -35,7 +36,7 @@
 //==============================================================================
 /**
 */
-class Processor : public AudioProcessor, public ChangeNotifier
+class Processor : public AudioProcessor, public ChangeNotifier, public ChangeNotifier::Listener
 {
 public:
   //==============================================================================
@@ -48,6 +49,8 @@ public:
 
   void processBlock(juce::AudioSampleBuffer& buffer, MidiBuffer& midiMessages);
 
+  virtual void setNonRealtime(bool isNonRealtime) noexcept;
+
   //==============================================================================
   juce::AudioProcessorEditor* createEditor();
   bool hasEditor() const;
@@ -116,10 +119,14 @@ public:
 
   size_t getConvolverHeadBlockSize() const;
   size_t getConvolverTailBlockSize() const;
+  size_t getConvolverLatency() const;
+  bool isOfflineRendering() const;
 
   IRAgent* getAgent(size_t inputChannel, size_t outputChannel) const;
+  IRAgent* createAgent(size_t inputChannel, size_t outputChannel);
   size_t getAgentCount() const;
   IRAgentContainer getAgents() const;
+  ConvolutionEngine& getEngine() const;
 
   void setStretch(double stretch);
   double getStretch() const;
@@ -153,11 +160,25 @@ public:
   void clearConvolvers();
   void updateConvolvers();
 
+  // Changes of several agents in a row (e.g. clearing all of them and assigning new
+  // files) restart the IR calculation only once, at the end of the outermost update
+  void beginConvolverUpdate();
+  void endConvolverUpdate();
+
+  virtual void changeNotification();
+
   float getBeatsPerMinute() const;
 
 private:
+  void delayDry(juce::AudioSampleBuffer& buffer, int numChannels, size_t samples);
+  void waitForIRCalculation(int timeoutMs);
+  void createAgents(size_t inputCount, size_t outputCount);
+
   juce::AudioSampleBuffer _wetBuffer;
-  std::vector<float> _convolutionBuffer;
+  juce::AudioSampleBuffer _dryDelayBuffer;
+  size_t _dryDelayPosition;
+  std::vector<const float*> _engineInputs;
+  std::vector<float*> _engineOutputs;
   ParameterSet _parameterSet;  
   std::vector<LevelMeasurement> _levelMeasurementsDry;
   std::vector<LevelMeasurement> _levelMeasurementsWet;
@@ -166,10 +187,13 @@ private:
 
   mutable juce::CriticalSection _convolverMutex;
   IRAgentContainer _agents;
+  std::unique_ptr<ConvolutionEngine> _engine;
   double _stretch;
   bool _reverse;
   size_t _convolverHeadBlockSize;
   size_t _convolverTailBlockSize;
+  size_t _convolverLatency;
+  bool _offlineRendering;
   double _irBegin;
   double _irEnd;
   double _predelayMs;
@@ -185,6 +209,8 @@ private:
 
   mutable juce::CriticalSection _irCalculationMutex;
   std::unique_ptr<juce::Thread> _irCalculation;
+  int _convolverUpdateDepth;
+  bool _convolverUpdatePending;
 
   //==============================================================================
   JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (Processor);
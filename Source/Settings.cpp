@@ -86,6 +86,97 @@ void Settings::setConvolverBlockSize(size_t blockSize)
 }
 
 
+size_t Settings::getLatencyBudget()
+{
+  int latency = 0;
+  juce::PropertiesFile* propertiesFile = _properties.getUserSettings();
+  if (propertiesFile)
+  {
+    latency = propertiesFile->getIntValue("LatencyBudget", latency);
+  }
+  return (latency > 0) ? static_cast<size_t>(latency) : 0;
+}
+
+
+void Settings::setLatencyBudget(size_t latency)
+{
+  juce::PropertiesFile* propertiesFile = _properties.getUserSettings();
+  if (propertiesFile)
+  {
+    propertiesFile->setValue("LatencyBudget", static_cast<int>(latency));
+    propertiesFile->saveIfNeeded();
+  }
+}
+
+
+audiofft::AudioFFT::Backend Settings::getFFTBackend()
+{
+  audiofft::AudioFFT::Backend backend = audiofft::AudioFFT::Backend::Default;
+  juce::PropertiesFile* propertiesFile = _properties.getUserSettings();
+  if (propertiesFile)
+  {
+    const juce::String backendStr = propertiesFile->getValue("FFTBackend");
+    if (backendStr == juce::String("SIMD"))
+    {
+      backend = audiofft::AudioFFT::Backend::SIMD;
+    }
+    else if (backendStr == juce::String("Ooura"))
+    {
+      backend = audiofft::AudioFFT::Backend::Ooura;
+    }
+    else if (backendStr == juce::String("FFTW3"))
+    {
+      backend = audiofft::AudioFFT::Backend::FFTW3;
+    }
+    else if (backendStr == juce::String("AppleAccelerate"))
+    {
+      backend = audiofft::AudioFFT::Backend::AppleAccelerate;
+    }
+  }
+  return backend;
+}
+
+
+void Settings::setFFTBackend(audiofft::AudioFFT::Backend backend)
+{
+  juce::PropertiesFile* propertiesFile = _properties.getUserSettings();
+  if (propertiesFile)
+  {
+    juce::String backendStr("Default");
+    switch (backend)
+    {
+    case audiofft::AudioFFT::Backend::SIMD:
+      backendStr = "SIMD";
+      break;
+    case audiofft::AudioFFT::Backend::Ooura:
+      backendStr = "Ooura";
+      break;
+    case audiofft::AudioFFT::Backend::FFTW3:
+      backendStr = "FFTW3";
+      break;
+    case audiofft::AudioFFT::Backend::AppleAccelerate:
+      backendStr = "AppleAccelerate";
+      break;
+    default:
+      break;
+    }
+    propertiesFile->setValue("FFTBackend", backendStr);
+    propertiesFile->saveIfNeeded();
+  }
+}
+
+
+juce::File Settings::getFFTWisdomFile()
+{
+  juce::PropertiesFile* propertiesFile = _properties.getUserSettings();
+  if (propertiesFile)
+  {
+    return propertiesFile->getFile().getSiblingFile("KlangFalter.fftwisdom");
+  }
+  return juce::File();
+}
+
+
 juce::File Settings::getImpulseResponseDirectory()
 {
   juce::PropertiesFile* propertiesFile = _properties.getUserSettings();
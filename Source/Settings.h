@@ -20,6 +20,8 @@
 
 #include "JuceHeader.h"
 
+#include "FFTConvolver/AudioFFT.h"
+
 
 class Settings
 {
@@ -33,6 +35,17 @@ public:
   size_t getConvolverBlockSize();
   void setConvolverBlockSize(size_t blockSize);
 
+  // Latency the convolution may introduce in exchange for lower CPU load (0: No latency)
+  size_t getLatencyBudget();
+  void setLatencyBudget(size_t latency);
+
+  // FFT implementation used by the convolvers (applies to impulse responses loaded afterwards)
+  audiofft::AudioFFT::Backend getFFTBackend();
+  void setFFTBackend(audiofft::AudioFFT::Backend backend);
+
+  // Cache of measured FFT plans next to the settings file (only used by FFTW3)
+  juce::File getFFTWisdomFile();
+
   juce::File getImpulseResponseDirectory();
   void setImpulseResponseDirectory(const juce::File& directory);
   
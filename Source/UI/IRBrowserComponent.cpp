@@ -200,6 +200,10 @@ void IRBrowserComponent::fileDoubleClicked(const File &file)
     return;
   }
   
+  // All agents are cleared and get their files in one go, so the IR calculation
+  // only starts once for all of them
+  _processor->beginConvolverUpdate();
+
   IRAgent* agent00 = _processor->getAgent(0, 0);
   IRAgent* agent01 = _processor->getAgent(0, 1);
   IRAgent* agent10 = _processor->getAgent(1, 0);
@@ -266,6 +270,44 @@ void IRBrowserComponent::fileDoubleClicked(const File &file)
       agent11->setFile(file, 3);
     }
   }
+  else if (inputChannels > 0 && outputChannels > 0)
+  {
+    // Multichannel: A file with a channel for each pair of input and output channel
+    // fills the whole matrix, otherwise the inputs feed the outputs in turn (e.g. a
+    // mono input feeds all outputs of an ambisonic decoder, or each input of a
+    // surround layout its own output), one file channel per output
+    const size_t numInputs = static_cast<size_t>(inputChannels);
+    const size_t numOutputs = static_cast<size_t>(outputChannels);
+    if (channelCount >= numInputs * numOutputs)
+    {
+      _processor->clearConvolvers();
+      for (size_t input=0; input<numInputs; ++input)
+      {
+        for (size_t output=0; output<numOutputs; ++output)
+        {
+          IRAgent* agent = _processor->getAgent(input, output);
+          if (agent)
+          {
+            agent->setFile(file, input * numOutputs + output);
+          }
+        }
+      }
+    }
+    else if (channelCount == 1 || channelCount >= numOutputs)
+    {
+      _processor->clearConvolvers();
+      for (size_t output=0; output<numOutputs; ++output)
+      {
+        IRAgent* agent = _processor->getAgent(output % numInputs, output);
+        if (agent)
+        {
+          agent->setFile(file, (channelCount == 1) ? 0 : output);
+        }
+      }
+    }
+  }
+
+  _processor->endConvolverUpdate();
 }
 
 
@@ -23,6 +23,8 @@
 
 #include "../Settings.h"
 
+#include <algorithm>
+
 //[/Headers]
 
 #include "SettingsDialogComponent.h"
@@ -52,6 +54,8 @@ SettingsDialogComponent::SettingsDialogComponent (Processor& processor)
       _headBlockSizeLabel (0),
       _tailBlockSizePrefixLabel (0),
       _tailBlockSizeLabel (0),
+      _latencyBudgetPrefixLabel (0),
+      _latencyBudgetComboBox (0),
       _selectIRDirectoryButton (0),
       cachedImage_hifilofi_jpg (Image())
 {
@@ -132,7 +136,7 @@ SettingsDialogComponent::SettingsDialogComponent (Processor& processor)
     _numberOutputsLabel->setColour(TextEditor::textColourId, Colour(0xff202020));
     _numberOutputsLabel->setColour(TextEditor::backgroundColourId, Colour(0x0));
 
-    addAndMakeVisible(_sseOptimizationPrefixLabel = new Label({}, L"SSE Optimization:"));
+    addAndMakeVisible(_sseOptimizationPrefixLabel = new Label({}, L"SIMD Optimization:"));
     _sseOptimizationPrefixLabel->setFont(Font(15.0000f, Font::plain));
     _sseOptimizationPrefixLabel->setJustificationType(Justification::centredLeft);
     _sseOptimizationPrefixLabel->setEditable(false, false, false);
@@ -180,6 +184,22 @@ SettingsDialogComponent::SettingsDialogComponent (Processor& processor)
     _tailBlockSizeLabel->setColour(TextEditor::textColourId, Colour(0xff202020));
     _tailBlockSizeLabel->setColour(TextEditor::backgroundColourId, Colour(0x0));
 
+    addAndMakeVisible(_latencyBudgetPrefixLabel = new Label({}, L"Latency Budget:"));
+    _latencyBudgetPrefixLabel->setFont(Font(15.0000f, Font::plain));
+    _latencyBudgetPrefixLabel->setJustificationType(Justification::centredLeft);
+    _latencyBudgetPrefixLabel->setEditable(false, false, false);
+    _latencyBudgetPrefixLabel->setColour(Label::textColourId, Colour(0xff202020));
+    _latencyBudgetPrefixLabel->setColour(TextEditor::textColourId, Colour(0xff202020));
+    _latencyBudgetPrefixLabel->setColour(TextEditor::backgroundColourId, Colour(0x0));
+
+    addAndMakeVisible(_latencyBudgetComboBox = new ComboBox({}));
+    _latencyBudgetComboBox->setTooltip(L"Latency the convolution may introduce in exchange for lower CPU load (applies when the host prepares playing the next time)");
+    _latencyBudgetComboBox->setEditableText(false);
+    _latencyBudgetComboBox->setJustificationType(Justification::centredLeft);
+    _latencyBudgetComboBox->setTextWhenNothingSelected({});
+    _latencyBudgetComboBox->setTextWhenNoChoicesAvailable(L"(no choices)");
+    _latencyBudgetComboBox->addListener(this);
+
     addAndMakeVisible(_selectIRDirectoryButton = new TextButton);
     _selectIRDirectoryButton->setButtonText(L"Select Directory");
     _selectIRDirectoryButton->setConnectedEdges(Button::ConnectedOnLeft | Button::ConnectedOnRight);
@@ -200,7 +220,7 @@ SettingsDialogComponent::SettingsDialogComponent (Processor& processor)
     _irDirectoryGroupComponent->addAndMakeVisible(_irDirectoryBrowserComponent.get());
     //[/UserPreSize]
 
-    setSize(504, 580);
+    setSize(504, 600);
 
 
     //[Constructor] You can add your own custom stuff here..
@@ -208,9 +228,34 @@ SettingsDialogComponent::SettingsDialogComponent (Processor& processor)
     _juceVersionLabel->setText(juce::SystemStats::getJUCEVersion(), juce::sendNotification);
     _numberInputsLabel->setText(juce::String(_processor.getTotalNumInputChannels()), juce::sendNotification);
     _numberOutputsLabel->setText(juce::String(_processor.getTotalNumOutputChannels()), juce::sendNotification);
-    _sseOptimizationLabel->setText((fftconvolver::SSEEnabled() == true) ? juce::String("Yes") : juce::String("No"), juce::sendNotification);
-    _headBlockSizeLabel->setText(juce::String(static_cast<int>(_processor.getConvolverHeadBlockSize())), juce::sendNotification);
+    _sseOptimizationLabel->setText(juce::String(fftconvolver::SIMDKernelName(fftconvolver::ActiveSIMDKernel())) + juce::String(" (FFT: ") + juce::String(audiofft::AudioFFT::GetBackendName(audiofft::AudioFFT::GetDefaultBackend())) + juce::String(")"), juce::sendNotification);
+    juce::String headBlockSizeText(static_cast<int>(_processor.getConvolverHeadBlockSize()));
+    if (_processor.getConvolverLatency() > 0)
+    {
+      headBlockSizeText += juce::String(" (Latency: ") + juce::String(static_cast<int>(_processor.getConvolverLatency())) + juce::String(" Samples)");
+    }
+    _headBlockSizeLabel->setText(headBlockSizeText, juce::sendNotification);
     _tailBlockSizeLabel->setText(juce::String(static_cast<int>(_processor.getConvolverTailBlockSize())), juce::sendNotification);
+
+    // Powers of 2 (the convolver rounds the budget down to one anyway), plus
+    // the budget from the settings file if it has been edited by hand
+    const size_t latencyBudget = _processor.getSettings().getLatencyBudget();
+    _latencyBudgets.push_back(0);
+    for (size_t budget=256; budget<=8192; budget*=2)
+    {
+      _latencyBudgets.push_back(budget);
+    }
+    if (std::find(_latencyBudgets.begin(), _latencyBudgets.end(), latencyBudget) == _latencyBudgets.end())
+    {
+      _latencyBudgets.push_back(latencyBudget);
+    }
+    for (size_t i=0; i<_latencyBudgets.size(); ++i)
+    {
+      const juce::String text = (_latencyBudgets[i] > 0) ? juce::String(static_cast<int>(_latencyBudgets[i])) + juce::String(" Samples") : juce::String("None");
+      _latencyBudgetComboBox->addItem(text, static_cast<int>(i+1));
+    }
+    const size_t latencyBudgetIndex = static_cast<size_t>(std::find(_latencyBudgets.begin(), _latencyBudgets.end(), latencyBudget) - _latencyBudgets.begin());
+    _latencyBudgetComboBox->setSelectedId(static_cast<int>(latencyBudgetIndex+1), juce::dontSendNotification);
     //[/Constructor]
 }
 
@@ -237,6 +282,8 @@ SettingsDialogComponent::~SettingsDialogComponent()
     deleteAndZero (_headBlockSizeLabel);
     deleteAndZero (_tailBlockSizePrefixLabel);
     deleteAndZero (_tailBlockSizeLabel);
+    deleteAndZero (_latencyBudgetPrefixLabel);
+    deleteAndZero (_latencyBudgetComboBox);
     deleteAndZero (_selectIRDirectoryButton);
 
 
@@ -269,7 +316,7 @@ void SettingsDialogComponent::resized()
     _nameVersionLabel->setBounds (24, 28, 344, 24);
     _copyrightLabel->setBounds (24, 52, 344, 24);
     _licenseHyperlink->setBounds (160, 76, 184, 24);
-    _infoGroupComponent->setBounds (16, 416, 472, 152);
+    _infoGroupComponent->setBounds (16, 416, 472, 172);
     _juceVersionPrefixLabel->setBounds (24, 436, 140, 24);
     _juceVersionLabel->setBounds (156, 436, 316, 24);
     _numberInputsPrefixLabel->setBounds (24, 456, 140, 24);
@@ -282,6 +329,8 @@ void SettingsDialogComponent::resized()
     _headBlockSizeLabel->setBounds (156, 516, 316, 24);
     _tailBlockSizePrefixLabel->setBounds (24, 536, 140, 24);
     _tailBlockSizeLabel->setBounds (156, 536, 316, 24);
+    _latencyBudgetPrefixLabel->setBounds (24, 556, 140, 24);
+    _latencyBudgetComboBox->setBounds (160, 558, 140, 20);
     _selectIRDirectoryButton->setBounds (352, 372, 124, 24);
     //[UserResized] Add your own custom resize handling here..
     _irDirectoryBrowserComponent->setBounds(4, 12, _irDirectoryGroupComponent->getWidth()-8, _irDirectoryGroupComponent->getHeight()-(_selectIRDirectoryButton->getHeight()+26));
@@ -312,6 +361,26 @@ void SettingsDialogComponent::buttonClicked (Button* buttonThatWasClicked)
     //[/UserbuttonClicked_Post]
 }
 
+void SettingsDialogComponent::comboBoxChanged (ComboBox* comboBoxThatHasChanged)
+{
+    //[UsercomboBoxChanged_Pre]
+    //[/UsercomboBoxChanged_Pre]
+
+    if (comboBoxThatHasChanged == _latencyBudgetComboBox)
+    {
+        //[UserComboBoxCode__latencyBudgetComboBox] -- add your combo box handling code here..
+        const size_t index = static_cast<size_t>(_latencyBudgetComboBox->getSelectedId() - 1);
+        if (index < _latencyBudgets.size())
+        {
+          _processor.getSettings().setLatencyBudget(_latencyBudgets[index]);
+        }
+        //[/UserComboBoxCode__latencyBudgetComboBox]
+    }
+
+    //[UsercomboBoxChanged_Post]
+    //[/UsercomboBoxChanged_Post]
+}
+
 
 
 //[MiscUserCode] You can add your own definitions of your custom methods or any other code here...
@@ -330,7 +399,7 @@ BEGIN_JUCER_METADATA
                  componentName="" parentClasses="public Component" constructorParams="Processor&amp; processor"
                  variableInitialisers="_processor(processor)" snapPixels="4" snapActive="1"
                  snapShown="1" overlayOpacity="0.330000013" fixedSize="1" initialWidth="504"
-                 initialHeight="580">
+                 initialHeight="600">
   <BACKGROUND backgroundColour="ffb1b1b6">
     <IMAGE pos="400 31 74 69" resource="hifilofi_jpg" opacity="1" mode="2"/>
   </BACKGROUND>
@@ -355,7 +424,7 @@ BEGIN_JUCER_METADATA
                    buttonText="Licensed under GPL3" connectedEdges="0" needsCallback="0"
                    radioGroupId="0" url="http://www.gnu.org/licenses"/>
   <GROUPCOMPONENT name="" id="25ac040a541cb0e7" memberName="_infoGroupComponent"
-                  virtualName="" explicitFocusOrder="0" pos="16 416 472 152" textcol="ff202020"
+                  virtualName="" explicitFocusOrder="0" pos="16 416 472 172" textcol="ff202020"
                   title="Plugin Information"/>
   <LABEL name="" id="c4a4ccf3c53f694f" memberName="_juceVersionPrefixLabel"
          virtualName="" explicitFocusOrder="0" pos="24 436 140 24" textCol="ff202020"
@@ -389,7 +458,7 @@ BEGIN_JUCER_METADATA
          fontname="Default font" fontsize="15" bold="0" italic="0" justification="33"/>
   <LABEL name="" id="ad7d4e6a39bb8ab5" memberName="_sseOptimizationPrefixLabel"
          virtualName="" explicitFocusOrder="0" pos="24 496 140 24" textCol="ff202020"
-         edTextCol="ff202020" edBkgCol="0" labelText="SSE Optimization:"
+         edTextCol="ff202020" edBkgCol="0" labelText="SIMD Optimization:"
          editableSingleClick="0" editableDoubleClick="0" focusDiscardsChanges="0"
          fontname="Default font" fontsize="15" bold="0" italic="0" justification="33"/>
   <LABEL name="" id="7a6359296851c399" memberName="_sseOptimizationLabel"
@@ -417,6 +486,14 @@ BEGIN_JUCER_METADATA
          edTextCol="ff202020" edBkgCol="0" labelText="&lt;Unknown&gt;"
          editableSingleClick="0" editableDoubleClick="0" focusDiscardsChanges="0"
          fontname="Default font" fontsize="15" bold="0" italic="0" justification="33"/>
+  <LABEL name="" id="3d2f7a91c54e08b6" memberName="_latencyBudgetPrefixLabel"
+         virtualName="" explicitFocusOrder="0" pos="24 556 140 24" textCol="ff202020"
+         edTextCol="ff202020" edBkgCol="0" labelText="Latency Budget:"
+         editableSingleClick="0" editableDoubleClick="0" focusDiscardsChanges="0"
+         fontname="Default font" fontsize="15" bold="0" italic="0" justification="33"/>
+  <COMBOBOX name="" id="c81e5b0f9a7d3264" memberName="_latencyBudgetComboBox"
+            virtualName="" explicitFocusOrder="0" pos="160 558 140 20" tooltip="Latency the convolution may introduce in exchange for lower CPU load (applies when the host prepares playing the next time)"
+            editable="0" layout="33" items="" textWhenNonSelected="" textWhenNoItems="(no choices)"/>
   <TEXTBUTTON name="" id="12129938a2f63765" memberName="_selectIRDirectoryButton"
               virtualName="" explicitFocusOrder="0" pos="352 372 124 24" buttonText="Select Directory"
               connectedEdges="3" needsCallback="1" radioGroupId="0"/>
@@ -39,7 +39,8 @@
                                                                     //[/Comments]
 */
 class SettingsDialogComponent  : public Component,
-	public Button::Listener
+	public Button::Listener,
+	public ComboBox::Listener
 {
 public:
     //==============================================================================
@@ -53,6 +54,7 @@ public:
     void paint (Graphics& g);
     void resized();
     void buttonClicked (Button* buttonThatWasClicked);
+    void comboBoxChanged (ComboBox* comboBoxThatHasChanged);
 
     // Binary resources:
     static const char* hifilofi_jpg;
@@ -66,6 +68,7 @@ private:
     //[UserVariables]   -- You can add your own custom variables in this section.
     Processor& _processor;
     std::unique_ptr<juce::FileBrowserComponent> _irDirectoryBrowserComponent;
+    std::vector<size_t> _latencyBudgets;
     //[/UserVariables]
 
     //==============================================================================
@@ -87,6 +90,8 @@ private:
     Label* _headBlockSizeLabel;
     Label* _tailBlockSizePrefixLabel;
     Label* _tailBlockSizeLabel;
+    Label* _latencyBudgetPrefixLabel;
+    ComboBox* _latencyBudgetComboBox;
     TextButton* _selectIRDirectoryButton;
     Image cachedImage_hifilofi_jpg;
 